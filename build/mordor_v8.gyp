@@ -32,6 +32,15 @@
       'type': 'none',
       'dependencies': [
         '../test/test.gyp:shell',
+        '../test/test.gyp:counters_tool',
+      ],
+    },
+    {
+      'target_name': 'mordor_v8_bench',
+      'type': 'none',
+      'dependencies': [
+        '../test/test.gyp:bench',
+        '../test/test.gyp:binding_bench',
       ],
     },
   ],
@@ -7,6 +7,7 @@
       'dependencies': [
         '../third_party/mordor-base/gyp/mordor.gyp:mordor_base',
         '../third_party/v8/mordor_v8_patch/gen/v8.gyp:v8',
+        '../trace/trace.gyp:mordor_trace',
       ],
       'include_dirs': [
         '.',
@@ -14,6 +14,8 @@
 #include "mordor/workerpool.h"
 #include "mordor/timer.h"
 
+#include "md_trace.h"
+
 namespace Mordor
 {
 namespace Platform
@@ -69,6 +71,7 @@ void DefaultPlatform::EnsureInitialized()
 void DefaultPlatform::runOnBackground(v8::Task *task)
 {
     std::unique_ptr<Task> t(task);
+    MD_TRACE_SCOPE("platform", "v8::Task::Run");
     t->Run();
 }
 
@@ -89,6 +92,7 @@ double DefaultPlatform::MonotonicallyIncreasingTime()
 void DefaultPlatform::CallOnBackgroundThread(v8::Task *task, v8::Platform::ExpectedRuntime expected_runtime)
 {
     EnsureInitialized();
+    MD_TRACE_INSTANT("platform", "CallOnBackgroundThread");
     scheduler_->schedule(std::bind(&DefaultPlatform::runOnBackground, this, task));
 }
 
@@ -0,0 +1,214 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#include "v8.h"
+#include "mordor/config.h"
+
+#include "md_bench.h"
+#include "md_clock.h"
+#include "md_json.h"
+#include "md_stats_summary.h"
+
+#ifdef LINUX
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+namespace Mordor
+{
+namespace Test
+{
+
+static ConfigVar<int>::ptr g_warmup =
+        Config::lookup("mdv8.bench.warmup", 3,
+                "Untimed repetitions before measuring each benchmark");
+static ConfigVar<int>::ptr g_repetitions =
+        Config::lookup("mdv8.bench.repetitions", 20,
+                "Timed repetitions of each benchmark");
+static ConfigVar<std::string>::ptr g_filter =
+        Config::lookup("mdv8.bench.filter", std::string(),
+                "Only run benchmarks whose name contains this string");
+static ConfigVar<std::string>::ptr g_output =
+        Config::lookup("mdv8.bench.output", std::string(),
+                "Write the JSON results to this file instead of stdout");
+static ConfigVar<bool>::ptr g_perf =
+        Config::lookup("mdv8.bench.perf", true,
+                "Count hardware cache misses with perf events where available");
+
+/**
+ * Hardware cache misses of every thread in the process. The IOManager
+ * threads exist before the suite, so instead of inheriting one counter
+ * each thread listed in /proc/self/task gets its own.
+ */
+class CacheMissCounter
+{
+public:
+    CacheMissCounter()
+    {
+#ifdef LINUX
+        DIR* dir = opendir("/proc/self/task");
+        if (dir == NULL)
+            return;
+        while (struct dirent* entry = readdir(dir)) {
+            if (entry->d_name[0] == '.')
+                continue;
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            int fd = static_cast<int>(syscall(__NR_perf_event_open, &attr,
+                                              atoi(entry->d_name), -1, -1, 0));
+            if (fd >= 0)
+                fds_.push_back(fd);
+        }
+        closedir(dir);
+#endif
+    }
+
+    ~CacheMissCounter()
+    {
+#ifdef LINUX
+        for (size_t i = 0; i < fds_.size(); ++i)
+            close(fds_[i]);
+#endif
+    }
+
+    bool available() const
+    {
+        return !fds_.empty();
+    }
+
+    void start()
+    {
+#ifdef LINUX
+        for (size_t i = 0; i < fds_.size(); ++i) {
+            ioctl(fds_[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    uint64_t stop()
+    {
+        uint64_t total = 0;
+#ifdef LINUX
+        for (size_t i = 0; i < fds_.size(); ++i) {
+            ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t count = 0;
+            if (read(fds_[i], &count, sizeof(count)) == sizeof(count))
+                total += count;
+        }
+#endif
+        return total;
+    }
+
+private:
+    std::vector<int> fds_;
+};
+
+BenchSuite::BenchSuite() :
+        filter_(g_filter->val()),
+        warmup_(std::max(g_warmup->val(), 0)),
+        repetitions_(std::max(g_repetitions->val(), 1))
+{
+    if (g_perf->val()) {
+        cache_misses_.reset(new CacheMissCounter());
+        if (!cache_misses_->available())
+            cache_misses_.reset();
+    }
+}
+
+BenchSuite::~BenchSuite()
+{
+}
+
+bool BenchSuite::enabled(const char* name) const
+{
+    return filter_.empty() || std::string(name).find(filter_) != std::string::npos;
+}
+
+void BenchSuite::run(const char* name, size_t iterations, const Body& body)
+{
+    if (!enabled(name))
+        return;
+    for (int i = 0; i < warmup_; ++i)
+        body(iterations);
+
+    Result result;
+    result.name = name;
+    result.iterations = iterations;
+    for (int i = 0; i < repetitions_; ++i) {
+        if (cache_misses_)
+            cache_misses_->start();
+        uint64_t start = MonotonicNanos();
+        body(iterations);
+        uint64_t elapsed = MonotonicNanos() - start;
+        if (cache_misses_)
+            result.cache_misses.push_back(static_cast<double>(cache_misses_->stop()) / iterations);
+        result.samples.push_back(static_cast<double>(elapsed) / iterations);
+    }
+    fprintf(stderr, "%-28s %12.1f ns/op\n", name,
+            *std::min_element(result.samples.begin(), result.samples.end()));
+    results_.push_back(result);
+}
+
+void BenchSuite::writeJson(std::ostream& os) const
+{
+    std::string out("{\"v8\":");
+    AppendJsonString(out, v8::V8::GetVersion());
+    char numbers[256];
+    snprintf(numbers, sizeof(numbers), ",\"warmup\":%d,\"repetitions\":%d,\"unit\":\"ns/op\",\"benchmarks\":[",
+             warmup_, repetitions_);
+    out += numbers;
+    for (size_t i = 0; i < results_.size(); ++i) {
+        const Result& result = results_[i];
+        std::vector<double> samples(result.samples);
+        SampleSummary summary = Summarize(samples);
+
+        out += i ? ",{\"name\":" : "{\"name\":";
+        AppendJsonString(out, result.name);
+        snprintf(numbers, sizeof(numbers),
+                 ",\"iterations\":%zu,\"mean\":%.3f,\"stddev\":%.3f,\"min\":%.3f,\"max\":%.3f,"
+                 "\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f",
+                 result.iterations, summary.mean, summary.stddev, summary.min, summary.max,
+                 summary.p50, summary.p90, summary.p99);
+        out += numbers;
+        if (!result.cache_misses.empty()) {
+            double misses = 0;
+            for (size_t j = 0; j < result.cache_misses.size(); ++j)
+                misses += result.cache_misses[j];
+            snprintf(numbers, sizeof(numbers), ",\"cacheMisses\":%.3f",
+                     misses / result.cache_misses.size());
+            out += numbers;
+        }
+        out += "}";
+    }
+    out += "]}\n";
+    os << out;
+    os.flush();
+}
+
+void BenchSuite::writeJson() const
+{
+    if (g_output->val().empty()) {
+        writeJson(std::cout);
+        return;
+    }
+    std::ofstream file(g_output->val().c_str());
+    writeJson(file);
+}
+
+} } // namespace Mordor::Test
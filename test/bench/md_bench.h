@@ -0,0 +1,65 @@
+#ifndef MD_BENCH_H_
+#define MD_BENCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Mordor
+{
+namespace Test
+{
+
+class CacheMissCounter;
+
+/**
+ * BenchSuite
+ *
+ * Runs each benchmark body for --mdv8.bench.warmup untimed and then
+ * --mdv8.bench.repetitions timed repetitions. A body performs the given
+ * number of operations per call; every repetition yields one ns/op sample,
+ * and the samples are summarized when the suite is written as JSON.
+ * --mdv8.bench.filter restricts the run to names containing the string.
+ *
+ * Where perf events are available (Linux, --mdv8.bench.perf) hardware
+ * cache misses of all threads are counted as well and reported per op.
+ */
+class BenchSuite
+{
+public:
+    typedef std::function<void (size_t iterations)> Body;
+
+    struct Result
+    {
+        std::string name;
+        size_t iterations;
+        std::vector<double> samples;    // ns/op, one per repetition
+        std::vector<double> cache_misses;   // per op, if counted
+    };
+
+    BenchSuite();
+    ~BenchSuite();
+
+    bool enabled(const char* name) const;
+    void run(const char* name, size_t iterations, const Body& body);
+
+    void writeJson(std::ostream& os) const;
+    // Writes to --mdv8.bench.output, stdout if empty.
+    void writeJson() const;
+
+private:
+    std::string filter_;
+    int warmup_;
+    int repetitions_;
+    std::vector<Result> results_;
+    std::unique_ptr<CacheMissCounter> cache_misses_;
+};
+
+} } // namespace Mordor::Test
+
+#endif // MD_BENCH_H_
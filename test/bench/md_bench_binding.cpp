@@ -0,0 +1,147 @@
+// Microbenchmark for native method dispatch.
+//
+// Compares a ClassBinding method, which gets its receiver from an internal
+// field and its Environment from the callback data, against a plain function
+// that resolves the Environment through Environment::GetCurrent(isolate).
+
+#include <stdio.h>
+#include <functional>
+
+#include "v8.h"
+#include "v8/include/libplatform/libplatform.h"
+
+#include "mordor/main.h"
+#include "mordor/iomanager.h"
+#include "mordor/timer.h"
+#include "mordor/fibersynchronization.h"
+
+#include "md_env.h"
+#include "md_env_inl.h"
+#include "md_guarded.h"
+#include "js_objects/class_binding.h"
+
+using namespace Mordor;
+using namespace Mordor::Test;
+
+namespace
+{
+
+const int kCalls = 10000000;
+
+class Counter : public ObjectWrap
+{
+public:
+    Counter(Environment* env, v8::Local<v8::Object> object, const v8::FunctionCallbackInfo<v8::Value>& args) :
+            ObjectWrap(env, object), count_(0)
+    {
+    }
+
+    void increment(Environment* env, const v8::FunctionCallbackInfo<v8::Value>& args)
+    {
+        ++count_;
+    }
+
+    void value(Environment* env, const v8::FunctionCallbackInfo<v8::Value>& args)
+    {
+        args.GetReturnValue().Set(static_cast<double>(count_));
+    }
+
+    static const ClassBinding<Counter>::MethodEntry kMethods[];
+
+private:
+    int64_t count_;
+};
+
+const ClassBinding<Counter>::MethodEntry Counter::kMethods[] = {
+    MD_BINDING_METHOD(Counter, "increment", increment),
+    MD_BINDING_METHOD(Counter, "value", value),
+};
+
+int64_t g_legacy_count = 0;
+
+void LegacyIncrement(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Environment* env = Environment::GetCurrent(args.GetIsolate());
+    if (env != NULL)
+        ++g_legacy_count;
+}
+
+void runScenario(Environment* env, const char* name, const char* source)
+{
+    v8::Isolate* isolate = env->isolate();
+    v8::HandleScope handle_scope(isolate);
+    v8::TryCatch try_catch;
+    v8::Local<v8::Script> script = v8::Script::Compile(Utf8String(isolate, source), Utf8String(isolate, name));
+    if (script.IsEmpty()) {
+        v8::String::Utf8Value error(try_catch.Exception());
+        fprintf(stderr, "%s: compile failed: %s\n", name, *error);
+        return;
+    }
+
+    unsigned long long start = TimerManager::now();
+    v8::Local<v8::Value> result = script->Run();
+    unsigned long long elapsed = TimerManager::now() - start;
+    if (result.IsEmpty()) {
+        v8::String::Utf8Value error(try_catch.Exception());
+        fprintf(stderr, "%s: run failed: %s\n", name, *error);
+        return;
+    }
+
+    double seconds = elapsed / 1000000.0;
+    printf("%-10s %d calls in %.3f ms, %.0f calls/s\n", name, kCalls, elapsed / 1000.0, kCalls / seconds);
+}
+
+void runBenchmark(FiberSemaphore& done)
+{
+    v8::Platform* v8_platform = v8::platform::CreateDefaultPlatform(1);
+    v8::V8::InitializeICU();
+    v8::V8::InitializePlatform(v8_platform);
+    v8::V8::Initialize();
+
+    v8::Isolate* isolate = v8::Isolate::New();
+    {
+        v8::Isolate::Scope isolate_scope(isolate);
+        v8::Locker locker(isolate);
+        v8::HandleScope handle_scope(isolate);
+        v8::Local<v8::Context> context = v8::Context::New(isolate);
+        v8::Context::Scope context_scope(context);
+        Environment* env = Environment::New(context, Scheduler::getThis());
+
+        v8::Local<v8::Object> global = context->Global();
+        ClassBinding<Counter>::Install(env, global, "Counter", Counter::kMethods);
+        JSObjectUtils::setMethod(global, isolate, "legacyIncrement", LegacyIncrement);
+
+        char source[256];
+        snprintf(source, sizeof(source),
+                 "(function() { var c = new Counter();"
+                 " for (var i = 0; i < %d; ++i) c.increment(); return c.value(); })()",
+                 kCalls);
+        runScenario(env, "binding", source);
+
+        snprintf(source, sizeof(source),
+                 "(function() { for (var i = 0; i < %d; ++i) legacyIncrement(); })()",
+                 kCalls);
+        runScenario(env, "legacy", source);
+
+        Environment::environment.reset();
+    }
+    ReleasePendingInterrupts(isolate);
+    isolate->Dispose();
+
+    v8::V8::Dispose();
+    v8::V8::ShutdownPlatform();
+    delete v8_platform;
+
+    done.notify();
+}
+
+} // namespace
+
+MORDOR_MAIN(int argc, char* argv[])
+{
+    IOManager iom(1);
+    FiberSemaphore done;
+    iom.schedule(std::bind(&runBenchmark, std::ref(done)));
+    done.wait();
+    return 0;
+}
@@ -0,0 +1,290 @@
+// Microbenchmarks for the embedding hot paths, see BenchSuite.
+//
+//   md_bench [--mdv8.bench.filter=doTask] [--mdv8.bench.output=out.json]
+//
+// Results go to stdout (or the output file) as JSON, the best repetition of each
+// benchmark to stderr as it finishes.
+
+#include <stdio.h>
+
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "v8.h"
+#include "v8/include/libplatform/libplatform.h"
+
+#include "mordor/config.h"
+#include "mordor/main.h"
+#include "mordor/iomanager.h"
+#include "mordor/fibersynchronization.h"
+
+#include "md_array_buffer_allocator.h"
+#include "md_env.h"
+#include "md_env_inl.h"
+#include "md_guarded.h"
+#include "md_task.h"
+#include "md_task_queue.h"
+#include "md_worker.h"
+#include "bench/md_bench.h"
+
+using namespace Mordor;
+using namespace Mordor::Test;
+
+namespace
+{
+
+typedef MD_Task<void(TASK)> NoopTask;
+typedef MD_Task<void(TASK_V8)> NoopV8Task;
+
+const int kProducers = 4;
+const int kConsumers = 4;
+
+void noop(NoopTask&)
+{
+}
+
+void noopV8(NoopV8Task&)
+{
+}
+
+void benchDoTask(Environment* env, size_t iterations)
+{
+    for (size_t i = 0; i < iterations; ++i)
+        env->worker()->doTask<void, TASK>(&noop, TaskOptions("bench"));
+}
+
+void benchDoTaskV8(Environment* env, size_t iterations)
+{
+    v8::HandleScope handle_scope(env->isolate());
+    v8::Local<v8::Context> context = env->context();
+    for (size_t i = 0; i < iterations; ++i)
+        env->worker()->doTask<void, TASK_V8>(context, &noopV8, TaskOptions("bench"));
+}
+
+// kProducers fibers append, kConsumers fibers drain, all spread over the
+// IOManager's threads.
+void benchQueueContention(IOManager& iom, std::vector<std::unique_ptr<NoopTask> >& tasks,
+                          size_t iterations)
+{
+    MD_TaskQueue queue;
+    FiberSemaphore finished;
+    std::atomic<int> producers(kProducers);
+    for (int p = 0; p < kProducers; ++p) {
+        iom.schedule([&, p]() {
+            for (size_t i = p; i < iterations; i += kProducers)
+                queue.append(tasks[i].get());
+            if (producers.fetch_sub(1) == 1)
+                queue.terminate();
+            finished.notify();
+        });
+    }
+    for (int c = 0; c < kConsumers; ++c) {
+        iom.schedule([&]() {
+            while (Task* task = queue.getNext())
+                task->Call();
+            finished.notify();
+        });
+    }
+    for (int i = 0; i < kProducers + kConsumers; ++i)
+        finished.wait();
+}
+
+// A little JS touching a few pages of the heap, so it matters whether the
+// isolate stays on one core.
+static const char kAffinityWorkload[] =
+        "(function() {"
+        "  var a = new Array(4096);"
+        "  for (var i = 0; i < a.length; ++i) a[i] = { v: i };"
+        "  return function() {"
+        "    var s = 0;"
+        "    for (var i = 0; i < a.length; ++i) s += a[i].v;"
+        "    return s;"
+        "  };"
+        "})()";
+
+void affinityTask(NoopV8Task& self, v8::Persistent<v8::Function>* workload)
+{
+    v8::Local<v8::Function> fn = StrongPersistentToLocal(*workload);
+    fn->Call(self.context()->Global(), 0, NULL);
+}
+
+// TASK_V8 round trips running kAffinityWorkload, on a worker with or
+// without isolate affinity.
+void benchIsolateAffinity(MD_Worker* worker, v8::Isolate* isolate,
+                          v8::Persistent<v8::Function>* workload, size_t iterations)
+{
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = isolate->GetCurrentContext();
+    for (size_t i = 0; i < iterations; ++i) {
+        worker->doTask<void, TASK_V8>(context, std::bind(&affinityTask, std::placeholders::_1, workload),
+                                      TaskOptions("bench"));
+    }
+}
+
+void benchContextNew(v8::Isolate* isolate, size_t iterations)
+{
+    for (size_t i = 0; i < iterations; ++i) {
+        v8::HandleScope handle_scope(isolate);
+        v8::Context::New(isolate);
+    }
+}
+
+// Replaces the current Environment each time, like a fresh shell would.
+void benchEnvironmentNew(v8::Isolate* isolate, Scheduler* scheduler, size_t iterations)
+{
+    for (size_t i = 0; i < iterations; ++i) {
+        v8::HandleScope handle_scope(isolate);
+        v8::Local<v8::Context> context = v8::Context::New(isolate);
+        v8::Context::Scope context_scope(context);
+        Environment::New(context, scheduler);
+    }
+}
+
+void benchUtf8String(v8::Isolate* isolate, const char* data, size_t iterations)
+{
+    v8::HandleScope handle_scope(isolate);
+    for (size_t i = 0; i < iterations; ++i)
+        Utf8String(isolate, data);
+}
+
+void benchOneByteString(v8::Isolate* isolate, const char* data, size_t iterations)
+{
+    v8::HandleScope handle_scope(isolate);
+    for (size_t i = 0; i < iterations; ++i)
+        OneByteString(isolate, data);
+}
+
+void benchAllocator(size_t length, size_t iterations)
+{
+    ArrayBufferAllocator& allocator = ArrayBufferAllocator::the_singleton;
+    for (size_t i = 0; i < iterations; ++i)
+        allocator.Free(allocator.Allocate(length), length);
+}
+
+void benchArrayBufferNew(v8::Isolate* isolate, size_t length, size_t iterations)
+{
+    v8::HandleScope handle_scope(isolate);
+    for (size_t i = 0; i < iterations; ++i)
+        v8::ArrayBuffer::New(isolate, length);
+}
+
+// What ExecuteString does for every line typed into the shell, minus the
+// printing. With |unique| set every source differs, defeating V8's
+// compilation cache.
+void benchCompileRun(v8::Isolate* isolate, bool unique, size_t iterations)
+{
+    static const char kSource[] =
+            "var a = [1, 2, 3, 4]; a.map(function(x) { return x * 2; }).length";
+    char source[128];
+    for (size_t i = 0; i < iterations; ++i) {
+        v8::HandleScope handle_scope(isolate);
+        v8::TryCatch try_catch;
+        if (unique)
+            snprintf(source, sizeof(source), "%s // %zu", kSource, i);
+        v8::Local<v8::Script> script = v8::Script::Compile(
+                Utf8String(isolate, unique ? source : kSource), OneByteString(isolate, "bench"));
+        if (!script.IsEmpty())
+            script->Run();
+    }
+}
+
+void runBenchmarks(IOManager& iom, FiberSemaphore& done)
+{
+    v8::Platform* v8_platform = v8::platform::CreateDefaultPlatform(1);
+    v8::V8::InitializeICU();
+    v8::V8::InitializePlatform(v8_platform);
+    v8::V8::Initialize();
+    v8::V8::SetArrayBufferAllocator(&ArrayBufferAllocator::the_singleton);
+
+    BenchSuite suite;
+    v8::Isolate* isolate = v8::Isolate::New();
+    {
+        v8::Isolate::Scope isolate_scope(isolate);
+        v8::Locker locker(isolate);
+        v8::HandleScope handle_scope(isolate);
+        v8::Local<v8::Context> context = v8::Context::New(isolate);
+        v8::Context::Scope context_scope(context);
+        Environment* env = Environment::New(context, &iom);
+
+        suite.run("doTask.TASK", 10000, std::bind(&benchDoTask, env, std::placeholders::_1));
+        suite.run("doTask.TASK_V8", 10000, std::bind(&benchDoTaskV8, env, std::placeholders::_1));
+
+        const size_t kQueueTasks = 100000;
+        std::vector<std::unique_ptr<NoopTask> > tasks;
+        if (suite.enabled("taskQueue.contention")) {
+            for (size_t i = 0; i < kQueueTasks; ++i)
+                tasks.push_back(std::unique_ptr<NoopTask>(new NoopTask(&noop)));
+        }
+        suite.run("taskQueue.contention", kQueueTasks,
+                  std::bind(&benchQueueContention, std::ref(iom), std::ref(tasks), std::placeholders::_1));
+        tasks.clear();
+
+        static const char kAscii[] = "The quick brown fox jumps over the lazy dog, 0123456789 times.";
+        static const char kUtf8[] = "Sch\xc3\xb6ne Gr\xc3\xbc\xc3\x9f" "e, \xe4\xbd\xa0\xe5\xa5\xbd, \xf0\x9f\x98\x80 and more text";
+        suite.run("string.utf8.ascii", 100000,
+                  std::bind(&benchUtf8String, isolate, kAscii, std::placeholders::_1));
+        suite.run("string.utf8.multibyte", 100000,
+                  std::bind(&benchUtf8String, isolate, kUtf8, std::placeholders::_1));
+        suite.run("string.oneByte", 100000,
+                  std::bind(&benchOneByteString, isolate, kAscii, std::placeholders::_1));
+
+        suite.run("allocator.4k", 100000, std::bind(&benchAllocator, 4096, std::placeholders::_1));
+        suite.run("allocator.1m", 1000, std::bind(&benchAllocator, 1 << 20, std::placeholders::_1));
+        suite.run("arrayBuffer.new.4k", 10000,
+                  std::bind(&benchArrayBufferNew, isolate, 4096, std::placeholders::_1));
+
+        suite.run("compileRun.cached", 10000,
+                  std::bind(&benchCompileRun, isolate, false, std::placeholders::_1));
+        suite.run("compileRun.uncached", 1000,
+                  std::bind(&benchCompileRun, isolate, true, std::placeholders::_1));
+
+        if (suite.enabled("isolateAffinity")) {
+            v8::Local<v8::Script> script = v8::Script::Compile(OneByteString(isolate, kAffinityWorkload));
+            v8::Persistent<v8::Function> workload(isolate, script->Run().As<v8::Function>());
+            {
+                std::unique_ptr<MD_Worker> worker(MD_Worker::New(&iom, 4));
+                suite.run("isolateAffinity.shared", 2000,
+                          std::bind(&benchIsolateAffinity, worker.get(), isolate, &workload,
+                                    std::placeholders::_1));
+            }
+            {
+                std::unique_ptr<MD_Worker> worker(MD_Worker::New(&iom, 4, gettid()));
+                suite.run("isolateAffinity.pinned", 2000,
+                          std::bind(&benchIsolateAffinity, worker.get(), isolate, &workload,
+                                    std::placeholders::_1));
+            }
+            workload.Reset();
+        }
+
+        suite.run("context.new", 100, std::bind(&benchContextNew, isolate, std::placeholders::_1));
+        // Replaces |env|, keep it last.
+        suite.run("environment.new", 20,
+                  std::bind(&benchEnvironmentNew, isolate, &iom, std::placeholders::_1));
+
+        Environment::environment.reset();
+    }
+    ReleasePendingInterrupts(isolate);
+    isolate->Dispose();
+
+    v8::V8::Dispose();
+    v8::V8::ShutdownPlatform();
+    delete v8_platform;
+
+    suite.writeJson();
+    done.notify();
+}
+
+} // namespace
+
+MORDOR_MAIN(int argc, char* argv[])
+{
+    Config::loadFromCommandLine(argc, argv);
+    IOManager iom(4);
+    FiberSemaphore done;
+    iom.schedule(std::bind(&runBenchmarks, std::ref(iom), std::ref(done)));
+    done.wait();
+    return 0;
+}
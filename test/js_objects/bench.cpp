@@ -0,0 +1,164 @@
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "bench.h"
+#include "jsobject_utils.h"
+#include "md_clock.h"
+#include "md_memory.h"
+#include "md_stats_summary.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+static const double kMaxIterations = 1 << 30;
+static const double kMaxSamples = 100000;
+
+// Sets |result| to options[name], or |default_value| when it is not a
+// number. Returns false if the getter threw, the exception is left pending.
+static bool NumberOption(v8::Isolate* isolate, v8::Local<v8::Object> options,
+                         const char* name, double default_value, double* result)
+{
+    *result = default_value;
+    if (options.IsEmpty())
+        return true;
+    v8::Local<v8::Value> value = options->Get(OneByteString(isolate, name));
+    if (value.IsEmpty())
+        return false;
+    if (value->IsNumber())
+        *result = value->NumberValue();
+    return true;
+}
+
+// Calls |fn| |iterations| times. Returns false if it threw or the script
+// was terminated, the exception is left pending for the caller.
+static bool RunBatch(v8::Isolate* isolate, v8::Local<v8::Function> fn, double iterations)
+{
+    v8::Local<v8::Value> receiver = v8::Undefined(isolate);
+    for (double i = 0; i < iterations; ++i) {
+        if (fn->Call(receiver, 0, NULL).IsEmpty())
+            return false;
+    }
+    return true;
+}
+
+// %OptimizeFunctionOnNextCall(fn), if the parser accepts natives syntax.
+static bool OptimizeOnNextCall(v8::Isolate* isolate, v8::Local<v8::Function> fn)
+{
+    v8::TryCatch try_catch;
+    v8::Local<v8::Script> script = v8::Script::Compile(
+            OneByteString(isolate, "(function(f) { %OptimizeFunctionOnNextCall(f); })"));
+    if (script.IsEmpty())
+        return false;
+    v8::Local<v8::Value> helper = script->Run();
+    if (helper.IsEmpty() || !helper->IsFunction())
+        return false;
+    v8::Local<v8::Value> argv[] = { fn };
+    return !helper.As<v8::Function>()->Call(v8::Undefined(isolate), 1, argv).IsEmpty();
+}
+
+static void Bench(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Environment* env = Environment::GetCurrent(args);
+    v8::Isolate* isolate = env->isolate();
+    v8::HandleScope scope(isolate);
+    if (!args[0]->IsFunction()) {
+        env->ThrowTypeError("bench() expects a function");
+        return;
+    }
+    v8::Local<v8::Function> fn = args[0].As<v8::Function>();
+    v8::Local<v8::Object> options;
+    if (args[1]->IsObject())
+        options = args[1].As<v8::Object>();
+
+    double samples_option, warmup_option, min_time, iterations;
+    if (!NumberOption(isolate, options, "samples", 20, &samples_option) ||
+        !NumberOption(isolate, options, "warmup", 3, &warmup_option) ||
+        !NumberOption(isolate, options, "minTime", 10, &min_time) ||
+        !NumberOption(isolate, options, "iterations", 0, &iterations))
+        return;
+    bool optimize = true;
+    if (!options.IsEmpty() && options->Has(OneByteString(isolate, "optimize"))) {
+        v8::Local<v8::Value> value = options->Get(OneByteString(isolate, "optimize"));
+        if (value.IsEmpty())
+            return;
+        optimize = value->BooleanValue();
+    }
+    // Checked before any conversion, NaN fails every comparison.
+    if (!(samples_option >= 1 && samples_option <= kMaxSamples) ||
+        !(warmup_option >= 0 && warmup_option <= kMaxSamples) ||
+        !(min_time >= 0 && min_time <= 3600 * 1e3) ||
+        !(iterations >= 0 && iterations <= kMaxIterations)) {
+        env->ThrowRangeError("bench() options out of range");
+        return;
+    }
+    int samples = static_cast<int>(samples_option);
+    int warmup = static_cast<int>(warmup_option);
+    min_time *= 1e6;
+    iterations = floor(iterations);
+
+    // Calibrate: double the batch until it takes minTime.
+    if (iterations == 0) {
+        iterations = 1;
+        for (;;) {
+            uint64_t start = MonotonicNanos();
+            if (!RunBatch(isolate, fn, iterations))
+                return;
+            if (MonotonicNanos() - start >= min_time || iterations >= kMaxIterations)
+                break;
+            iterations *= 2;
+        }
+    }
+
+    bool optimized = false;
+    for (int i = 0; i < warmup; ++i) {
+        if (!RunBatch(isolate, fn, iterations))
+            return;
+        if (optimize && i == 0)
+            optimized = OptimizeOnNextCall(isolate, fn);
+    }
+
+    GcStats* gc_stats = env->gc_stats();
+    std::vector<double> per_call;
+    per_call.reserve(samples);
+    uint64_t gc_excluded = 0;
+    for (int i = 0; i < samples; ++i) {
+        uint64_t gc_before = gc_stats->totalPause();
+        uint64_t start = MonotonicNanos();
+        if (!RunBatch(isolate, fn, iterations))
+            return;
+        uint64_t elapsed = MonotonicNanos() - start;
+        // totalPause() is in microseconds.
+        uint64_t gc = (gc_stats->totalPause() - gc_before) * 1000;
+        gc = std::min(gc, elapsed);
+        gc_excluded += gc;
+        per_call.push_back((elapsed - gc) / iterations);
+    }
+
+    SampleSummary summary = Summarize(per_call);
+
+    v8::Local<v8::Object> result = v8::Object::New(isolate);
+    JSObjectUtils::setNumber(isolate, result, "iterations", iterations);
+    JSObjectUtils::setNumber(isolate, result, "samples", samples);
+    JSObjectUtils::setNumber(isolate, result, "mean", summary.mean);
+    JSObjectUtils::setNumber(isolate, result, "stddev", summary.stddev);
+    JSObjectUtils::setNumber(isolate, result, "min", summary.min);
+    JSObjectUtils::setNumber(isolate, result, "max", summary.max);
+    JSObjectUtils::setNumber(isolate, result, "p50", summary.p50);
+    JSObjectUtils::setNumber(isolate, result, "p90", summary.p90);
+    JSObjectUtils::setNumber(isolate, result, "p99", summary.p99);
+    JSObjectUtils::setNumber(isolate, result, "gcTime", gc_excluded / 1e6);
+    result->Set(OneByteString(isolate, "optimized"), v8::Boolean::New(isolate, optimized));
+    args.GetReturnValue().Set(result);
+}
+
+void BenchObject::setup()
+{
+    v8::HandleScope handleScope(isolate_);
+    JSObjectUtils::setMethod(isolate_->GetCurrentContext()->Global(), env_, name, Bench);
+}
+
+} } // namespace Mordor::Test
@@ -0,0 +1,35 @@
+#ifndef MD_JSOBJECT_BENCH_H_
+#define MD_JSOBJECT_BENCH_H_
+
+#include "class_base.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+/**
+ * Installs the global bench(fn, [options]).
+ *
+ * fn is called in batches sized so one batch takes at least
+ * options.minTime ms (default 10), or exactly options.iterations times.
+ * options.warmup batches (default 3) run untimed first; when V8 was
+ * started with --allow-natives-syntax fn is also optimized between them.
+ * options.samples timed batches (default 20) follow, each with the GC
+ * pauses that fell into it subtracted. Returns ns per call as
+ * { mean, stddev, min, max, p50, p90, p99 } together with iterations,
+ * samples, gcTime (ms excluded) and optimized. Percentiles are nearest
+ * rank, as in md_bench, see SampleSummary. samples and warmup are capped
+ * at 100000, minTime at an hour.
+ */
+class BenchObject : public ClassBase
+{
+public:
+    BenchObject(Environment* env) : ClassBase(env, name){}
+    constexpr static const char* name { "bench" } ;
+    virtual void setup() override;
+};
+
+} } // namespace Mordor::Test
+
+#endif // MD_JSOBJECT_BENCH_H_
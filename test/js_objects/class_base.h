@@ -50,7 +50,7 @@ public:
 
     void setMethod(const char* name, v8::FunctionCallback callback)
     {
-        JSObjectUtils::setMethod(object_, isolate_, name, callback);
+        JSObjectUtils::setMethod(object_, env_, name, callback);
     }
 
     void setTo(v8::Local<v8::Object> target, v8::Local<v8::String> name)
@@ -65,7 +65,7 @@ public:
 
     void setToGlobal(v8::Local<v8::String> name)
     {
-        v8::Local<v8::Object> global = env_->context()->Global();
+        v8::Local<v8::Object> global = isolate_->GetCurrentContext()->Global();
         setTo(global, name);
     }
 
@@ -0,0 +1,161 @@
+#ifndef MD_JSOBJECT_CLASS_BINDING_H_
+#define MD_JSOBJECT_CLASS_BINDING_H_
+
+#include <stddef.h>
+
+#include "v8.h"
+#include "mordor/util.h"
+#include "jsobject_utils.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+/**
+ * Base of every native object exposed through ClassBinding.
+ *
+ * The native pointer lives in internal field 0 of the JS object, the JS
+ * object is held weakly and deletes its native peer when it is collected.
+ */
+class ObjectWrap : Mordor::noncopyable
+{
+public:
+    ObjectWrap(Environment* env, v8::Local<v8::Object> object) :
+            env_(env), handle_(env->isolate(), object)
+    {
+        Wrap(object, this);
+        handle_.SetWeak(this, WeakCallback);
+    }
+
+    virtual ~ObjectWrap()
+    {
+        if (handle_.IsEmpty())
+            return;
+        v8::HandleScope handle_scope(env_->isolate());
+        ClearWrap(object());
+        handle_.Reset();
+    }
+
+    Environment* env() const
+    {
+        return env_;
+    }
+
+    v8::Local<v8::Object> object() const
+    {
+        return PersistentToLocal(env_->isolate(), handle_);
+    }
+
+private:
+    static void WeakCallback(const v8::WeakCallbackData<v8::Object, ObjectWrap>& data)
+    {
+        ObjectWrap* wrap = data.GetParameter();
+        wrap->handle_.Reset();
+        delete wrap;
+    }
+
+    Environment* const env_;
+    v8::Persistent<v8::Object> handle_;
+};
+
+/**
+ * Binds the C++ class |T| (an ObjectWrap) to a JS constructor.
+ *
+ * |T| supplies a constructor T(Environment*, v8::Local<v8::Object>, args)
+ * and a method table built with MD_BINDING_METHOD. Every table entry is a
+ * Dispatch<> instantiation, so the thunk for each method is generated at
+ * compile time. Methods are installed with a receiver signature and the
+ * Environment as callback data, a call therefore costs one internal field
+ * load and never looks at the current context.
+ *
+ *   class Counter : public ObjectWrap {
+ *   public:
+ *       Counter(Environment* env, v8::Local<v8::Object> object,
+ *               const v8::FunctionCallbackInfo<v8::Value>& args);
+ *       void increment(Environment* env, const v8::FunctionCallbackInfo<v8::Value>& args);
+ *       static const ClassBinding<Counter>::MethodEntry kMethods[];
+ *   };
+ *   const ClassBinding<Counter>::MethodEntry Counter::kMethods[] = {
+ *       MD_BINDING_METHOD(Counter, "increment", increment),
+ *   };
+ *   ClassBinding<Counter>::Define(env, "Counter", Counter::kMethods);
+ */
+template <typename T>
+class ClassBinding
+{
+public:
+    typedef void (T::*Method)(Environment* env, const v8::FunctionCallbackInfo<v8::Value>& args);
+
+    struct MethodEntry
+    {
+        const char* name;
+        v8::FunctionCallback callback;
+    };
+
+    template <Method M>
+    static void Dispatch(const v8::FunctionCallbackInfo<v8::Value>& args)
+    {
+        // The signature guarantees the holder was created from our template.
+        ObjectWrap* wrap = Unwrap<ObjectWrap>(args.Holder());
+        if (wrap == NULL) {
+            Environment::ThrowTypeError(args.GetIsolate(), "Illegal invocation");
+            return;
+        }
+        T* self = static_cast<T*>(wrap);
+        (self->*M)(Environment::GetCurrent(args), args);
+    }
+
+    template <size_t N>
+    static v8::Local<v8::Function> Define(Environment* env,
+                                          const char* class_name,
+                                          const MethodEntry (&methods)[N])
+    {
+        v8::Isolate* isolate = env->isolate();
+        v8::EscapableHandleScope handle_scope(isolate);
+        v8::Local<v8::External> data = env->as_external();
+
+        v8::Local<v8::FunctionTemplate> tmpl = v8::FunctionTemplate::New(isolate, New, data);
+        tmpl->SetClassName(OneByteString(isolate, class_name));
+        tmpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+        v8::Local<v8::Signature> signature = v8::Signature::New(isolate, tmpl);
+        v8::Local<v8::ObjectTemplate> proto = tmpl->PrototypeTemplate();
+        for (size_t i = 0; i < N; ++i) {
+            v8::Local<v8::FunctionTemplate> method =
+                    v8::FunctionTemplate::New(isolate, methods[i].callback, data, signature);
+            v8::Local<v8::String> name = OneByteString(isolate, methods[i].name);
+            method->SetClassName(name);
+            proto->Set(name, method);
+        }
+        return handle_scope.Escape(tmpl->GetFunction());
+    }
+
+    template <size_t N>
+    static void Install(Environment* env,
+                        v8::Local<v8::Object> target,
+                        const char* class_name,
+                        const MethodEntry (&methods)[N])
+    {
+        v8::HandleScope handle_scope(env->isolate());
+        JSObjectUtils::setReadOnlyProperty(env, target, class_name, Define(env, class_name, methods));
+    }
+
+private:
+    static void New(const v8::FunctionCallbackInfo<v8::Value>& args)
+    {
+        if (!args.IsConstructCall()) {
+            Environment::ThrowTypeError(args.GetIsolate(), "Class constructor cannot be invoked without 'new'");
+            return;
+        }
+        // Ownership passes to the JS object, see ObjectWrap::WeakCallback.
+        new T(Environment::GetCurrent(args), args.This(), args);
+    }
+};
+
+#define MD_BINDING_METHOD(Class, name, method)                                \
+  { name, &Mordor::Test::ClassBinding<Class>::template Dispatch<&Class::method> }
+
+} } // namespace Mordor::Test
+
+#endif // MD_JSOBJECT_CLASS_BINDING_H_
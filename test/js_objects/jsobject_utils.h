@@ -5,6 +5,7 @@
 #include "v8.h"
 #include "md_v8_util_inl.h"
 #include "md_env_inl.h"
+#include "md_histogram.h"
 
 namespace Mordor
 {
@@ -35,16 +36,37 @@ public:
         setProperty(env->isolate(), object, name, value);
     }
 
+    static void setNumber(v8::Isolate* isolate, v8::Handle<v8::Object> object, const char* name, double value){
+        object->Set(OneByteString(isolate, name), v8::Number::New(isolate, value));
+    }
+
+    // { count, min, max, mean, p50, p90, p99, p999 } scaled by |scale|,
+    // e.g. 1e-3 to report microsecond samples in milliseconds.
+    static v8::Local<v8::Object> histogramToObject(v8::Isolate* isolate, const Histogram& histogram, double scale = 1.0){
+        v8::Local<v8::Object> object = v8::Object::New(isolate);
+        setNumber(isolate, object, "count", histogram.count());
+        setNumber(isolate, object, "min", histogram.min() * scale);
+        setNumber(isolate, object, "max", histogram.max() * scale);
+        setNumber(isolate, object, "mean", histogram.mean() * scale);
+        setNumber(isolate, object, "p50", histogram.percentile(50) * scale);
+        setNumber(isolate, object, "p90", histogram.percentile(90) * scale);
+        setNumber(isolate, object, "p99", histogram.percentile(99) * scale);
+        setNumber(isolate, object, "p999", histogram.percentile(99.9) * scale);
+        return object;
+    }
+
     template <typename TypeName>
     static void setMethod(
             const TypeName& object,
             v8::Isolate* isolate,
             const char* name,
-            v8::FunctionCallback callback)
+            v8::FunctionCallback callback,
+            v8::Handle<v8::Value> data = v8::Handle<v8::Value>())
     {
       v8::HandleScope handle_scope(isolate);
       v8::Local<v8::FunctionTemplate> t = v8::FunctionTemplate::New(isolate,
-                                                                    callback);
+                                                                    callback,
+                                                                    data);
       v8::Local<v8::Function> fn = t->GetFunction();
       v8::Local<v8::String> fn_name = v8::String::NewFromUtf8(isolate, name);
       fn->SetName(fn_name);
@@ -58,7 +80,9 @@ public:
             const char* name,
             v8::FunctionCallback callback)
     {
-        setMethod(object, env->isolate(), name, callback);
+        // The callback finds its Environment through the data slot, see
+        // Environment::GetCurrent(const v8::FunctionCallbackInfo&).
+        setMethod(object, env->isolate(), name, callback, env->as_external());
     }
 
     static const char* toCString(v8::Local<v8::String> value){
@@ -1,44 +1,277 @@
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
 
 #include "mordor/version.h"
 
 #include "process.h"
 #include "jsobject_utils.h"
+#include "class_binding.h"
+#include "md_clock.h"
+#include "md_fiber_pool.h"
+#include "md_memory.h"
+#include "md_topology.h"
+#include "md_array_buffer_allocator.h"
+#include "md_worker.h"
 
 namespace Mordor
 {
 namespace Test
 {
 
-static void EnvGetter(v8::Local<v8::String> property,
-        const v8::PropertyCallbackInfo<v8::Value>& info)
+/**
+ * Snapshot of environ behind process.env.
+ *
+ * Variables are indexed by name when process.env is created and the V8
+ * strings handed out are cached per entry, so a read is one hash lookup
+ * and no allocation. EnvSetter and EnvDeleter update the snapshot together
+ * with setenv()/unsetenv(); changes made by native code behind our back are
+ * not seen until refresh().
+ *
+ * Every context has its own process.env, so a write bumps a process wide
+ * generation and the other snapshots refresh before their next access.
+ */
+class EnvVarCache : public ObjectWrap
 {
-    Environment* env = Environment::GetCurrent(info.GetIsolate());
-    v8::HandleScope scope(env->isolate());
+public:
+    EnvVarCache(Environment* env, v8::Local<v8::Object> object, v8::Local<v8::Object> fallback) :
+            ObjectWrap(env, object), fallback_(env->isolate(), fallback), generation_(0)
+    {
+        refresh();
+    }
+
+    ~EnvVarCache()
+    {
+        clear();
+        fallback_.Reset();
+    }
+
+    static EnvVarCache* Get(v8::Local<v8::Object> holder)
+    {
+        return static_cast<EnvVarCache*>(Unwrap<ObjectWrap>(holder));
+    }
+
+    void refresh()
+    {
+        clear();
+        generation_ = generation.load(std::memory_order_acquire);
 #ifdef POSIX
-    v8::String::Utf8Value key(property);
-    const char* val = getenv(*key);
-    if (val) {
-        return info.GetReturnValue().Set(v8::String::NewFromUtf8(env->isolate(), val));
+        for (char** var = environ; *var != NULL; ++var) {
+            const char* s = strchr(*var, '=');
+            if (s == NULL)
+                continue;
+            insert(*var, s - *var, s + 1);
+        }
+#endif
+    }
+
+    v8::Local<v8::String> get(v8::Local<v8::String> property)
+    {
+        sync();
+        Entry* entry = find(property);
+        if (entry == NULL)
+            return v8::Local<v8::String>();
+        if (entry->js_value.IsEmpty()) {
+            entry->js_value.Reset(env()->isolate(),
+                    Utf8String(env()->isolate(), entry->value.data(), entry->value.size()));
+        }
+        return StrongPersistentToLocal(entry->js_value);
+    }
+
+    bool has(v8::Local<v8::String> property)
+    {
+        sync();
+        return find(property) != NULL;
     }
+
+    void set(v8::Local<v8::String> property, v8::Local<v8::Value> value)
+    {
+        v8::String::Utf8Value key(property);
+        v8::String::Utf8Value val(value);
+        if (*key == NULL || *val == NULL)
+            return;
+        sync();
+#ifdef POSIX
+        // Fails for an empty name or one containing '='. The environment
+        // is unchanged then, and so must be the snapshot.
+        if (setenv(*key, *val, 1) != 0)
+            return;
+#endif
+        written();
+        Entry* entry = find(*key, key.length());
+        if (entry == NULL) {
+            insert(*key, key.length(), *val);
+        } else {
+            entry->value.assign(*val, val.length());
+            entry->js_value.Reset();
+        }
+    }
+
+    bool remove(v8::Local<v8::String> property)
+    {
+        v8::String::Utf8Value key(property);
+        if (*key == NULL)
+            return false;
+        sync();
+        Map::iterator it = vars_.find(Key(*key, key.length()));
+        if (it == vars_.end())
+            return false;
+#ifdef POSIX
+        unsetenv(*key);
 #endif
+        written();
+        delete it->second;
+        vars_.erase(it);
+        return true;
+    }
+
+    v8::Local<v8::Array> names()
+    {
+        sync();
+        v8::Isolate* isolate = env()->isolate();
+        v8::Local<v8::Array> array = v8::Array::New(isolate, vars_.size());
+        uint32_t i = 0;
+        for (Map::iterator it = vars_.begin(); it != vars_.end(); ++it, ++i) {
+            Entry* entry = it->second;
+            if (entry->js_name.IsEmpty())
+                entry->js_name.Reset(isolate, Utf8String(isolate, entry->name.data(), entry->name.size()));
+            array->Set(i, StrongPersistentToLocal(entry->js_name));
+        }
+        return array;
+    }
+
+    v8::Local<v8::Object> fallback()
+    {
+        return StrongPersistentToLocal(fallback_);
+    }
+
+private:
+    struct Entry
+    {
+        ~Entry()
+        {
+            js_name.Reset();
+            js_value.Reset();
+        }
+
+        std::string name;
+        std::string value;
+        v8::Persistent<v8::String> js_name;
+        v8::Persistent<v8::String> js_value;
+    };
+
+    // Keys point into Entry::name, lookups use a key over a stack buffer.
+    struct Key
+    {
+        Key(const char* data, size_t length) : data(data), length(length) {}
+        const char* data;
+        size_t length;
+        bool operator==(const Key& other) const
+        {
+            return length == other.length && memcmp(data, other.data, length) == 0;
+        }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const
+        {
+            // FNV-1a
+            size_t hash = 2166136261u;
+            for (size_t i = 0; i < key.length; ++i) {
+                hash ^= static_cast<unsigned char>(key.data[i]);
+                hash *= 16777619u;
+            }
+            return hash;
+        }
+    };
+
+    typedef std::unordered_map<Key, Entry*, KeyHash> Map;
+
+    static const int kMaxStackKey = 256;
+
+    Entry* find(const char* name, size_t length)
+    {
+        Map::iterator it = vars_.find(Key(name, length));
+        return it == vars_.end() ? NULL : it->second;
+    }
+
+    Entry* find(v8::Local<v8::String> property)
+    {
+        char buf[kMaxStackKey];
+        // Three bytes per UTF-16 unit is enough for any BMP character.
+        if (property->Length() * 3 < kMaxStackKey) {
+            int length = property->WriteUtf8(buf, sizeof(buf), NULL, v8::String::NO_NULL_TERMINATION);
+            return find(buf, length);
+        }
+        v8::String::Utf8Value key(property);
+        return find(*key, key.length());
+    }
+
+    void insert(const char* name, size_t length, const char* value)
+    {
+        Entry* entry = new Entry();
+        entry->name.assign(name, length);
+        entry->value.assign(value);
+        std::pair<Map::iterator, bool> ret = vars_.insert(
+                Map::value_type(Key(entry->name.data(), entry->name.size()), entry));
+        if (!ret.second) {
+            // environ may hold duplicates, getenv() returns the first one.
+            delete entry;
+        }
+    }
+
+    void clear()
+    {
+        for (Map::iterator it = vars_.begin(); it != vars_.end(); ++it)
+            delete it->second;
+        vars_.clear();
+    }
+
+    // Another context's process.env changed the environment.
+    void sync()
+    {
+        if (generation_ != generation.load(std::memory_order_acquire))
+            refresh();
+    }
+
+    // Our snapshot already has the change, the others refresh.
+    void written()
+    {
+        generation_ = generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+    }
+
+    static std::atomic<uint64_t> generation;
+
+    Map vars_;
+    v8::Persistent<v8::Object> fallback_;
+    uint64_t generation_;
+};
+
+std::atomic<uint64_t> EnvVarCache::generation(0);
+
+static void EnvGetter(v8::Local<v8::String> property,
+        const v8::PropertyCallbackInfo<v8::Value>& info)
+{
+    EnvVarCache* vars = EnvVarCache::Get(info.Holder());
+    v8::Local<v8::String> value = vars->get(property);
+    if (!value.IsEmpty()) {
+        return info.GetReturnValue().Set(value);
+    }
     // Not found.  Fetch from prototype.
-    info.GetReturnValue().Set(info.Data().As<v8::Object>()->Get(property));
+    info.GetReturnValue().Set(vars->fallback()->Get(property));
 }
 
 static void EnvSetter(v8::Local<v8::String> property,
         v8::Local<v8::Value> value,
         const v8::PropertyCallbackInfo<v8::Value>& info)
 {
-    Environment* env = Environment::GetCurrent(info.GetIsolate());
-    v8::HandleScope scope(env->isolate());
-#ifdef POSIX
-    v8::String::Utf8Value key(property);
-    v8::String::Utf8Value val(value);
-    setenv(*key, *val, 1);
-#endif
+    EnvVarCache::Get(info.Holder())->set(property, value);
     // Whether it worked or not, always return rval.
     info.GetReturnValue().Set(value);
 }
@@ -46,90 +279,357 @@ static void EnvSetter(v8::Local<v8::String> property,
 static void EnvQuery(v8::Local<v8::String> property,
         const v8::PropertyCallbackInfo<v8::Integer>& info)
 {
-    Environment* env = Environment::GetCurrent(info.GetIsolate());
-    v8::HandleScope scope(env->isolate());
-    int32_t rc = -1;  // Not found unless proven otherwise.
-#ifdef POSIX
-    v8::String::Utf8Value key(property);
-    if (getenv(*key))
-        rc = 0;
-#endif
-    if (rc != -1)
-        info.GetReturnValue().Set(rc);
+    if (EnvVarCache::Get(info.Holder())->has(property))
+        info.GetReturnValue().Set(0);
 }
 
 static void EnvDeleter(v8::Local<v8::String> property,
         const v8::PropertyCallbackInfo<v8::Boolean>& info)
 {
-    Environment* env = Environment::GetCurrent(info.GetIsolate());
-    v8::HandleScope scope(env->isolate());
-    bool rc = true;
-#ifdef POSIX
-    v8::String::Utf8Value key(property);
-    rc = (getenv(*key) != NULL);
-    if (rc)
-        unsetenv(*key);
-#endif
-    info.GetReturnValue().Set(rc);
+    info.GetReturnValue().Set(EnvVarCache::Get(info.Holder())->remove(property));
 }
 
 static void EnvEnumerator(const v8::PropertyCallbackInfo<v8::Array>& info)
 {
-    Environment* env = Environment::GetCurrent(info.GetIsolate());
-    v8::HandleScope scope(env->isolate());
-#ifdef POSIX
-    int size = 0;
-    while (environ[size])
-        size++;
-
-    v8::Local<v8::Array> envarr = v8::Array::New(env->isolate(), size);
-
-    for (int i = 0; i < size; ++i) {
-        const char* var = environ[i];
-        const char* s = strchr(var, '=');
-        const int length = s ? s - var : strlen(var);
-        v8::Local<v8::String> name = v8::String::NewFromUtf8(env->isolate(), var, v8::String::kNormalString, length);
-        envarr->Set(i, name);
-    }
-#endif
-    info.GetReturnValue().Set(envarr);
+    v8::HandleScope scope(info.GetIsolate());
+    info.GetReturnValue().Set(EnvVarCache::Get(info.Holder())->names());
 }
 
 static void Exit(const v8::FunctionCallbackInfo<v8::Value>& args)
 {
-    Environment* env = Environment::GetCurrent(args.GetIsolate());
+    Environment* env = Environment::GetCurrent(args);
     env->set_return_value(args[0]->Int32Value());
     env->set_running(false);
 }
 
 static void MemoryUsage(const v8::FunctionCallbackInfo<v8::Value>& args) {
-  Environment* env = Environment::GetCurrent(args.GetIsolate());
-  v8::HandleScope scope(env->isolate());
+  Environment* env = Environment::GetCurrent(args);
+  v8::Isolate* isolate = env->isolate();
+  v8::HandleScope scope(isolate);
   // V8 memory usage
   v8::HeapStatistics v8_heap_stats;
-  env->isolate()->GetHeapStatistics(&v8_heap_stats);
+  isolate->GetHeapStatistics(&v8_heap_stats);
 
   v8::Local<v8::Integer> physical_total =
-          v8::Integer::NewFromUnsigned(env->isolate(), v8_heap_stats.total_physical_size());
+          v8::Integer::NewFromUnsigned(isolate, v8_heap_stats.total_physical_size());
   v8::Local<v8::Integer> heap_total =
-          v8::Integer::NewFromUnsigned(env->isolate(), v8_heap_stats.total_heap_size());
+          v8::Integer::NewFromUnsigned(isolate, v8_heap_stats.total_heap_size());
   v8::Local<v8::Integer> heap_total_exec =
-          v8::Integer::NewFromUnsigned(env->isolate(), v8_heap_stats.total_heap_size_executable());
+          v8::Integer::NewFromUnsigned(isolate, v8_heap_stats.total_heap_size_executable());
   v8::Local<v8::Integer> heap_used =
-          v8::Integer::NewFromUnsigned(env->isolate(), v8_heap_stats.used_heap_size());
+          v8::Integer::NewFromUnsigned(isolate, v8_heap_stats.used_heap_size());
   v8::Local<v8::Integer> heap_limit =
-          v8::Integer::NewFromUnsigned(env->isolate(), v8_heap_stats.heap_size_limit());
+          v8::Integer::NewFromUnsigned(isolate, v8_heap_stats.heap_size_limit());
 
-  v8::Local<v8::Object> info = v8::Object::New(env->isolate());
+  v8::Local<v8::Object> info = v8::Object::New(isolate);
+  info->Set(env->rss_string(), v8::Number::New(isolate, MemoryInfo::residentSetSize()));
   info->Set(env->physical_total_string(), physical_total);
   info->Set(env->heap_total_string(), heap_total);
   info->Set(env->heap_total_exec_string(), heap_total_exec);
   info->Set(env->heap_used_string(), heap_used);
   info->Set(env->heap_limit_string(), heap_limit);
+  // Adjusting by zero just reads back what V8 has been told about.
+  ExternalMemory::the_singleton.flush();
+  info->Set(env->external_string(),
+            v8::Number::New(isolate, isolate->AdjustAmountOfExternalAllocatedMemory(0)));
+
+  // ArrayBuffer backing stores
+  ArrayBufferAllocator::Stats ab_stats = ArrayBufferAllocator::the_singleton.stats();
+  v8::Local<v8::Object> array_buffers = v8::Object::New(isolate);
+  JSObjectUtils::setNumber(isolate, array_buffers, "live", ab_stats.live_bytes);
+  JSObjectUtils::setNumber(isolate, array_buffers, "peak", ab_stats.peak_bytes);
+  JSObjectUtils::setNumber(isolate, array_buffers, "total", ab_stats.total_bytes);
+  JSObjectUtils::setNumber(isolate, array_buffers, "allocations", ab_stats.allocations);
+  JSObjectUtils::setNumber(isolate, array_buffers, "frees", ab_stats.frees);
+  JSObjectUtils::setNumber(isolate, array_buffers, "failures", ab_stats.failures);
+  info->Set(env->array_buffers_string(), array_buffers);
+
+  // Native memory held by bindings, see ExternalMemory
+  ExternalMemory& external_memory = ExternalMemory::the_singleton;
+  v8::Local<v8::Object> tracked = v8::Object::New(isolate);
+  JSObjectUtils::setNumber(isolate, tracked, "live", external_memory.live());
+  JSObjectUtils::setNumber(isolate, tracked, "peak", external_memory.peak());
+  JSObjectUtils::setNumber(isolate, tracked, "reported", external_memory.reported());
+  info->Set(OneByteString(isolate, "externalTracked"), tracked);
+
+#ifdef MD_V8_HAS_HEAP_SPACE_STATISTICS
+  v8::Local<v8::Array> spaces = v8::Array::New(isolate);
+  for (size_t i = 0; i < isolate->NumberOfHeapSpaces(); ++i) {
+      v8::HeapSpaceStatistics space_stats;
+      if (!isolate->GetHeapSpaceStatistics(&space_stats, i))
+          continue;
+      v8::Local<v8::Object> space = v8::Object::New(isolate);
+      space->Set(OneByteString(isolate, "name"), OneByteString(isolate, space_stats.space_name()));
+      JSObjectUtils::setNumber(isolate, space, "size", space_stats.space_size());
+      JSObjectUtils::setNumber(isolate, space, "used", space_stats.space_used_size());
+      JSObjectUtils::setNumber(isolate, space, "available", space_stats.space_available_size());
+      JSObjectUtils::setNumber(isolate, space, "physical", space_stats.physical_space_size());
+      spaces->Set(spaces->Length(), space);
+  }
+  info->Set(env->spaces_string(), spaces);
+#endif
+
+  // GC pauses, in milliseconds
+  GcStats* gc_stats = env->gc_stats();
+  v8::Local<v8::Object> gc = v8::Object::New(isolate);
+  for (int i = 0; i < GcStats::kKindCount; ++i) {
+      GcStats::Kind kind = static_cast<GcStats::Kind>(i);
+      gc->Set(OneByteString(isolate, GcStats::kindName(kind)),
+              JSObjectUtils::histogramToObject(isolate, gc_stats->pauses(kind), 1e-3));
+  }
+  JSObjectUtils::setNumber(isolate, gc, "pauseTotal", gc_stats->totalPause() / 1e3);
+  if (IdleGcScheduler* idle_gc = env->idle_gc()) {
+      JSObjectUtils::setNumber(isolate, gc, "idleNotifications", idle_gc->notifications());
+      JSObjectUtils::setNumber(isolate, gc, "idleTime", idle_gc->idleTime());
+  }
+  info->Set(env->gc_string(), gc);
+
+  // Heap pressure handling, see HeapGuard
+  HeapGuard* heap_guard = env->heap_guard();
+  v8::Local<v8::Object> pressure = v8::Object::New(isolate);
+  JSObjectUtils::setNumber(isolate, pressure, "events", heap_guard->pressureEvents());
+  JSObjectUtils::setNumber(isolate, pressure, "lowMemoryNotifications", heap_guard->lowMemoryNotifications());
+  JSObjectUtils::setNumber(isolate, pressure, "terminations", heap_guard->terminations());
+  JSObjectUtils::setNumber(isolate, pressure, "throttled", heap_guard->throttled());
+  JSObjectUtils::setProperty(isolate, pressure, "active", v8::Boolean::New(isolate, heap_guard->underPressure()));
+  JSObjectUtils::setProperty(isolate, pressure, "shedding", v8::Boolean::New(isolate, env->worker()->shedding()));
+  JSObjectUtils::setNumber(isolate, pressure, "shed", env->worker()->queueStats().shed);
+  info->Set(OneByteString(isolate, "pressure"), pressure);
 
   args.GetReturnValue().Set(info);
 }
 
+// Returns the samples kept by MemorySampler, oldest first. Empty unless
+// --mdv8.memory.sampleinterval is set.
+static void MemoryHistory(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Environment* env = Environment::GetCurrent(args);
+    v8::Isolate* isolate = env->isolate();
+    v8::HandleScope scope(isolate);
+    v8::Local<v8::Array> result = v8::Array::New(isolate);
+    MemorySampler* sampler = env->memory_sampler();
+    if (sampler == NULL)
+        return args.GetReturnValue().Set(result);
+
+    std::vector<MemorySample> history = sampler->history();
+    for (size_t i = 0; i < history.size(); ++i) {
+        const MemorySample& sample = history[i];
+        v8::Local<v8::Object> item = v8::Object::New(isolate);
+        JSObjectUtils::setNumber(isolate, item, "time", sample.time / 1e3);
+        item->Set(env->rss_string(), v8::Number::New(isolate, sample.rss));
+        item->Set(env->heap_used_string(), v8::Number::New(isolate, sample.heap_used));
+        item->Set(env->heap_total_string(), v8::Number::New(isolate, sample.heap_total));
+        item->Set(env->array_buffers_string(), v8::Number::New(isolate, sample.array_buffers));
+        JSObjectUtils::setNumber(isolate, item, "scavenges", sample.scavenges);
+        JSObjectUtils::setNumber(isolate, item, "markCompacts", sample.mark_compacts);
+        JSObjectUtils::setNumber(isolate, item, "gcPause", sample.gc_pause / 1e3);
+        result->Set(i, item);
+    }
+    args.GetReturnValue().Set(result);
+}
+
+// process.hrtime([previous]): monotonic [seconds, nanoseconds], relative to
+// |previous| when given, as in node.
+static void Hrtime(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Environment* env = Environment::GetCurrent(args);
+    v8::Isolate* isolate = env->isolate();
+    v8::HandleScope scope(isolate);
+    uint64_t t = MonotonicNanos();
+    if (args[0]->IsArray()) {
+        v8::Local<v8::Array> previous = args[0].As<v8::Array>();
+        if (previous->Length() != 2) {
+            env->ThrowTypeError("process.hrtime() only accepts an Array tuple");
+            return;
+        }
+        uint64_t sec = previous->Get(0)->IntegerValue();
+        uint64_t nsec = previous->Get(1)->IntegerValue();
+        t -= sec * 1000000000ull + nsec;
+    }
+    v8::Local<v8::Array> result = v8::Array::New(isolate, 2);
+    result->Set(0, v8::Number::New(isolate, static_cast<double>(t / 1000000000ull)));
+    result->Set(1, v8::Integer::NewFromUnsigned(isolate, static_cast<uint32_t>(t % 1000000000ull)));
+    args.GetReturnValue().Set(result);
+}
+
+// Per task name latency histograms of the worker, in milliseconds.
+static void TaskStatsCallback(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Environment* env = Environment::GetCurrent(args);
+    v8::Isolate* isolate = env->isolate();
+    v8::HandleScope scope(isolate);
+    v8::Local<v8::Object> result = v8::Object::New(isolate);
+    env->worker()->stats().forEach([&](const std::string& name, const TaskLatency& latency) {
+        v8::Local<v8::Object> item = v8::Object::New(isolate);
+        item->Set(OneByteString(isolate, "wait"), JSObjectUtils::histogramToObject(isolate, latency.wait, 1e-3));
+        item->Set(OneByteString(isolate, "run"), JSObjectUtils::histogramToObject(isolate, latency.run, 1e-3));
+        item->Set(OneByteString(isolate, "total"), JSObjectUtils::histogramToObject(isolate, latency.total, 1e-3));
+        result->Set(Utf8String(isolate, name.data(), name.size()), item);
+    });
+    args.GetReturnValue().Set(result);
+}
+
+// Capacity and high-water mark of the worker queue, with the depth and
+// throughput of each lane.
+static void TaskQueueCallback(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Environment* env = Environment::GetCurrent(args);
+    v8::Isolate* isolate = env->isolate();
+    v8::HandleScope scope(isolate);
+    v8::Local<v8::Object> result = v8::Object::New(isolate);
+    MD_TaskQueue::Stats queue = env->worker()->queueStats();
+    JSObjectUtils::setNumber(isolate, result, "capacity", queue.capacity);
+    JSObjectUtils::setNumber(isolate, result, "highWater", queue.high_water);
+    JSObjectUtils::setNumber(isolate, result, "blocked", queue.blocked);
+    JSObjectUtils::setNumber(isolate, result, "rejected", queue.rejected);
+    JSObjectUtils::setNumber(isolate, result, "shed", queue.shed);
+    JSObjectUtils::setNumber(isolate, result, "expired", queue.expired);
+    JSObjectUtils::setNumber(isolate, result, "cancelled", queue.cancelled);
+    for (int i = 0; i < kLaneCount; ++i) {
+        TaskLane lane = static_cast<TaskLane>(i);
+        MD_TaskQueue::LaneStats stats = env->worker()->laneStats(lane);
+        v8::Local<v8::Object> item = v8::Object::New(isolate);
+        JSObjectUtils::setNumber(isolate, item, "depth", stats.depth);
+        JSObjectUtils::setNumber(isolate, item, "dequeued", stats.dequeued);
+        JSObjectUtils::setNumber(isolate, item, "promoted", stats.promoted);
+        result->Set(OneByteString(isolate, TaskLaneName(lane)), item);
+    }
+    args.GetReturnValue().Set(result);
+}
+
+// Worker fiber count and the adaptive controller's view of the last
+// window, wait in milliseconds.
+static void WorkersCallback(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Environment* env = Environment::GetCurrent(args);
+    v8::Isolate* isolate = env->isolate();
+    v8::HandleScope scope(isolate);
+    MD_Worker::PoolStats stats = env->worker()->poolStats();
+    v8::Local<v8::Object> result = v8::Object::New(isolate);
+    JSObjectUtils::setNumber(isolate, result, "size", stats.size);
+    JSObjectUtils::setNumber(isolate, result, "min", stats.min);
+    JSObjectUtils::setNumber(isolate, result, "max", stats.max);
+    JSObjectUtils::setNumber(isolate, result, "busy", stats.busy);
+    JSObjectUtils::setNumber(isolate, result, "grows", stats.grows);
+    JSObjectUtils::setNumber(isolate, result, "shrinks", stats.shrinks);
+    JSObjectUtils::setNumber(isolate, result, "utilization", stats.utilization);
+    JSObjectUtils::setNumber(isolate, result, "meanWait", stats.mean_wait / 1e3);
+    result->Set(OneByteString(isolate, "isolateAffinity"), v8::Boolean::New(isolate, stats.isolate_affinity));
+    args.GetReturnValue().Set(result);
+}
+
+// Reuse of pooled fibers and the stack memory they keep, in bytes.
+static void FiberPoolsCallback(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Environment* env = Environment::GetCurrent(args);
+    v8::Isolate* isolate = env->isolate();
+    v8::HandleScope scope(isolate);
+    v8::Local<v8::Object> result = v8::Object::New(isolate);
+    FiberPool* pools[] = { &FiberPool::small(), &FiberPool::large() };
+    for (size_t i = 0; i < sizeof(pools) / sizeof(pools[0]); ++i) {
+        FiberPool::Stats stats = pools[i]->stats();
+        v8::Local<v8::Object> item = v8::Object::New(isolate);
+        JSObjectUtils::setNumber(isolate, item, "stackSize", stats.stack_size);
+        JSObjectUtils::setNumber(isolate, item, "idle", stats.idle);
+        JSObjectUtils::setNumber(isolate, item, "acquired", stats.acquired);
+        JSObjectUtils::setNumber(isolate, item, "hits", stats.hits);
+        JSObjectUtils::setNumber(isolate, item, "hitRate",
+                                 stats.acquired > 0 ? static_cast<double>(stats.hits) / stats.acquired : 0);
+        JSObjectUtils::setNumber(isolate, item, "retained", stats.retained_bytes);
+        result->Set(OneByteString(isolate, pools[i]->name()), item);
+    }
+    args.GetReturnValue().Set(result);
+}
+
+// The NUMA nodes seen, the IOManager threads' CPUs and the node isolate
+// memory is preferred on (-1 if none).
+static void TopologyCallback(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Environment* env = Environment::GetCurrent(args);
+    v8::Isolate* isolate = env->isolate();
+    v8::HandleScope scope(isolate);
+    const ThreadPlacement& placement = ThreadPlacement::the_singleton;
+    v8::Local<v8::Object> result = v8::Object::New(isolate);
+    result->Set(OneByteString(isolate, "affinity"),
+                OneByteString(isolate, PlacementPolicyName(placement.policy())));
+    const std::vector<NumaNode>& nodes = placement.topology().nodes();
+    v8::Local<v8::Array> js_nodes = v8::Array::New(isolate, nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        v8::Local<v8::Object> item = v8::Object::New(isolate);
+        JSObjectUtils::setNumber(isolate, item, "id", nodes[i].id);
+        v8::Local<v8::Array> cpus = v8::Array::New(isolate, nodes[i].cpus.size());
+        for (size_t j = 0; j < nodes[i].cpus.size(); ++j)
+            cpus->Set(j, v8::Integer::New(isolate, nodes[i].cpus[j]));
+        item->Set(OneByteString(isolate, "cpus"), cpus);
+        js_nodes->Set(i, item);
+    }
+    result->Set(OneByteString(isolate, "nodes"), js_nodes);
+    std::vector<ThreadPlacement::Assignment> assignments = placement.assignments();
+    v8::Local<v8::Array> threads = v8::Array::New(isolate, assignments.size());
+    for (size_t i = 0; i < assignments.size(); ++i) {
+        v8::Local<v8::Object> item = v8::Object::New(isolate);
+        JSObjectUtils::setNumber(isolate, item, "tid", assignments[i].tid);
+        JSObjectUtils::setNumber(isolate, item, "cpu", assignments[i].cpu);
+        JSObjectUtils::setNumber(isolate, item, "node", assignments[i].node);
+        threads->Set(i, item);
+    }
+    result->Set(OneByteString(isolate, "threads"), threads);
+    JSObjectUtils::setNumber(isolate, result, "memoryNode", placement.memoryNode());
+    args.GetReturnValue().Set(result);
+}
+
+// Isolate lag histogram in ms and the recent stalls, undefined unless
+// --mdv8.watchdog.interval is set.
+static void WatchdogCallback(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Environment* env = Environment::GetCurrent(args);
+    IsolateWatchdog* watchdog = env->watchdog();
+    if (watchdog == NULL)
+        return;
+    v8::Isolate* isolate = env->isolate();
+    v8::HandleScope scope(isolate);
+    v8::Local<v8::Object> result = v8::Object::New(isolate);
+    result->Set(OneByteString(isolate, "lag"), JSObjectUtils::histogramToObject(isolate, watchdog->lag(), 1e-3));
+    JSObjectUtils::setNumber(isolate, result, "stalls", watchdog->stallCount());
+    std::deque<IsolateWatchdog::Stall> stalls = watchdog->stalls();
+    v8::Local<v8::Array> recent = v8::Array::New(isolate, stalls.size());
+    for (size_t i = 0; i < stalls.size(); ++i) {
+        v8::Local<v8::Object> item = v8::Object::New(isolate);
+        JSObjectUtils::setNumber(isolate, item, "time", stalls[i].time / 1e3);
+        JSObjectUtils::setNumber(isolate, item, "lag", stalls[i].lag / 1e3);
+        item->Set(env->stack_string(), Utf8String(isolate, stalls[i].stack.data(), stalls[i].stack.size()));
+        recent->Set(i, item);
+    }
+    result->Set(OneByteString(isolate, "recent"), recent);
+    args.GetReturnValue().Set(result);
+}
+
+// Contexts ready for the next requests and how often a request had to
+// bootstrap its own. Undefined unless --mdv8.contextpool.size is set.
+static void ContextPoolCallback(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Environment* env = Environment::GetCurrent(args);
+    ContextPool* pool = env->context_pool();
+    if (pool == NULL)
+        return;
+    v8::Isolate* isolate = env->isolate();
+    v8::HandleScope scope(isolate);
+    ContextPool::Stats stats = pool->stats();
+    v8::Local<v8::Object> result = v8::Object::New(isolate);
+    JSObjectUtils::setNumber(isolate, result, "size", stats.size);
+    JSObjectUtils::setNumber(isolate, result, "ready", stats.ready);
+    result->Set(OneByteString(isolate, "policy"), OneByteString(isolate, ContextPool::policyName(stats.policy)));
+    JSObjectUtils::setNumber(isolate, result, "hits", stats.hits);
+    JSObjectUtils::setNumber(isolate, result, "misses", stats.misses);
+    JSObjectUtils::setNumber(isolate, result, "created", stats.created);
+    JSObjectUtils::setNumber(isolate, result, "recycled", stats.recycled);
+    JSObjectUtils::setNumber(isolate, result, "discarded", stats.discarded);
+    JSObjectUtils::setNumber(isolate, result, "bootstrapAvg",
+                             stats.created > 0 ? stats.bootstrap_total / 1e3 / stats.created : 0);
+    JSObjectUtils::setNumber(isolate, result, "bootstrapMax", stats.bootstrap_max / 1e3);
+    args.GetReturnValue().Set(result);
+}
+
 void ProcessObject::setup()
 {
     v8::HandleScope handleScope(isolate_);
@@ -151,14 +651,16 @@ void ProcessObject::setup()
 #undef PLAT
     // process.env
     v8::Local<v8::ObjectTemplate> process_env_template = v8::ObjectTemplate::New(isolate_);
+    process_env_template->SetInternalFieldCount(1);
     process_env_template->SetNamedPropertyHandler(EnvGetter,
             EnvSetter,
             EnvQuery,
             EnvDeleter,
-            EnvEnumerator,
-            v8::Object::New(isolate_)
+            EnvEnumerator
     );
     v8::Local<v8::Object> process_env = process_env_template->NewInstance();
+    // Owned by process_env, see ObjectWrap.
+    new EnvVarCache(env_, process_env, v8::Object::New(isolate_));
     object_->Set(env_->env_string(), process_env);
     // process.pid
     setReadOnlyProperty("pid", v8::Integer::New(isolate_, getpid()));
@@ -167,9 +669,29 @@ void ProcessObject::setup()
     setMethod("reallyExit", Exit);
     // process.memoryUsage()
     setMethod("memoryUsage", MemoryUsage);
+    setMethod("memoryHistory", MemoryHistory);
+    // process.hrtime()
+    setMethod("hrtime", Hrtime);
+    // process.taskStats()
+    setMethod("taskStats", TaskStatsCallback);
+    // process.taskQueue()
+    setMethod("taskQueue", TaskQueueCallback);
+    // process.workers()
+    setMethod("workers", WorkersCallback);
+    // process.fiberPools()
+    setMethod("fiberPools", FiberPoolsCallback);
+    // process.topology()
+    setMethod("topology", TopologyCallback);
+    // process.watchdog()
+    setMethod("watchdog", WatchdogCallback);
+    // process.contextPool()
+    setMethod("contextPool", ContextPoolCallback);
 
     setToGlobal();
-    env_->set_process_object(object_);
+    // Pooled contexts get their own process object, the environment keeps
+    // the main context's.
+    if (isolate_->GetCurrentContext() == env_->context())
+        env_->set_process_object(object_);
 }
 
 } } // namespace Mordor::Test
@@ -0,0 +1,120 @@
+#include <string>
+
+#include "profiler.h"
+#include "jsobject_utils.h"
+#include "md_profiler.h"
+#include "md_heap_snapshot.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+// profiler.start() -> false if already running
+static void Start(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Environment* env = Environment::GetCurrent(args);
+    args.GetReturnValue().Set(env->cpu_profiler()->start());
+}
+
+// profiler.stop([basename]) -> basename of the written files, or null if
+// the profiler was not running.
+static void Stop(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Environment* env = Environment::GetCurrent(args);
+    std::string base;
+    if (args.Length() > 0 && args[0]->IsString()) {
+        v8::String::Utf8Value value(args[0]);
+        base.assign(*value, value.length());
+    } else if (args.Length() > 0 && !args[0]->IsUndefined()) {
+        return env->ThrowTypeError("basename must be a string");
+    } else {
+        base = ProfileFile::DefaultBaseName("CPU");
+    }
+    if (!env->cpu_profiler()->stop(base))
+        return args.GetReturnValue().SetNull();
+    args.GetReturnValue().Set(Utf8String(env->isolate(), base.c_str(), base.size()));
+}
+
+static void Profiling(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Environment* env = Environment::GetCurrent(args);
+    args.GetReturnValue().Set(env->cpu_profiler()->profiling());
+}
+
+// profiler.setSamplingInterval(us)
+static void SetSamplingInterval(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Environment* env = Environment::GetCurrent(args);
+    if (args.Length() < 1 || !args[0]->IsNumber() || args[0]->Int32Value() <= 0)
+        return env->ThrowRangeError("interval must be a positive number of microseconds");
+    env->cpu_profiler()->setSamplingInterval(args[0]->Int32Value());
+}
+
+// profiler.writeHeapSnapshot(path, [{compress: bool}]) -> bytes written
+// before compression. Blocks the isolate while the snapshot is taken.
+static void WriteHeapSnapshot(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Environment* env = Environment::GetCurrent(args);
+    if (args.Length() < 1 || !args[0]->IsString())
+        return env->ThrowTypeError("path must be a string");
+    bool compress = false;
+    if (args.Length() > 1 && args[1]->IsObject())
+        compress = args[1]->ToObject()->Get(env->compress_string())->BooleanValue();
+
+    v8::String::Utf8Value path(args[0]);
+    uint64_t bytes = 0;
+    std::string error;
+    if (!HeapSnapshotWriter::Write(env->isolate(), std::string(*path, path.length()),
+                                   compress, &bytes, &error))
+        return env->ThrowError(error.c_str());
+    args.GetReturnValue().Set(static_cast<double>(bytes));
+}
+
+// profiler.startAllocationSampling([intervalMs]) -> false if already running
+static void StartAllocationSampling(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Environment* env = Environment::GetCurrent(args);
+    unsigned int interval = 0;
+    if (args.Length() > 0 && !args[0]->IsUndefined()) {
+        if (!args[0]->IsNumber() || args[0]->Int32Value() <= 0)
+            return env->ThrowRangeError("interval must be a positive number of milliseconds");
+        interval = args[0]->Uint32Value();
+    }
+    args.GetReturnValue().Set(env->allocation_sampler()->start(interval));
+}
+
+// profiler.stopAllocationSampling([path]) -> path of the collapsed stacks,
+// or null if the sampler was not running.
+static void StopAllocationSampling(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Environment* env = Environment::GetCurrent(args);
+    std::string path;
+    if (args.Length() > 0 && args[0]->IsString()) {
+        v8::String::Utf8Value value(args[0]);
+        path.assign(*value, value.length());
+    } else if (args.Length() > 0 && !args[0]->IsUndefined()) {
+        return env->ThrowTypeError("path must be a string");
+    } else {
+        path = ProfileFile::DefaultBaseName("ALLOC") + ".folded";
+    }
+    if (!env->allocation_sampler()->stop(path))
+        return args.GetReturnValue().SetNull();
+    args.GetReturnValue().Set(Utf8String(env->isolate(), path.c_str(), path.size()));
+}
+
+void ProfilerObject::setup()
+{
+    v8::HandleScope handleScope(isolate_);
+    setMethod("start", Start);
+    setMethod("stop", Stop);
+    setMethod("profiling", Profiling);
+    setMethod("setSamplingInterval", SetSamplingInterval);
+    setMethod("writeHeapSnapshot", WriteHeapSnapshot);
+    setMethod("startAllocationSampling", StartAllocationSampling);
+    setMethod("stopAllocationSampling", StopAllocationSampling);
+
+    setToGlobal();
+}
+
+} } // namespace Mordor::Test
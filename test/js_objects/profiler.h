@@ -0,0 +1,24 @@
+#ifndef MD_JSOBJECT_PROFILER_H_
+#define MD_JSOBJECT_PROFILER_H_
+
+#include "class_base.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+// profiler.start(), profiler.stop([basename]), see CpuProfilerSession, and
+// profiler.writeHeapSnapshot(path), see HeapSnapshotWriter, and
+// profiler.start/stopAllocationSampling(), see AllocationSampler.
+class ProfilerObject : public ClassBase
+{
+public:
+    ProfilerObject(Environment* env) : ClassBase(env, name){}
+    constexpr static const char* name { "profiler" } ;
+    virtual void setup() override;
+};
+
+} } // namespace Mordor::Test
+
+#endif // MD_JSOBJECT_PROFILER_H_
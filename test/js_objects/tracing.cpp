@@ -0,0 +1,71 @@
+#include "mordor/streams/file.h"
+
+#include "tracing.h"
+#include "jsobject_utils.h"
+#include "md_trace.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+// Returns the number of events written, or -1 after throwing.
+static double WriteTrace(Environment* env, v8::Local<v8::Value> path)
+{
+    if (!path->IsString()) {
+        env->ThrowTypeError("path must be a string");
+        return -1;
+    }
+    v8::String::Utf8Value file(path);
+    try {
+        FileStream stream(*file, FileStream::WRITE, FileStream::OVERWRITE_OR_CREATE);
+        size_t count = Tracer::write(stream);
+        stream.close();
+        return count;
+    } catch (...) {
+        env->ThrowError("failed to write trace file");
+        return -1;
+    }
+}
+
+static void Start(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Tracer::start();
+}
+
+static void Stop(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Tracer::stop();
+    if (args.Length() < 1 || args[0]->IsUndefined())
+        return;
+    Environment* env = Environment::GetCurrent(args);
+    double count = WriteTrace(env, args[0]);
+    if (count >= 0)
+        args.GetReturnValue().Set(count);
+}
+
+static void Write(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Environment* env = Environment::GetCurrent(args);
+    double count = WriteTrace(env, args[0]);
+    if (count >= 0)
+        args.GetReturnValue().Set(count);
+}
+
+static void Enabled(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    args.GetReturnValue().Set(Tracer::enabled());
+}
+
+void TracingObject::setup()
+{
+    v8::HandleScope handleScope(isolate_);
+    setMethod("start", Start);
+    setMethod("stop", Stop);
+    setMethod("write", Write);
+    setMethod("enabled", Enabled);
+
+    setToGlobal();
+}
+
+} } // namespace Mordor::Test
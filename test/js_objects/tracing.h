@@ -0,0 +1,22 @@
+#ifndef MD_JSOBJECT_TRACING_H_
+#define MD_JSOBJECT_TRACING_H_
+
+#include "class_base.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+// tracing.start(), tracing.stop([path]) and tracing.write(path), see Tracer.
+class TracingObject : public ClassBase
+{
+public:
+    TracingObject(Environment* env) : ClassBase(env, name){}
+    constexpr static const char* name { "tracing" } ;
+    virtual void setup() override;
+};
+
+} } // namespace Mordor::Test
+
+#endif // MD_JSOBJECT_TRACING_H_
@@ -0,0 +1,74 @@
+#include <string.h>
+
+#include "md_array_buffer_allocator.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+ArrayBufferAllocator ArrayBufferAllocator::the_singleton;
+
+ArrayBufferAllocator::ArrayBufferAllocator() :
+        live_bytes_(0),
+        peak_bytes_(0),
+        total_bytes_(0),
+        allocations_(0),
+        frees_(0),
+        failures_(0)
+{
+}
+
+void* ArrayBufferAllocator::Allocate(size_t length)
+{
+    if (length > kMaxLength) {
+        failures_.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+    }
+    char* data = new char[length];
+    memset(data, 0, length);
+    onAllocate(length);
+    return data;
+}
+
+void* ArrayBufferAllocator::AllocateUninitialized(size_t length)
+{
+    if (length > kMaxLength) {
+        failures_.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+    }
+    char* data = new char[length];
+    onAllocate(length);
+    return data;
+}
+
+void ArrayBufferAllocator::Free(void* data, size_t length)
+{
+    delete[] static_cast<char*>(data);
+    live_bytes_.fetch_sub(length, std::memory_order_relaxed);
+    frees_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ArrayBufferAllocator::onAllocate(size_t length)
+{
+    uint64_t live = live_bytes_.fetch_add(length, std::memory_order_relaxed) + length;
+    total_bytes_.fetch_add(length, std::memory_order_relaxed);
+    allocations_.fetch_add(1, std::memory_order_relaxed);
+    uint64_t peak = peak_bytes_.load(std::memory_order_relaxed);
+    while (live > peak && !peak_bytes_.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+ArrayBufferAllocator::Stats ArrayBufferAllocator::stats() const
+{
+    Stats stats;
+    stats.live_bytes = live_bytes_.load(std::memory_order_relaxed);
+    stats.peak_bytes = peak_bytes_.load(std::memory_order_relaxed);
+    stats.total_bytes = total_bytes_.load(std::memory_order_relaxed);
+    stats.allocations = allocations_.load(std::memory_order_relaxed);
+    stats.frees = frees_.load(std::memory_order_relaxed);
+    stats.failures = failures_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+} } // namespace Mordor::Test
@@ -0,0 +1,66 @@
+#ifndef MD_ARRAY_BUFFER_ALLOCATOR_H_
+#define MD_ARRAY_BUFFER_ALLOCATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "v8.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+/**
+ * ArrayBufferAllocator
+ *
+ * Backing stores handed to V8 for ArrayBuffers. Keeps cheap counters of
+ * what is currently allocated so memory telemetry can report it.
+ */
+class ArrayBufferAllocator: public v8::ArrayBuffer::Allocator
+{
+public:
+    // Impose an upper limit to avoid out of memory errors that bring down
+    // the process.
+    static const size_t kMaxLength = 0x3fffffff;
+    static ArrayBufferAllocator the_singleton;
+
+    struct Stats
+    {
+        uint64_t live_bytes;
+        uint64_t peak_bytes;
+        uint64_t total_bytes;
+        uint64_t allocations;
+        uint64_t frees;
+        uint64_t failures;
+    };
+
+    virtual ~ArrayBufferAllocator()
+    {
+    }
+    virtual void* Allocate(size_t length);
+    virtual void* AllocateUninitialized(size_t length);
+    virtual void Free(void* data, size_t length);
+
+    Stats stats() const;
+
+private:
+    ArrayBufferAllocator();
+    ArrayBufferAllocator(const ArrayBufferAllocator&);
+    void operator=(const ArrayBufferAllocator&);
+
+    void onAllocate(size_t length);
+
+    std::atomic<uint64_t> live_bytes_;
+    std::atomic<uint64_t> peak_bytes_;
+    std::atomic<uint64_t> total_bytes_;
+    std::atomic<uint64_t> allocations_;
+    std::atomic<uint64_t> frees_;
+    std::atomic<uint64_t> failures_;
+};
+
+} } // namespace Mordor::Test
+
+#endif // MD_ARRAY_BUFFER_ALLOCATOR_H_
@@ -0,0 +1,138 @@
+#include <pthread.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <functional>
+
+#include "mordor/config.h"
+#include "mordor/version.h"
+
+#include "md_budget.h"
+#include "md_trace.h"
+#include "md_worker.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+static ConfigVar<unsigned int>::ptr g_wallBudget =
+        Config::lookup("mdv8.budget.wall", 0u,
+                "Wall clock budget of one script execution in ms, 0 for none");
+static ConfigVar<unsigned int>::ptr g_cpuBudget =
+        Config::lookup("mdv8.budget.cpu", 0u,
+                "CPU time budget of one script execution in ms, 0 for none");
+
+ExecutionBudget::Limits ExecutionBudget::DefaultLimits()
+{
+    Limits limits;
+    limits.wall = g_wallBudget->val() * 1000ull;
+    limits.cpu = g_cpuBudget->val() * 1000ull;
+    if (limits.cpu && !MD_Worker::isolateAffinityConfigured()) {
+        static bool warned = false;
+        if (!warned) {
+            fprintf(stderr, "mdv8.budget.cpu needs mdv8.worker.isolateaffinity, ignored\n");
+            warned = true;
+        }
+        limits.cpu = 0;
+    }
+    return limits;
+}
+
+ExecutionBudget::ExecutionBudget(v8::Isolate* isolate, TimerManager* timers, const Limits& limits) :
+        isolate_(isolate),
+        limits_(limits),
+        wall_start_(TimerManager::now()),
+        has_cpu_clock_(false),
+        cpu_start_(0),
+        guard_(GuardedTarget<ExecutionBudget>::Create(this)),
+        expired_(false),
+        expired_cpu_(false)
+{
+#ifdef LINUX
+    if (limits_.cpu && pthread_getcpuclockid(pthread_self(), &cpu_clock_) == 0) {
+        has_cpu_clock_ = true;
+        cpu_start_ = cpuUsed();
+    }
+#endif
+    if (timers == NULL || (limits_.wall == 0 && !has_cpu_clock_))
+        return;
+    // A wall clock budget alone needs a single shot; CPU time has to be
+    // polled since it advances slower than the clock.
+    if (has_cpu_clock_) {
+        unsigned long long period = std::min(limits_.cpu, kPollInterval);
+        if (limits_.wall)
+            period = std::min(period, limits_.wall);
+        timer_ = timers->registerTimer(period,
+                GuardedTarget<ExecutionBudget>::Bind(guard_, &ExecutionBudget::check), true);
+    } else {
+        timer_ = timers->registerTimer(limits_.wall,
+                GuardedTarget<ExecutionBudget>::Bind(guard_, &ExecutionBudget::check));
+    }
+}
+
+ExecutionBudget::~ExecutionBudget()
+{
+    // Waits out a poll in progress; later ones find no budget.
+    guard_->detach();
+    if (timer_)
+        timer_->cancel();
+    // The script may have finished right after the budget ran out; don't
+    // let the pending termination hit whatever runs next.
+    recover();
+}
+
+unsigned long long ExecutionBudget::cpuUsed() const
+{
+    struct timespec ts;
+    if (clock_gettime(cpu_clock_, &ts) != 0)
+        return 0;
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+// Timer thread.
+void ExecutionBudget::check()
+{
+    if (expired_)
+        return;
+    bool wall = limits_.wall && TimerManager::now() - wall_start_ >= limits_.wall;
+    bool cpu = has_cpu_clock_ && cpuUsed() - cpu_start_ >= limits_.cpu;
+    if (!wall && !cpu)
+        return;
+    MD_TRACE_INSTANT("v8", "TerminateExecution");
+    expired_ = true;
+    expired_cpu_ = cpu && !wall;
+    v8::V8::TerminateExecution(isolate_);
+}
+
+bool ExecutionBudget::expired() const
+{
+    std::lock_guard<std::mutex> scopeLock(guard_->mutex());
+    return expired_;
+}
+
+bool ExecutionBudget::recover()
+{
+    if (!expired())
+        return false;
+    v8::V8::CancelTerminateExecution(isolate_);
+    return true;
+}
+
+void ExecutionBudget::throwTimeout() const
+{
+    char message[128];
+    {
+        std::lock_guard<std::mutex> scopeLock(guard_->mutex());
+        if (expired_cpu_)
+            snprintf(message, sizeof(message), "Script execution timed out after %llu ms of CPU time",
+                     limits_.cpu / 1000);
+        else
+            snprintf(message, sizeof(message), "Script execution timed out after %llu ms",
+                     limits_.wall / 1000);
+    }
+    isolate_->ThrowException(v8::Exception::Error(
+            v8::String::NewFromUtf8(isolate_, message)));
+}
+
+} } // namespace Mordor::Test
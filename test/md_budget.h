@@ -0,0 +1,90 @@
+#ifndef MD_BUDGET_H_
+#define MD_BUDGET_H_
+
+#include <time.h>
+
+#include <string>
+
+#include "v8.h"
+#include "mordor/util.h"
+#include "mordor/timer.h"
+
+#include "md_guarded.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+/**
+ * ExecutionBudget
+ *
+ * Bounds one script execution in wall clock and/or CPU time of the thread
+ * that runs it. A timer polls the budget and calls V8::TerminateExecution
+ * once it is exceeded; the executing side then calls recover(), which
+ * cancels the termination so the isolate stays usable and the timeout can
+ * be reported as an ordinary error.
+ *
+ * Construct it on the thread that runs the script, right before running.
+ * Defaults come from --mdv8.budget.wall and --mdv8.budget.cpu (ms, 0 for
+ * no limit).
+ *
+ * CPU time is read from the clock of the constructing thread. Without
+ * isolate affinity a script that waits in doTask can resume on another
+ * thread, and the fibers sharing the thread are charged too, so the
+ * default CPU limit only applies with --mdv8.worker.isolateaffinity, where
+ * that thread runs nothing but isolate work.
+ *
+ * The timer goes through a GuardedTarget, so a poll already running when
+ * the budget goes away finds nothing to terminate.
+ */
+class ExecutionBudget : Mordor::noncopyable
+{
+public:
+    // Timer period while a CPU budget is active.
+    static const unsigned long long kPollInterval = 10000;
+
+    struct Limits
+    {
+        Limits() : wall(0), cpu(0) {}
+
+        unsigned long long wall;    // µs
+        unsigned long long cpu;     // µs
+    };
+
+    static Limits DefaultLimits();
+
+    ExecutionBudget(v8::Isolate* isolate, TimerManager* timers,
+                    const Limits& limits = DefaultLimits());
+    ~ExecutionBudget();
+
+    bool expired() const;
+
+    // Returns true if this budget terminated the script, after cancelling
+    // the termination.
+    bool recover();
+
+    // Throws a JS Error describing the timeout into the current TryCatch.
+    void throwTimeout() const;
+
+private:
+    // Under the guard's lock.
+    void check();
+    unsigned long long cpuUsed() const;
+
+    v8::Isolate* const isolate_;
+    const Limits limits_;
+    unsigned long long wall_start_;
+    bool has_cpu_clock_;
+    clockid_t cpu_clock_;
+    unsigned long long cpu_start_;
+    Timer::ptr timer_;
+
+    GuardedTarget<ExecutionBudget>::ptr guard_;
+    bool expired_;
+    bool expired_cpu_;
+};
+
+} } // namespace Mordor::Test
+
+#endif // MD_BUDGET_H_
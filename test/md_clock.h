@@ -0,0 +1,34 @@
+#ifndef MD_CLOCK_H_
+#define MD_CLOCK_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+namespace Mordor
+{
+namespace Test
+{
+
+// Monotonic time in nanoseconds, for measurements finer than the
+// microseconds of TimerManager::now().
+inline uint64_t MonotonicNanos()
+{
+#ifdef __APPLE__
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0)
+        mach_timebase_info(&timebase);
+    return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+} } // namespace Mordor::Test
+
+#endif // MD_CLOCK_H_
@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <functional>
+
+#include "mordor/assert.h"
+#include "mordor/config.h"
+
+#include "md_context_pool.h"
+#include "md_env.h"
+#include "md_env_inl.h"
+#include "md_worker.h"
+#include "md_trace.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+static ConfigVar<unsigned int>::ptr g_poolSize =
+        Config::lookup("mdv8.contextpool.size", 0u,
+                "Number of contexts kept bootstrapped for requests read from a pipe, 0 disables "
+                "the pool; lines typed at a terminal always share the shell's context");
+static ConfigVar<std::string>::ptr g_poolPolicy =
+        Config::lookup("mdv8.contextpool.policy", std::string("recycle"),
+                "What to do with a context after a request: recycle or discard");
+static ConfigVar<unsigned int>::ptr g_poolMaxUses =
+        Config::lookup("mdv8.contextpool.maxuses", 100u,
+                "Requests a recycled context serves before it is discarded, 0 is no limit");
+
+struct ContextPool::Entry
+{
+    Entry(v8::Isolate* isolate, v8::Local<v8::Context> context) :
+            context(isolate, context),
+            uses(0)
+    {
+    }
+
+    v8::Persistent<v8::Context> context;
+    unsigned int uses;
+};
+
+ContextPool::Lease::Lease(ContextPool* pool) :
+        pool_(pool),
+        entry_(pool ? pool->acquire() : NULL)
+{
+}
+
+ContextPool::Lease::~Lease()
+{
+    if (entry_)
+        pool_->release(entry_);
+}
+
+v8::Local<v8::Context> ContextPool::Lease::context() const
+{
+    return StrongPersistentToLocal(entry_->context);
+}
+
+ContextPool* ContextPool::Create(Environment* env, MD_Worker* worker)
+{
+    unsigned int size = g_poolSize->val();
+    if (size == 0)
+        return NULL;
+    Policy policy = g_poolPolicy->val() == "discard" ? kDiscard : kRecycle;
+    return new ContextPool(env, worker, size, policy, g_poolMaxUses->val());
+}
+
+ContextPool::ContextPool(Environment* env, MD_Worker* worker,
+                         size_t size, Policy policy, unsigned int max_uses) :
+        env_(env),
+        isolate_(env->isolate()),
+        worker_(worker),
+        size_(size),
+        policy_(policy),
+        max_uses_(max_uses),
+        started_(false),
+        idle_(false),
+        hits_(0),
+        misses_(0),
+        created_(0),
+        recycled_(0),
+        discarded_(0),
+        bootstrap_total_(0),
+        bootstrap_max_(0)
+{
+}
+
+ContextPool::~ContextPool()
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    for (size_t i = 0; i < ready_.size(); ++i)
+        dispose(ready_[i]);
+    ready_.clear();
+}
+
+const char* ContextPool::policyName(Policy policy)
+{
+    return policy == kDiscard ? "discard" : "recycle";
+}
+
+void ContextPool::start(const Setup& setup)
+{
+    MORDOR_ASSERT(!started_.load(std::memory_order_relaxed));
+    setup_ = setup;
+    started_.store(true, std::memory_order_release);
+}
+
+void ContextPool::setIdle(bool idle)
+{
+    idle_.store(idle, std::memory_order_relaxed);
+}
+
+ContextPool::Entry* ContextPool::acquire()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (!ready_.empty()) {
+            Entry* entry = ready_.front();
+            ready_.pop_front();
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return entry;
+        }
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return bootstrap();
+}
+
+void ContextPool::release(Entry* entry)
+{
+    entry->uses += 1;
+    if (policy_ == kRecycle && (max_uses_ == 0 || entry->uses < max_uses_)) {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (ready_.size() < size_) {
+            // Most recently used first, its heap pages are still warm.
+            ready_.push_front(entry);
+            recycled_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    dispose(entry);
+}
+
+ContextPool::Entry* ContextPool::bootstrap()
+{
+    MD_TRACE_SCOPE("v8", "ContextPool::bootstrap");
+    unsigned long long start = TimerManager::now();
+    v8::HandleScope handle_scope(isolate_);
+    v8::Local<v8::Context> context = v8::Context::New(isolate_);
+    {
+        v8::Context::Scope context_scope(context);
+        env_->AssignToContext(context);
+        if (setup_)
+            setup_(context);
+    }
+    Entry* entry = new Entry(isolate_, context);
+
+    uint64_t elapsed = TimerManager::now() - start;
+    created_.fetch_add(1, std::memory_order_relaxed);
+    bootstrap_total_.fetch_add(elapsed, std::memory_order_relaxed);
+    uint64_t max = bootstrap_max_.load(std::memory_order_relaxed);
+    while (elapsed > max && !bootstrap_max_.compare_exchange_weak(max, elapsed, std::memory_order_relaxed)) {
+    }
+    return entry;
+}
+
+void ContextPool::dispose(Entry* entry)
+{
+    {
+        v8::HandleScope handle_scope(isolate_);
+        StrongPersistentToLocal(entry->context)->SetAlignedPointerInEmbedderData(
+                MD_V8_CONTEXT_EMBEDDER_DATA_INDEX, NULL);
+    }
+    entry->context.Reset();
+    delete entry;
+    discarded_.fetch_add(1, std::memory_order_relaxed);
+}
+
+size_t ContextPool::deficit() const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return size_ - std::min(size_, ready_.size());
+}
+
+bool ContextPool::quiet() const
+{
+    if (!started_.load(std::memory_order_acquire) || !idle_.load(std::memory_order_relaxed))
+        return false;
+    return worker_ == NULL || worker_->queued() == 0;
+}
+
+bool ContextPool::refillPending() const
+{
+    return quiet() && deficit() > 0;
+}
+
+// Called by the runner while it waits for input. One context per pass so
+// input that arrives meanwhile is not held up behind a whole refill.
+bool ContextPool::refill()
+{
+    if (!refillPending())
+        return false;
+    {
+        MD_TRACE_SCOPE("v8", "ContextPool::refill");
+        Entry* entry = bootstrap();
+        std::lock_guard<std::mutex> guard(lock_);
+        ready_.push_back(entry);
+    }
+    return refillPending();
+}
+
+ContextPool::Stats ContextPool::stats() const
+{
+    Stats stats;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stats.ready = ready_.size();
+    }
+    stats.size = size_;
+    stats.policy = policy_;
+    stats.hits = hits_.load(std::memory_order_relaxed);
+    stats.misses = misses_.load(std::memory_order_relaxed);
+    stats.created = created_.load(std::memory_order_relaxed);
+    stats.recycled = recycled_.load(std::memory_order_relaxed);
+    stats.discarded = discarded_.load(std::memory_order_relaxed);
+    stats.bootstrap_total = bootstrap_total_.load(std::memory_order_relaxed);
+    stats.bootstrap_max = bootstrap_max_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+} } // namespace Mordor::Test
@@ -0,0 +1,159 @@
+#ifndef MD_CONTEXT_POOL_H_
+#define MD_CONTEXT_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "v8.h"
+#include "mordor/util.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+class Environment;
+class MD_Worker;
+
+/**
+ * ContextPool
+ *
+ * Keeps --mdv8.contextpool.size contexts bootstrapped ahead of time, with
+ * the Environment assigned and the globals installed by the setup passed
+ * to start(), so a request does not pay for Context::New and the JS
+ * objects on its own latency. The runner leases one per script when its
+ * input is not a terminal, so every piped in request starts from its own
+ * context. An interactive session keeps running in the shell's context:
+ * leasing there would make globals vanish between lines.
+ *
+ * What happens to a context after its lease depends on
+ * --mdv8.contextpool.policy: "recycle" puts it back for the next request,
+ * until it has served --mdv8.contextpool.maxuses of them (0 is no limit);
+ * globals a script leaves behind are seen by the next one. "discard"
+ * throws it away so every request starts clean.
+ *
+ * Refills happen in idle time: the IdleGcScheduler timer asks
+ * refillPending() whether the runner is waiting for input, the worker
+ * queue is empty and the pool is short, then wakes the runner, which calls
+ * refill() and bootstraps one context per pass. Without that timer
+ * (--mdv8.gc.idleinterval 0) the pool only fills with recycled contexts.
+ * A lease that finds the pool empty bootstraps synchronously and counts as
+ * a miss.
+ *
+ * Everything but stats() and refillPending() runs on the isolate thread,
+ * under the isolate lock.
+ */
+class ContextPool : Mordor::noncopyable
+{
+public:
+    enum Policy {
+        kRecycle = 0,
+        kDiscard
+    };
+
+    // Installs the globals into the context, which is entered.
+    typedef std::function<void (v8::Local<v8::Context>)> Setup;
+
+    struct Stats
+    {
+        size_t size;
+        size_t ready;
+        Policy policy;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t created;
+        uint64_t recycled;
+        uint64_t discarded;
+        // Time spent bootstrapping contexts, in µs.
+        uint64_t bootstrap_total;
+        uint64_t bootstrap_max;
+    };
+
+private:
+    struct Entry;
+
+public:
+    class Lease : Mordor::noncopyable
+    {
+    public:
+        // A NULL pool leases nothing.
+        explicit Lease(ContextPool* pool);
+        ~Lease();
+
+        bool empty() const
+        {
+            return entry_ == NULL;
+        }
+
+        v8::Local<v8::Context> context() const;
+
+    private:
+        ContextPool* const pool_;
+        Entry* entry_;
+    };
+
+    // Must be called on the isolate thread. Returns NULL when
+    // --mdv8.contextpool.size is 0.
+    static ContextPool* Create(Environment* env, MD_Worker* worker);
+
+    ContextPool(Environment* env, MD_Worker* worker,
+                size_t size, Policy policy, unsigned int max_uses);
+    ~ContextPool();
+
+    static const char* policyName(Policy policy);
+
+    // Nothing is bootstrapped before the setup is known.
+    void start(const Setup& setup);
+
+    void setIdle(bool idle);
+
+    // Whether refill() has work, from any thread.
+    bool refillPending() const;
+
+    // Bootstraps one context if the shell is still idle. Returns true while
+    // the pool is still short, so the runner goes on without waiting for
+    // the next timer tick.
+    bool refill();
+
+    Stats stats() const;
+
+private:
+    Entry* acquire();
+    void release(Entry* entry);
+
+    Entry* bootstrap();
+    void dispose(Entry* entry);
+    size_t deficit() const;
+    bool quiet() const;
+
+    Environment* const env_;
+    v8::Isolate* const isolate_;
+    MD_Worker* const worker_;
+    const size_t size_;
+    const Policy policy_;
+    const unsigned int max_uses_;
+    Setup setup_;
+
+    mutable std::mutex lock_;
+    std::deque<Entry*> ready_;
+
+    std::atomic<bool> started_;
+    std::atomic<bool> idle_;
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> created_;
+    std::atomic<uint64_t> recycled_;
+    std::atomic<uint64_t> discarded_;
+    std::atomic<uint64_t> bootstrap_total_;
+    std::atomic<uint64_t> bootstrap_max_;
+};
+
+} } // namespace Mordor::Test
+
+#endif // MD_CONTEXT_POOL_H_
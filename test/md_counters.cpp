@@ -0,0 +1,104 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "mordor/config.h"
+
+#include "md_counters.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+static ConfigVar<std::string>::ptr g_countersFile =
+        Config::lookup("mdv8.counters.file", std::string(),
+                "Export V8 counters to this memory mapped file");
+
+CounterCollection* CounterTable::s_collection = NULL;
+std::mutex CounterTable::s_lock;
+std::unordered_map<std::string, CounterSlot*> CounterTable::s_slots;
+
+bool CounterTable::Install(v8::Isolate* isolate, const char* path)
+{
+    {
+        std::lock_guard<std::mutex> scopeLock(s_lock);
+        if (s_collection == NULL) {
+            int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+                return false;
+            if (ftruncate(fd, sizeof(CounterCollection)) != 0) {
+                close(fd);
+                return false;
+            }
+            void* memory = mmap(NULL, sizeof(CounterCollection), PROT_READ | PROT_WRITE,
+                                MAP_SHARED, fd, 0);
+            close(fd);
+            if (memory == MAP_FAILED)
+                return false;
+            s_collection = static_cast<CounterCollection*>(memory);
+            s_collection->max_counters = CounterCollection::kMaxCounters;
+            s_collection->max_name_size = CounterSlot::kMaxNameSize;
+            s_collection->counters_in_use = 0;
+            // Readers check the magic number last.
+            __atomic_store_n(&s_collection->magic_number, CounterCollection::kMagicNumber,
+                             __ATOMIC_RELEASE);
+        }
+    }
+    isolate->SetCounterFunction(LookupCounter);
+    isolate->SetCreateHistogramFunction(CreateHistogram);
+    isolate->SetAddHistogramSampleFunction(AddHistogramSample);
+    return true;
+}
+
+void CounterTable::InstallFromConfig(v8::Isolate* isolate)
+{
+    std::string path = g_countersFile->val();
+    if (path.empty())
+        return;
+    if (!Install(isolate, path.c_str()))
+        fprintf(stderr, "cannot map counters file %s\n", path.c_str());
+}
+
+CounterSlot* CounterTable::bind(const char* name, bool is_histogram)
+{
+    std::lock_guard<std::mutex> scopeLock(s_lock);
+    std::unordered_map<std::string, CounterSlot*>::iterator it = s_slots.find(name);
+    if (it != s_slots.end())
+        return it->second;
+    uint32_t index = s_collection->counters_in_use;
+    if (index >= CounterCollection::kMaxCounters)
+        return NULL;
+    CounterSlot* slot = &s_collection->counters[index];
+    slot->count = 0;
+    slot->sample_total = 0;
+    slot->is_histogram = is_histogram;
+    strncpy(reinterpret_cast<char*>(slot->name), name, CounterSlot::kMaxNameSize - 1);
+    slot->name[CounterSlot::kMaxNameSize - 1] = '\0';
+    // Publish the slot only once its name is in place.
+    __atomic_store_n(&s_collection->counters_in_use, index + 1, __ATOMIC_RELEASE);
+    s_slots[name] = slot;
+    return slot;
+}
+
+int* CounterTable::LookupCounter(const char* name)
+{
+    CounterSlot* slot = bind(name, false);
+    return slot ? &slot->count : NULL;
+}
+
+void* CounterTable::CreateHistogram(const char* name, int min, int max, size_t buckets)
+{
+    return bind(name, true);
+}
+
+void CounterTable::AddHistogramSample(void* histogram, int sample)
+{
+    CounterSlot* slot = static_cast<CounterSlot*>(histogram);
+    __atomic_fetch_add(&slot->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&slot->sample_total, sample, __ATOMIC_RELAXED);
+}
+
+} } // namespace Mordor::Test
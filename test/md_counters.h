@@ -0,0 +1,77 @@
+#ifndef MD_COUNTERS_H_
+#define MD_COUNTERS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "v8.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+// Shared memory layout of V8's native counters. It is the layout d8 uses
+// for --map-counters, so v8/tools/stats-viewer.py can read our files too.
+struct CounterSlot
+{
+    static const int kMaxNameSize = 64;
+
+    int32_t count;
+    int32_t sample_total;
+    bool is_histogram;
+    uint8_t name[kMaxNameSize];
+};
+
+struct CounterCollection
+{
+    static const uint32_t kMagicNumber = 0xDEADFACE;
+    static const uint32_t kMaxCounters = 512;
+
+    uint32_t magic_number;
+    uint32_t max_counters;
+    uint32_t max_name_size;
+    uint32_t counters_in_use;
+    CounterSlot counters[kMaxCounters];
+};
+
+/**
+ * CounterTable
+ *
+ * Backs V8's counter and histogram callbacks with a CounterCollection in a
+ * memory mapped file (--mdv8.counters.file), so other processes can watch
+ * the counters of a live shell without asking it anything.
+ *
+ * V8 bumps counters through the pointers we hand out, and histogram
+ * samples are relaxed atomic adds, so updates never lock. Only binding a
+ * name to a slot takes a mutex, which happens once per counter.
+ */
+class CounterTable
+{
+public:
+    // Maps |path| and installs the callbacks on |isolate|. Returns false if
+    // the file could not be mapped.
+    static bool Install(v8::Isolate* isolate, const char* path);
+
+    // Installs on |isolate| if --mdv8.counters.file is set.
+    static void InstallFromConfig(v8::Isolate* isolate);
+
+private:
+    static int* LookupCounter(const char* name);
+    static void* CreateHistogram(const char* name, int min, int max, size_t buckets);
+    static void AddHistogramSample(void* histogram, int sample);
+
+    static CounterSlot* bind(const char* name, bool is_histogram);
+
+    static CounterCollection* s_collection;
+    static std::mutex s_lock;
+    static std::unordered_map<std::string, CounterSlot*> s_slots;
+};
+
+} } // namespace Mordor::Test
+
+#endif // MD_COUNTERS_H_
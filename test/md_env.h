@@ -5,7 +5,13 @@
 
 #include "v8.h"
 #include "mordor/util.h"
+#include "mordor/fibersynchronization.h"
 #include "md_v8_util_inl.h"
+#include "md_memory.h"
+#include "md_profiler.h"
+#include "md_watchdog.h"
+#include "md_idle_gc.h"
+#include "md_context_pool.h"
 
 namespace Mordor
 {
@@ -25,6 +31,7 @@ namespace Test
   V(args_string, "args")                                                      \
   V(argv_string, "argv")                                                      \
   V(code_string, "code")                                                      \
+  V(compress_string, "compress")                                              \
   V(env_string, "env")                                                        \
   V(errno_string, "errno")                                                    \
   V(error_string, "error")                                                    \
@@ -35,12 +42,18 @@ namespace Test
   V(heap_total_exec_string, "heapExecTotal")                                  \
   V(heap_used_string, "heapUsed")                                             \
   V(heap_limit_string, "heapLimit")                                           \
+  V(rss_string, "rss")                                                        \
+  V(external_string, "external")                                              \
+  V(array_buffers_string, "arrayBuffers")                                     \
+  V(spaces_string, "spaces")                                                  \
+  V(gc_string, "gc")                                                          \
   V(message_string, "message")                                                \
   V(processed_string, "processed")                                            \
   V(stack_string, "stack")                                            \
 
 
 #define ENVIRONMENT_STRONG_PERSISTENT_PROPERTIES(V)                           \
+  V(as_external, v8::External)                                                \
   V(context, v8::Context)                                                     \
   V(binding_cache_object, v8::Object)                                         \
   V(module_load_list_array, v8::Array)                                        \
@@ -54,6 +67,11 @@ class Environment: Mordor::noncopyable
 public:
     static inline Environment* GetCurrent(v8::Isolate* isolate);
     static inline Environment* GetCurrent(v8::Local<v8::Context> context);
+    // Binding callbacks installed with as_external() as their data get the
+    // Environment back without going through the current context.
+    static inline Environment* GetCurrent(const v8::FunctionCallbackInfo<v8::Value>& info);
+    template <typename TypeName>
+    static inline Environment* GetCurrent(const v8::PropertyCallbackInfo<TypeName>& info);
     static inline Environment* New(v8::Local<v8::Context> context, Scheduler* scheduer);
     inline void Dispose();
 
@@ -64,6 +82,48 @@ public:
         return worker_.get();
     }
 
+    inline GcStats* gc_stats() const;
+    inline HeapGuard* heap_guard() const;
+
+    // NULL unless --mdv8.memory.sampleinterval is set.
+    MemorySampler* memory_sampler(){
+        return memory_sampler_.get();
+    }
+
+    // NULL unless --mdv8.watchdog.interval is set.
+    IsolateWatchdog* watchdog(){
+        return watchdog_.get();
+    }
+
+    // NULL when idle time GC is disabled.
+    IdleGcScheduler* idle_gc(){
+        return idle_gc_.get();
+    }
+
+    // NULL unless --mdv8.contextpool.size is set.
+    ContextPool* context_pool(){
+        return context_pool_.get();
+    }
+
+    // The runner is waiting for input; tells the watchdog, the idle GC and
+    // the context pool.
+    inline void set_idle(bool idle);
+
+    // While it waits for input the runner sleeps in wait_idle(), and does
+    // the work the idle GC timer wakes it for, GC and context pool refills,
+    // in run_idle_work(), on the isolate thread under the isolate lock.
+    inline void wake_idle();
+    inline void wait_idle();
+    inline void run_idle_work();
+
+    CpuProfilerSession* cpu_profiler(){
+        return cpu_profiler_.get();
+    }
+
+    AllocationSampler* allocation_sampler(){
+        return allocation_sampler_.get();
+    }
+
     void AssignToContext(v8::Local<v8::Context> context);
     inline v8::Isolate* isolate() const;
 
@@ -145,6 +205,13 @@ private:
     int return_value_;
 
     std::unique_ptr<MD_Worker> worker_;
+    std::unique_ptr<MemorySampler> memory_sampler_;
+    std::unique_ptr<IsolateWatchdog> watchdog_;
+    std::unique_ptr<IdleGcScheduler> idle_gc_;
+    std::unique_ptr<CpuProfilerSession> cpu_profiler_;
+    std::unique_ptr<AllocationSampler> allocation_sampler_;
+    std::unique_ptr<ContextPool> context_pool_;
+    Mordor::FiberSemaphore idle_wake_ { 0 };
 
 #define V(PropertyName, TypeName)                                             \
   v8::Persistent<TypeName> PropertyName ## _;
@@ -166,6 +233,14 @@ private:
         static inline IsolateData* GetOrCreate(v8::Isolate* isolate);
         inline void Put();
 
+        GcStats* gc_stats() {
+            return &gc_stats_;
+        }
+
+        HeapGuard* heap_guard() {
+            return &heap_guard_;
+        }
+
 #define V(PropertyName, StringValue)                                          \
       inline v8::Local<v8::String> PropertyName() const;
         PER_ISOLATE_STRING_PROPERTIES(V)
@@ -182,6 +257,8 @@ private:
         PER_ISOLATE_STRING_PROPERTIES(V)
 #undef V
 
+        GcStats gc_stats_;
+        HeapGuard heap_guard_;
         unsigned int ref_count_;
     };  // class IsolateData
 
@@ -41,6 +41,8 @@ inline Environment::IsolateData::IsolateData(v8::Isolate* isolate) :
     PropertyName ## _(isolate, FIXED_UTF8_STRING(isolate, StringValue)),
     PER_ISOLATE_STRING_PROPERTIES(V)
 #undef V
+        gc_stats_(isolate),
+        heap_guard_(isolate),
         ref_count_(0)
 {
 }
@@ -54,7 +56,33 @@ inline Environment* Environment::New(v8::Local<v8::Context> context, Scheduler*
 {
     Environment::environment.reset(new Environment(context), Environment::EnvironmentDeleter());
     Environment::environment->AssignToContext(context);
-    Environment::environment->worker_.reset(MD_Worker::New(scheduer, kWorkerPoolSize));
+    Environment::environment->worker_.reset(MD_Worker::New(scheduer, kWorkerPoolSize,
+            MD_Worker::isolateAffinityConfigured() ? gettid() : emptytid()));
+    // Bulk work is turned away while the heap is under pressure.
+    MD_Worker* worker = Environment::environment->worker();
+    Environment::environment->heap_guard()->setPressureHandler(
+            std::bind(&MD_Worker::setShedding, worker, std::placeholders::_1));
+    worker->setShedding(Environment::environment->heap_guard()->underPressure());
+    Environment::environment->memory_sampler_.reset(
+            MemorySampler::Create(Environment::environment->gc_stats(), dynamic_cast<TimerManager*>(scheduer)));
+    Environment::environment->watchdog_.reset(
+            IsolateWatchdog::Create(Environment::environment->isolate(), scheduer));
+    Environment::environment->context_pool_.reset(
+            ContextPool::Create(Environment::environment.get(), Environment::environment->worker()));
+    // The idle GC timer also wakes the runner to refill the pool.
+    IdleGcScheduler::Pending refill_pending;
+    if (ContextPool* pool = Environment::environment->context_pool())
+        refill_pending = std::bind(&ContextPool::refillPending, pool);
+    Environment::environment->idle_gc_.reset(
+            IdleGcScheduler::Create(Environment::environment->isolate(), scheduer,
+                                    Environment::environment->worker(),
+                                    std::bind(&Environment::wake_idle, Environment::environment.get()),
+                                    refill_pending));
+    Environment::environment->cpu_profiler_.reset(
+            new CpuProfilerSession(Environment::environment->isolate(), scheduer));
+    Environment::environment->allocation_sampler_.reset(
+            new AllocationSampler(Environment::environment->isolate(),
+                                  dynamic_cast<TimerManager*>(scheduer), scheduer));
     return Environment::environment.get();
 }
 
@@ -73,6 +101,19 @@ inline Environment* Environment::GetCurrent(v8::Local<v8::Context> context)
     return static_cast<Environment*>(context->GetAlignedPointerFromEmbedderData(kContextEmbedderDataIndex));
 }
 
+inline Environment* Environment::GetCurrent(const v8::FunctionCallbackInfo<v8::Value>& info)
+{
+    MORDOR_ASSERT(info.Data()->IsExternal());
+    return static_cast<Environment*>(info.Data().As<v8::External>()->Value());
+}
+
+template <typename TypeName>
+inline Environment* Environment::GetCurrent(const v8::PropertyCallbackInfo<TypeName>& info)
+{
+    MORDOR_ASSERT(info.Data()->IsExternal());
+    return static_cast<Environment*>(info.Data().As<v8::External>()->Value());
+}
+
 inline MD_Worker* Environment::GetCurrentWorker(v8::Isolate* isolate)
 {
     return Environment::GetCurrent(isolate)->worker();
@@ -96,12 +137,24 @@ inline Environment::Environment(v8::Local<v8::Context> context) :
     // We'll be creating new objects so make sure we've entered the context.
     v8::HandleScope handle_scope(isolate());
     v8::Context::Scope context_scope(context);
+    set_as_external(v8::External::New(isolate(), this));
     set_binding_cache_object(v8::Object::New(isolate()));
     set_module_load_list_array(v8::Array::New(isolate()));
 }
 
 inline Environment::~Environment()
 {
+    // Its timer asks the pool for refills.
+    idle_gc_.reset();
+    // Pooled contexts point back at us.
+    context_pool_.reset();
+    // The isolate data outlives the worker.
+    heap_guard()->setPressureHandler(HeapGuard::PressureHandler());
+    // The sampler reads GcStats, which goes away with the isolate data.
+    memory_sampler_.reset();
+    watchdog_.reset();
+    cpu_profiler_.reset();
+    allocation_sampler_.reset();
     v8::HandleScope handle_scope(isolate());
 
     context()->SetAlignedPointerInEmbedderData(kContextEmbedderDataIndex, NULL);
@@ -126,6 +179,45 @@ inline Environment::IsolateData* Environment::isolate_data() const
     return isolate_data_;
 }
 
+inline GcStats* Environment::gc_stats() const
+{
+    return isolate_data()->gc_stats();
+}
+
+inline void Environment::set_idle(bool idle)
+{
+    if (watchdog_)
+        watchdog_->setIdle(idle);
+    if (idle_gc_)
+        idle_gc_->setIdle(idle);
+    if (context_pool_)
+        context_pool_->setIdle(idle);
+}
+
+inline void Environment::wake_idle()
+{
+    idle_wake_.notify();
+}
+
+inline void Environment::wait_idle()
+{
+    // Whoever wakes us, the isolate lock we hold belongs to this thread.
+    WaitOnThread(idle_wake_, true);
+}
+
+inline void Environment::run_idle_work()
+{
+    if (idle_gc_)
+        idle_gc_->collect();
+    if (context_pool_ && context_pool_->refill())
+        wake_idle();
+}
+
+inline HeapGuard* Environment::heap_guard() const
+{
+    return isolate_data()->heap_guard();
+}
+
 inline bool Environment::using_smalloc_alloc_cb() const
 {
     return using_smalloc_alloc_cb_;
@@ -0,0 +1,101 @@
+#include <algorithm>
+
+#include "mordor/config.h"
+#include "mordor/scheduler.h"
+#include "mordor/thread.h"
+
+#include "md_fiber_pool.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+static ConfigVar<int>::ptr g_smallStack =
+        Config::lookup("mdv8.fiber.smallstack", 128,
+                       "Stack size in KB of pooled fibers that do not enter V8");
+
+static ConfigVar<int>::ptr g_largeStack =
+        Config::lookup("mdv8.fiber.largestack", 1024,
+                       "Stack size in KB of pooled fibers that may run V8");
+
+static ConfigVar<int>::ptr g_poolSize =
+        Config::lookup("mdv8.fiber.poolsize", 16,
+                       "Terminated fibers kept for reuse per fiber pool");
+
+static size_t StackBytes(int kb)
+{
+    return static_cast<size_t>(std::max(kb, 16)) * 1024;
+}
+
+FiberPool& FiberPool::small()
+{
+    static FiberPool pool("small", StackBytes(g_smallStack->val()),
+                          static_cast<size_t>(std::max(g_poolSize->val(), 0)));
+    return pool;
+}
+
+FiberPool& FiberPool::large()
+{
+    static FiberPool pool("large", StackBytes(g_largeStack->val()),
+                          static_cast<size_t>(std::max(g_poolSize->val(), 0)));
+    return pool;
+}
+
+FiberPool::FiberPool(const char* name, size_t stack_size, size_t max_idle) :
+        name_(name),
+        stack_size_(stack_size),
+        max_idle_(max_idle),
+        acquired_(0),
+        hits_(0)
+{
+}
+
+Fiber::ptr FiberPool::acquire(const std::function<void ()>& dg)
+{
+    Fiber::ptr fiber;
+    {
+        std::lock_guard<std::mutex> scopeLock(lock_);
+        ++acquired_;
+        if (!idle_.empty()) {
+            fiber = idle_.back();
+            idle_.pop_back();
+            ++hits_;
+        }
+    }
+    if (fiber) {
+        fiber->reset(dg);
+        return fiber;
+    }
+    return Fiber::ptr(new Fiber(dg, stack_size_));
+}
+
+void FiberPool::release(const Fiber::ptr& fiber)
+{
+    if (fiber->state() != Fiber::TERM)
+        return;
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    if (idle_.size() < max_idle_)
+        idle_.push_back(fiber);
+}
+
+void FiberPool::recycleSelf()
+{
+    Scheduler* sched = Scheduler::getThis();
+    if (sched)
+        sched->schedule(std::bind(&FiberPool::release, this, Fiber::getThis()), gettid());
+}
+
+FiberPool::Stats FiberPool::stats() const
+{
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    Stats stats;
+    stats.stack_size = stack_size_;
+    stats.idle = idle_.size();
+    stats.acquired = acquired_;
+    stats.hits = hits_;
+    stats.retained_bytes = idle_.size() * stack_size_;
+    return stats;
+}
+
+} } // namespace Mordor::Test
@@ -0,0 +1,79 @@
+#ifndef MD_FIBER_POOL_H_
+#define MD_FIBER_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "mordor/fiber.h"
+#include "mordor/util.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+/**
+ * FiberPool
+ *
+ * Keeps terminated fibers, stacks included, and resets them for the next
+ * acquire() instead of mapping a new stack with its guard page. Each pool
+ * hands out one stack size: small() for fibers that only shuffle I/O,
+ * large() for fibers that may enter V8, sized by --mdv8.fiber.smallstack
+ * and --mdv8.fiber.largestack (KB). At most --mdv8.fiber.poolsize idle
+ * fibers are retained per pool.
+ *
+ * A fiber must not be reset while its thread is still switching away from
+ * it, so pooled fibers hand themselves back with recycleSelf() as the last
+ * thing they do.
+ */
+class FiberPool : Mordor::noncopyable
+{
+public:
+    struct Stats
+    {
+        size_t stack_size;
+        size_t idle;
+        uint64_t acquired;
+        uint64_t hits;          // acquires served by a recycled fiber
+        size_t retained_bytes;  // stacks of the idle fibers
+    };
+
+    static FiberPool& small();
+    static FiberPool& large();
+
+    FiberPool(const char* name, size_t stack_size, size_t max_idle);
+
+    const char* name() const
+    {
+        return name_;
+    }
+
+    Fiber::ptr acquire(const std::function<void ()>& dg);
+
+    // Takes |fiber| back if it has terminated; fibers in any other state
+    // are left to their other owners.
+    void release(const Fiber::ptr& fiber);
+
+    // Releases the calling fiber once it has returned: the release is
+    // queued on this thread, which only gets to it after switching out.
+    void recycleSelf();
+
+    Stats stats() const;
+
+private:
+    const char* const name_;
+    const size_t stack_size_;
+    const size_t max_idle_;
+    mutable std::mutex lock_;
+    std::vector<Fiber::ptr> idle_;
+    uint64_t acquired_;
+    uint64_t hits_;
+};
+
+} } // namespace Mordor::Test
+
+#endif // MD_FIBER_POOL_H_
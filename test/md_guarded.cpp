@@ -0,0 +1,67 @@
+#include <set>
+#include <vector>
+
+#include "md_guarded.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+namespace
+{
+
+std::mutex g_pendingLock;
+std::set<Internal::PendingInterrupt*> g_pending;
+
+} // namespace
+
+namespace Internal
+{
+
+void PendingInterrupt::Request(v8::Isolate* isolate, PendingInterrupt* pending)
+{
+    pending->isolate_ = isolate;
+    {
+        std::lock_guard<std::mutex> scopeLock(g_pendingLock);
+        g_pending.insert(pending);
+    }
+    isolate->RequestInterrupt(OnInterrupt, pending);
+}
+
+void PendingInterrupt::OnInterrupt(v8::Isolate* isolate, void* data)
+{
+    PendingInterrupt* pending = static_cast<PendingInterrupt*>(data);
+    {
+        std::lock_guard<std::mutex> scopeLock(g_pendingLock);
+        if (g_pending.erase(pending) == 0)
+            return;
+    }
+    std::unique_ptr<PendingInterrupt> owner(pending);
+    pending->run();
+}
+
+} // namespace Internal
+
+void ReleasePendingInterrupts(v8::Isolate* isolate)
+{
+    std::vector<Internal::PendingInterrupt*> released;
+    {
+        std::lock_guard<std::mutex> scopeLock(g_pendingLock);
+        std::set<Internal::PendingInterrupt*>::iterator it = g_pending.begin();
+        while (it != g_pending.end()) {
+            if ((*it)->isolate_ == isolate) {
+                released.push_back(*it);
+                g_pending.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+    }
+    // Outside the lock, a target may be the last thing keeping an object's
+    // guard alive.
+    for (size_t i = 0; i < released.size(); ++i)
+        delete released[i];
+}
+
+} } // namespace Mordor::Test
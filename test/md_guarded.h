@@ -0,0 +1,147 @@
+#ifndef MD_GUARDED_H_
+#define MD_GUARDED_H_
+
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "v8.h"
+#include "mordor/util.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+// Frees the interrupts requested through a GuardedTarget that |isolate|
+// has not delivered. Call it right before disposing the isolate.
+void ReleasePendingInterrupts(v8::Isolate* isolate);
+
+namespace Internal
+{
+
+// An interrupt handed to V8. A registry owns it until V8 delivers it or
+// ReleasePendingInterrupts() frees it, so a request that never gets to
+// run does not leak.
+class PendingInterrupt : Mordor::noncopyable
+{
+public:
+    virtual ~PendingInterrupt() {}
+
+    // Takes ownership of |pending|.
+    static void Request(v8::Isolate* isolate, PendingInterrupt* pending);
+
+protected:
+    virtual void run() = 0;
+
+private:
+    friend void Mordor::Test::ReleasePendingInterrupts(v8::Isolate* isolate);
+
+    static void OnInterrupt(v8::Isolate* isolate, void* data);
+
+    v8::Isolate* isolate_;
+};
+
+} // namespace Internal
+
+/**
+ * GuardedTarget
+ *
+ * What a timer, a fiber scheduled for later or a V8 interrupt points at
+ * instead of the object it calls back. None of them can be withdrawn
+ * reliably: Timer::cancel() does not wait for a callback already running,
+ * and V8 delivers an interrupt whenever JS runs next. A callback runs under
+ * the target's lock and only while the object is attached. The object
+ * calls detach() first thing in its destructor, which waits out a callback
+ * in progress and leaves later ones with nothing to call.
+ */
+template <typename T>
+class GuardedTarget : Mordor::noncopyable
+{
+public:
+    typedef std::shared_ptr<GuardedTarget> ptr;
+
+    static ptr Create(T* object)
+    {
+        return ptr(new GuardedTarget(object));
+    }
+
+    // Held while a callback runs, for state it shares with the object.
+    std::mutex& mutex()
+    {
+        return lock_;
+    }
+
+    void detach()
+    {
+        std::lock_guard<std::mutex> scopeLock(lock_);
+        object_ = NULL;
+    }
+
+    // For registerTimer() or schedule().
+    static std::function<void ()> Bind(const ptr& target, void (T::*fn)())
+    {
+        return std::bind(&GuardedTarget::call, target, fn);
+    }
+
+    template <typename A>
+    static std::function<void ()> Bind(const ptr& target, void (T::*fn)(A), A arg)
+    {
+        return std::bind(&GuardedTarget::template callWith<A>, target, fn, arg);
+    }
+
+    // Runs |fn| on the isolate thread the next time JS runs, from any
+    // thread.
+    static void RequestInterrupt(const ptr& target, v8::Isolate* isolate, void (T::*fn)())
+    {
+        Internal::PendingInterrupt::Request(isolate, new Interrupt(target, fn));
+    }
+
+private:
+    class Interrupt : public Internal::PendingInterrupt
+    {
+    public:
+        Interrupt(const ptr& target, void (T::*fn)()) :
+                target_(target),
+                fn_(fn)
+        {
+        }
+
+    protected:
+        void run()
+        {
+            target_->call(fn_);
+        }
+
+    private:
+        const ptr target_;
+        void (T::*const fn_)();
+    };
+
+    explicit GuardedTarget(T* object) :
+            object_(object)
+    {
+    }
+
+    void call(void (T::*fn)())
+    {
+        std::lock_guard<std::mutex> scopeLock(lock_);
+        if (object_)
+            (object_->*fn)();
+    }
+
+    template <typename A>
+    void callWith(void (T::*fn)(A), A arg)
+    {
+        std::lock_guard<std::mutex> scopeLock(lock_);
+        if (object_)
+            (object_->*fn)(arg);
+    }
+
+    std::mutex lock_;
+    T* object_;
+};
+
+} } // namespace Mordor::Test
+
+#endif // MD_GUARDED_H_
@@ -0,0 +1,87 @@
+#include <memory>
+
+#include "mordor/exception.h"
+#include "mordor/streams/buffered.h"
+#include "mordor/streams/file.h"
+#include "mordor/streams/zlib.h"
+
+#include "md_heap_snapshot.h"
+#include "md_trace.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+HeapSnapshotWriter::HeapSnapshotWriter(const std::string& path, bool compress) :
+        failed_(false),
+        bytes_(0)
+{
+    stream_.reset(new FileStream(path, FileStream::WRITE, FileStream::OVERWRITE_OR_CREATE));
+    if (compress)
+        stream_.reset(new GzipStream(stream_));
+    BufferedStream::ptr buffered(new BufferedStream(stream_));
+    buffered->bufferSize(kChunkSize);
+    stream_ = buffered;
+}
+
+HeapSnapshotWriter::~HeapSnapshotWriter()
+{
+}
+
+v8::OutputStream::WriteResult HeapSnapshotWriter::WriteAsciiChunk(char* data, int size)
+{
+    try {
+        size_t offset = 0;
+        while (offset < static_cast<size_t>(size))
+            offset += stream_->write(data + offset, size - offset);
+        bytes_ += size;
+        return kContinue;
+    } catch (...) {
+        failed_ = true;
+        return kAbort;
+    }
+}
+
+void HeapSnapshotWriter::EndOfStream()
+{
+    try {
+        stream_->close();
+    } catch (...) {
+        failed_ = true;
+    }
+}
+
+bool HeapSnapshotWriter::Write(v8::Isolate* isolate, const std::string& path, bool compress,
+                               uint64_t* bytes, std::string* error)
+{
+    MD_TRACE_SCOPE("profiler", "HeapSnapshotWriter::Write");
+    std::unique_ptr<HeapSnapshotWriter> writer;
+    try {
+        writer.reset(new HeapSnapshotWriter(path, compress));
+    } catch (...) {
+        *error = "cannot open " + path;
+        return false;
+    }
+
+    v8::HandleScope handle_scope(isolate);
+    v8::HeapProfiler* profiler = isolate->GetHeapProfiler();
+    const v8::HeapSnapshot* snapshot =
+            profiler->TakeHeapSnapshot(v8::String::NewFromUtf8(isolate, path.c_str()));
+    if (snapshot == NULL) {
+        *error = "failed to take heap snapshot";
+        return false;
+    }
+    snapshot->Serialize(writer.get(), v8::HeapSnapshot::kJSON);
+    // The snapshot holds on to a copy of the heap graph, drop it right away.
+    const_cast<v8::HeapSnapshot*>(snapshot)->Delete();
+
+    *bytes = writer->bytes();
+    if (writer->failed()) {
+        *error = "failed to write " + path;
+        return false;
+    }
+    return true;
+}
+
+} } // namespace Mordor::Test
@@ -0,0 +1,62 @@
+#ifndef MD_HEAP_SNAPSHOT_H_
+#define MD_HEAP_SNAPSHOT_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "v8.h"
+#include "v8-profiler.h"
+#include "mordor/streams/stream.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+/**
+ * HeapSnapshotWriter
+ *
+ * v8::OutputStream that forwards every chunk V8 produces straight into a
+ * Mordor stream, so a snapshot is never held in memory as a whole. The
+ * stream stack is FileStream <- [GzipStream <-] BufferedStream.
+ */
+class HeapSnapshotWriter : public v8::OutputStream
+{
+public:
+    static const int kChunkSize = 64 * 1024;
+
+    HeapSnapshotWriter(const std::string& path, bool compress);
+    virtual ~HeapSnapshotWriter();
+
+    // Takes a snapshot of |isolate| and serializes it. Returns false and
+    // sets |error| on failure.
+    static bool Write(v8::Isolate* isolate, const std::string& path, bool compress,
+                      uint64_t* bytes, std::string* error);
+
+    virtual int GetChunkSize() override
+    {
+        return kChunkSize;
+    }
+    virtual WriteResult WriteAsciiChunk(char* data, int size) override;
+    virtual void EndOfStream() override;
+
+    bool failed() const
+    {
+        return failed_;
+    }
+
+    uint64_t bytes() const
+    {
+        return bytes_;
+    }
+
+private:
+    Stream::ptr stream_;
+    bool failed_;
+    uint64_t bytes_;
+};
+
+} } // namespace Mordor::Test
+
+#endif // MD_HEAP_SNAPSHOT_H_
@@ -0,0 +1,164 @@
+#ifndef MD_HISTOGRAM_H_
+#define MD_HISTOGRAM_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "mordor/util.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+/**
+ * Log-linear histogram in the spirit of HdrHistogram.
+ *
+ * Values are grouped by their highest set bit and every group is split into
+ * kSubBuckets linear buckets, which bounds the relative error of a reported
+ * percentile by 1/kSubBuckets over the whole uint64_t range. record() is a
+ * handful of relaxed atomic operations and can be called from any thread;
+ * readers see a slightly racy but consistent-enough view.
+ */
+class Histogram : Mordor::noncopyable
+{
+public:
+    static const int kSubBucketBits = 4;
+    static const int kSubBuckets = 1 << kSubBucketBits;
+    static const int kBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+    Histogram()
+    {
+        reset();
+    }
+
+    void record(uint64_t value)
+    {
+        buckets_[indexOf(value)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+
+        uint64_t cur = min_.load(std::memory_order_relaxed);
+        while (value < cur && !min_.compare_exchange_weak(cur, value, std::memory_order_relaxed)) {
+        }
+        cur = max_.load(std::memory_order_relaxed);
+        while (value > cur && !max_.compare_exchange_weak(cur, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t count() const
+    {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t sum() const
+    {
+        return sum_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t min() const
+    {
+        return count() ? min_.load(std::memory_order_relaxed) : 0;
+    }
+
+    uint64_t max() const
+    {
+        return max_.load(std::memory_order_relaxed);
+    }
+
+    double mean() const
+    {
+        uint64_t n = count();
+        return n ? static_cast<double>(sum()) / n : 0.0;
+    }
+
+    // Smallest recorded value v such that |p| percent of all samples are
+    // <= v, within the bucket resolution.
+    uint64_t percentile(double p) const
+    {
+        uint64_t total = count();
+        if (total == 0)
+            return 0;
+        if (p < 0)
+            p = 0;
+        if (p > 100)
+            p = 100;
+        uint64_t rank = static_cast<uint64_t>(p / 100.0 * total + 0.5);
+        if (rank == 0)
+            rank = 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < kBuckets; ++i) {
+            seen += buckets_[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                uint64_t value = highestEquivalent(i);
+                uint64_t top = max();
+                return value < top ? value : top;
+            }
+        }
+        return max();
+    }
+
+    void reset()
+    {
+        for (int i = 0; i < kBuckets; ++i)
+            buckets_[i].store(0, std::memory_order_relaxed);
+        count_.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+        min_.store(UINT64_MAX, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    // Adds the samples of |other| to this histogram.
+    void merge(const Histogram& other)
+    {
+        for (int i = 0; i < kBuckets; ++i) {
+            uint64_t n = other.buckets_[i].load(std::memory_order_relaxed);
+            if (n)
+                buckets_[i].fetch_add(n, std::memory_order_relaxed);
+        }
+        count_.fetch_add(other.count(), std::memory_order_relaxed);
+        sum_.fetch_add(other.sum(), std::memory_order_relaxed);
+        if (other.count()) {
+            uint64_t value = other.min();
+            uint64_t cur = min_.load(std::memory_order_relaxed);
+            while (value < cur && !min_.compare_exchange_weak(cur, value, std::memory_order_relaxed)) {
+            }
+            value = other.max();
+            cur = max_.load(std::memory_order_relaxed);
+            while (value > cur && !max_.compare_exchange_weak(cur, value, std::memory_order_relaxed)) {
+            }
+        }
+    }
+
+private:
+    static int indexOf(uint64_t value)
+    {
+        if (value < static_cast<uint64_t>(kSubBuckets))
+            return static_cast<int>(value);
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - kSubBucketBits;
+        int sub = static_cast<int>(value >> shift) - kSubBuckets;
+        return (shift + 1) * kSubBuckets + sub;
+    }
+
+    static uint64_t highestEquivalent(int index)
+    {
+        if (index < kSubBuckets)
+            return index;
+        int shift = index / kSubBuckets - 1;
+        uint64_t sub = index % kSubBuckets;
+        uint64_t low = (static_cast<uint64_t>(kSubBuckets) + sub) << shift;
+        return low + ((static_cast<uint64_t>(1) << shift) - 1);
+    }
+
+    std::atomic<uint64_t> buckets_[kBuckets];
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> min_;
+    std::atomic<uint64_t> max_;
+};
+
+} } // namespace Mordor::Test
+
+#endif // MD_HISTOGRAM_H_
@@ -0,0 +1,102 @@
+#include <algorithm>
+#include <functional>
+
+#include "mordor/config.h"
+
+#include "md_idle_gc.h"
+#include "md_iomanager.h"
+#include "md_worker.h"
+#include "md_trace.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+static ConfigVar<unsigned int>::ptr g_idleInterval =
+        Config::lookup("mdv8.gc.idleinterval", 100u,
+                "Interval in ms between checks for idle time to give to the GC, 0 disables");
+static ConfigVar<unsigned int>::ptr g_idleMax =
+        Config::lookup("mdv8.gc.idlemax", 50u,
+                "Longest idle notification handed to V8 in ms");
+
+IdleGcScheduler* IdleGcScheduler::Create(v8::Isolate* isolate, Scheduler* scheduler, MD_Worker* worker,
+                                         const Wake& wake, const Pending& pending)
+{
+    unsigned int interval = g_idleInterval->val();
+    MD_IOManager* iom = dynamic_cast<MD_IOManager*>(scheduler);
+    if (interval == 0 || iom == NULL)
+        return NULL;
+    return new IdleGcScheduler(isolate, iom, worker, interval * 1000ull, wake, pending);
+}
+
+IdleGcScheduler::IdleGcScheduler(v8::Isolate* isolate, MD_IOManager* iom, MD_Worker* worker,
+                                 unsigned long long interval, const Wake& wake,
+                                 const Pending& pending) :
+        isolate_(isolate),
+        iom_(iom),
+        worker_(worker),
+        wake_(wake),
+        pending_(pending),
+        guard_(GuardedTarget<IdleGcScheduler>::Create(this)),
+        idle_(false),
+        done_(false),
+        wake_pending_(false),
+        notifications_(0),
+        idle_time_(0)
+{
+    timer_ = iom_->registerTimer(interval,
+            GuardedTarget<IdleGcScheduler>::Bind(guard_, &IdleGcScheduler::onTimer), true);
+}
+
+IdleGcScheduler::~IdleGcScheduler()
+{
+    // Waits out a check in progress; later ones find nobody.
+    guard_->detach();
+    timer_->cancel();
+}
+
+void IdleGcScheduler::setIdle(bool idle)
+{
+    // Whatever ran in between left new garbage behind.
+    if (!idle)
+        done_.store(false, std::memory_order_relaxed);
+    idle_.store(idle, std::memory_order_relaxed);
+}
+
+bool IdleGcScheduler::quiet(unsigned long long* window)
+{
+    if (!idle_.load(std::memory_order_relaxed) || done_.load(std::memory_order_relaxed))
+        return false;
+    if (worker_ && worker_->queued() != 0)
+        return false;
+    *window = std::min(iom_->nextTimerDelay(), g_idleMax->val() * 1000ull);
+    return *window >= kMinIdleWindow;
+}
+
+// Timer thread.
+void IdleGcScheduler::onTimer()
+{
+    unsigned long long window;
+    if (!quiet(&window) && !(pending_ && pending_()))
+        return;
+    if (!wake_pending_.exchange(true, std::memory_order_acq_rel))
+        wake_();
+}
+
+void IdleGcScheduler::collect()
+{
+    if (!wake_pending_.exchange(false, std::memory_order_acq_rel))
+        return;
+    unsigned long long window;
+    if (!quiet(&window))
+        return;
+    MD_TRACE_SCOPE("v8", "IdleNotification");
+    int ms = static_cast<int>(window / 1000);
+    if (isolate_->IdleNotification(ms))
+        done_.store(true, std::memory_order_relaxed);
+    notifications_.fetch_add(1, std::memory_order_relaxed);
+    idle_time_.fetch_add(ms, std::memory_order_relaxed);
+}
+
+} } // namespace Mordor::Test
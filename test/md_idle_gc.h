@@ -0,0 +1,102 @@
+#ifndef MD_IDLE_GC_H_
+#define MD_IDLE_GC_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+
+#include "v8.h"
+#include "mordor/util.h"
+#include "mordor/timer.h"
+
+#include "md_guarded.h"
+
+namespace Mordor
+{
+
+class Scheduler;
+
+namespace Test
+{
+
+class MD_IOManager;
+class MD_Worker;
+
+/**
+ * IdleGcScheduler
+ *
+ * Moves GC work into the gaps between bursts. A recurring timer checks
+ * whether the shell is idle: the runner waits for input, the worker queue
+ * is empty and the next timer is far enough away. If so it wakes the
+ * runner, which calls collect() on the isolate thread with the isolate
+ * lock it holds anyway, and V8 gets an IdleNotification for the time left
+ * until the next timer (capped by --mdv8.gc.idlemax). Once V8 reports it
+ * has nothing left to do, no more notifications are sent until the shell
+ * has been busy again.
+ *
+ * The same timer wakes the runner for other idle time work, e.g. refills
+ * of the ContextPool, whenever the Pending check passed to Create() says
+ * some is waiting.
+ *
+ * Checks run every --mdv8.gc.idleinterval ms, 0 disables.
+ */
+class IdleGcScheduler : Mordor::noncopyable
+{
+public:
+    // Asks the runner to do its idle work, from the timer thread.
+    typedef std::function<void ()> Wake;
+    // Whether other idle work is waiting, from the timer thread.
+    typedef std::function<bool ()> Pending;
+
+    // Returns NULL when disabled or when |scheduler| is not an
+    // MD_IOManager. |pending| may be empty.
+    static IdleGcScheduler* Create(v8::Isolate* isolate, Scheduler* scheduler, MD_Worker* worker,
+                                   const Wake& wake, const Pending& pending);
+
+    IdleGcScheduler(v8::Isolate* isolate, MD_IOManager* iom, MD_Worker* worker,
+                    unsigned long long interval, const Wake& wake, const Pending& pending);
+    ~IdleGcScheduler();
+
+    void setIdle(bool idle);
+
+    // Runs the notification asked for, if the shell is still idle. Called
+    // by the runner on the isolate thread, under the isolate lock.
+    void collect();
+
+    uint64_t notifications() const
+    {
+        return notifications_.load(std::memory_order_relaxed);
+    }
+
+    // Idle time handed to V8, in ms.
+    uint64_t idleTime() const
+    {
+        return idle_time_.load(std::memory_order_relaxed);
+    }
+
+private:
+    // Shortest window worth a notification, in µs.
+    static const unsigned long long kMinIdleWindow = 2000;
+
+    bool quiet(unsigned long long* window);
+    void onTimer();
+
+    v8::Isolate* const isolate_;
+    MD_IOManager* const iom_;
+    MD_Worker* const worker_;
+    const Wake wake_;
+    const Pending pending_;
+    GuardedTarget<IdleGcScheduler>::ptr guard_;
+    Timer::ptr timer_;
+
+    std::atomic<bool> idle_;
+    std::atomic<bool> done_;
+    std::atomic<bool> wake_pending_;
+    std::atomic<uint64_t> notifications_;
+    std::atomic<uint64_t> idle_time_;
+};
+
+} } // namespace Mordor::Test
+
+#endif // MD_IDLE_GC_H_
@@ -0,0 +1,38 @@
+#ifndef MD_IOMANAGER_H_
+#define MD_IOMANAGER_H_
+
+#include "mordor/iomanager.h"
+
+#include "md_topology.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+/**
+ * MD_IOManager
+ *
+ * The shell's IOManager. Exposes what the embedder needs to know about the
+ * scheduler's state, such as how long it is going to stay quiet. Its
+ * threads are pinned as ThreadPlacement plans before it runs anything.
+ */
+class MD_IOManager : public IOManager
+{
+public:
+    explicit MD_IOManager(size_t threads = 1, bool useCaller = true) :
+            IOManager(threads, useCaller)
+    {
+        ThreadPlacement::the_singleton.placeScheduler(this, threads, useCaller);
+    }
+
+    // Microseconds until the next timer is due, ~0ull if there is none.
+    unsigned long long nextTimerDelay()
+    {
+        return nextTimer();
+    }
+};
+
+} } // namespace Mordor::Test
+
+#endif // MD_IOMANAGER_H_
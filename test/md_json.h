@@ -0,0 +1,47 @@
+#ifndef MD_JSON_H_
+#define MD_JSON_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <string>
+
+namespace Mordor
+{
+namespace Test
+{
+
+// Appends |data| as a quoted JSON string. Bytes >= 0x80 are copied as is,
+// so UTF-8 input stays valid UTF-8.
+inline void AppendJsonString(std::string& out, const char* data, size_t length)
+{
+    out += '"';
+    for (size_t i = 0; i < length; ++i) {
+        unsigned char c = data[i];
+        switch (c) {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (c < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            } else {
+                out += static_cast<char>(c);
+            }
+        }
+    }
+    out += '"';
+}
+
+inline void AppendJsonString(std::string& out, const std::string& value)
+{
+    AppendJsonString(out, value.data(), value.size());
+}
+
+} } // namespace Mordor::Test
+
+#endif // MD_JSON_H_
@@ -0,0 +1,441 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <functional>
+
+#include "mordor/assert.h"
+#include "mordor/config.h"
+#include "mordor/timer.h"
+
+#include "md_memory.h"
+#include "md_array_buffer_allocator.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+static ConfigVar<unsigned int>::ptr g_sampleInterval =
+        Config::lookup("mdv8.memory.sampleinterval", 0u,
+                "Interval in ms between memory samples, 0 disables sampling");
+static ConfigVar<unsigned int>::ptr g_historySize =
+        Config::lookup("mdv8.memory.historysize", 600u,
+                "Number of memory samples kept in the ring buffer");
+
+/*****************************************************************************
+ * GcStats
+ */
+GcStats::GcStats(v8::Isolate* isolate) :
+        isolate_(isolate),
+        total_pause_(0),
+        heap_used_(0),
+        heap_total_(0),
+        heap_limit_(0)
+{
+    for (int i = 0; i < kKindCount; ++i)
+        start_[i] = 0;
+    MORDOR_ASSERT(isolate_->GetData(kSlot) == NULL);
+    isolate_->SetData(kSlot, this);
+    isolate_->AddGCPrologueCallback(Prologue);
+    isolate_->AddGCEpilogueCallback(Epilogue);
+}
+
+GcStats::~GcStats()
+{
+    isolate_->RemoveGCPrologueCallback(Prologue);
+    isolate_->RemoveGCEpilogueCallback(Epilogue);
+    isolate_->SetData(kSlot, NULL);
+}
+
+GcStats* GcStats::Get(v8::Isolate* isolate)
+{
+    return static_cast<GcStats*>(isolate->GetData(kSlot));
+}
+
+const char* GcStats::kindName(Kind kind)
+{
+    switch (kind) {
+    case kScavenge:
+        return "scavenge";
+    case kMarkCompact:
+        return "markCompact";
+    default:
+        return "unknown";
+    }
+}
+
+GcStats::Kind GcStats::kindOf(v8::GCType type)
+{
+    return type == v8::kGCTypeScavenge ? kScavenge : kMarkCompact;
+}
+
+void GcStats::Prologue(v8::Isolate* isolate, v8::GCType type, v8::GCCallbackFlags flags)
+{
+    GcStats* self = Get(isolate);
+    if (self == NULL)
+        return;
+    self->start_[kindOf(type)] = TimerManager::now();
+}
+
+void GcStats::Epilogue(v8::Isolate* isolate, v8::GCType type, v8::GCCallbackFlags flags)
+{
+    GcStats* self = Get(isolate);
+    if (self == NULL)
+        return;
+    Kind kind = kindOf(type);
+    unsigned long long pause = TimerManager::now() - self->start_[kind];
+    self->pauses_[kind].record(pause);
+    self->total_pause_.fetch_add(pause, std::memory_order_relaxed);
+
+    v8::HeapStatistics heap_stats;
+    isolate->GetHeapStatistics(&heap_stats);
+    self->heap_used_.store(heap_stats.used_heap_size(), std::memory_order_relaxed);
+    self->heap_total_.store(heap_stats.total_heap_size(), std::memory_order_relaxed);
+    self->heap_limit_.store(heap_stats.heap_size_limit(), std::memory_order_relaxed);
+}
+
+/*****************************************************************************
+ * HeapGuard
+ */
+static ConfigVar<unsigned int>::ptr g_semiSpace =
+        Config::lookup("mdv8.heap.semispace", 0u,
+                "Max young generation semi-space size in MB, 0 for V8's default");
+static ConfigVar<unsigned int>::ptr g_oldSpace =
+        Config::lookup("mdv8.heap.oldspace", 0u,
+                "Max old generation size in MB, 0 for V8's default");
+static ConfigVar<unsigned int>::ptr g_executable =
+        Config::lookup("mdv8.heap.executable", 0u,
+                "Max size of executable (code) memory in MB, 0 for V8's default");
+static ConfigVar<unsigned int>::ptr g_codeRange =
+        Config::lookup("mdv8.heap.coderange", 0u,
+                "Code range size in MB, 0 for V8's default");
+static ConfigVar<unsigned int>::ptr g_heapPressure =
+        Config::lookup("mdv8.heap.pressure", 85u,
+                "Heap use in percent of the limit that triggers a low memory notification");
+static ConfigVar<unsigned int>::ptr g_heapCritical =
+        Config::lookup("mdv8.heap.critical", 95u,
+                "Heap use in percent of the limit that terminates the running script, 0 never");
+static ConfigVar<unsigned int>::ptr g_relieveInterval =
+        Config::lookup("mdv8.heap.relieveinterval", 1000u,
+                "Shortest time in ms between low memory notifications while the heap stays high");
+
+void HeapGuard::ConfigureConstraints(v8::ResourceConstraints* constraints)
+{
+    if (g_semiSpace->val())
+        constraints->set_max_semi_space_size(g_semiSpace->val());
+    if (g_oldSpace->val())
+        constraints->set_max_old_space_size(g_oldSpace->val());
+    if (g_executable->val())
+        constraints->set_max_executable_size(g_executable->val());
+    if (g_codeRange->val())
+        constraints->set_code_range_size(g_codeRange->val());
+}
+
+const double HeapGuard::kHysteresis = 0.05;
+
+HeapGuard::HeapGuard(v8::Isolate* isolate) :
+        isolate_(isolate),
+        pressure_(g_heapPressure->val() / 100.0),
+        critical_(g_heapCritical->val() / 100.0),
+        min_backoff_(std::max(g_relieveInterval->val(), 1u) * 1000ull),
+        interrupt_pending_(false),
+        relieving_(false),
+        terminated_(false),
+        last_relief_(0),
+        backoff_(min_backoff_),
+        interrupt_target_(GuardedTarget<HeapGuard>::Create(this)),
+        under_pressure_(false),
+        throttled_(0),
+        pressure_events_(0),
+        notifications_(0),
+        terminations_(0)
+{
+    MORDOR_ASSERT(isolate_->GetData(kSlot) == NULL);
+    isolate_->SetData(kSlot, this);
+    isolate_->AddGCEpilogueCallback(Epilogue, v8::kGCTypeMarkSweepCompact);
+}
+
+HeapGuard::~HeapGuard()
+{
+    isolate_->RemoveGCEpilogueCallback(Epilogue);
+    isolate_->SetData(kSlot, NULL);
+    // An interrupt V8 has not delivered yet finds nobody to call.
+    interrupt_target_->detach();
+}
+
+HeapGuard* HeapGuard::Get(v8::Isolate* isolate)
+{
+    return static_cast<HeapGuard*>(isolate->GetData(kSlot));
+}
+
+void HeapGuard::setPressureHandler(const PressureHandler& handler)
+{
+    pressure_handler_ = handler;
+}
+
+double HeapGuard::heapRatio() const
+{
+    v8::HeapStatistics heap_stats;
+    isolate_->GetHeapStatistics(&heap_stats);
+    if (heap_stats.heap_size_limit() == 0)
+        return 0;
+    return static_cast<double>(heap_stats.used_heap_size()) / heap_stats.heap_size_limit();
+}
+
+void HeapGuard::Epilogue(v8::Isolate* isolate, v8::GCType type, v8::GCCallbackFlags flags)
+{
+    HeapGuard* self = Get(isolate);
+    if (self == NULL || type != v8::kGCTypeMarkSweepCompact)
+        return;
+    self->onMarkCompact();
+}
+
+void HeapGuard::onMarkCompact()
+{
+    if (relieving_ || pressure_ <= 0)
+        return;
+    double ratio = heapRatio();
+    if (ratio < pressure_ - kHysteresis) {
+        setPressure(false);
+        backoff_ = min_backoff_;
+        return;
+    }
+    if (ratio < pressure_)
+        return;
+    setPressure(true);
+    // Past the critical mark there is no time to wait for the backoff.
+    bool critical = critical_ > 0 && ratio >= critical_;
+    if (!critical && TimerManager::now() - last_relief_ < backoff_) {
+        throttled_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    requestRelief();
+}
+
+void HeapGuard::setPressure(bool pressure)
+{
+    if (under_pressure_.exchange(pressure, std::memory_order_relaxed) == pressure)
+        return;
+    if (pressure)
+        pressure_events_.fetch_add(1, std::memory_order_relaxed);
+    if (pressure_handler_)
+        pressure_handler_(pressure);
+}
+
+void HeapGuard::requestRelief()
+{
+    if (interrupt_pending_)
+        return;
+    // No GC from inside a GC callback; do it once JS is interruptible.
+    interrupt_pending_ = true;
+    GuardedTarget<HeapGuard>::RequestInterrupt(interrupt_target_, isolate_, &HeapGuard::relieve);
+}
+
+void HeapGuard::relieve()
+{
+    interrupt_pending_ = false;
+    relieving_ = true;
+    isolate_->LowMemoryNotification();
+    relieving_ = false;
+    notifications_.fetch_add(1, std::memory_order_relaxed);
+    last_relief_ = TimerManager::now();
+
+    double ratio = heapRatio();
+    if (ratio < pressure_) {
+        backoff_ = min_backoff_;
+        if (ratio < pressure_ - kHysteresis)
+            setPressure(false);
+    } else {
+        // Collecting did not help, the live set is this large.
+        backoff_ = std::min(backoff_ * 2, kMaxBackoff);
+    }
+    if (critical_ > 0 && ratio >= critical_)
+        terminate(ratio);
+}
+
+void HeapGuard::terminate(double ratio)
+{
+    if (terminated_)
+        return;
+    // Whatever is running holds on to the memory; stop it before V8 runs
+    // out and aborts the process.
+    fprintf(stderr, "heap at %.0f%% of its limit after a full GC, terminating script\n", ratio * 100);
+    terminated_ = true;
+    terminations_.fetch_add(1, std::memory_order_relaxed);
+    v8::V8::TerminateExecution(isolate_);
+}
+
+bool HeapGuard::recover()
+{
+    if (!terminated_)
+        return false;
+    terminated_ = false;
+    v8::V8::CancelTerminateExecution(isolate_);
+    // The terminated script's garbage is collectable now.
+    relieving_ = true;
+    isolate_->LowMemoryNotification();
+    relieving_ = false;
+    return true;
+}
+
+void HeapGuard::throwOutOfMemory() const
+{
+    isolate_->ThrowException(v8::Exception::RangeError(
+            v8::String::NewFromUtf8(isolate_, "Script terminated: heap limit reached")));
+}
+
+/*****************************************************************************
+ * MemorySampler
+ */
+MemorySampler* MemorySampler::Create(GcStats* gc_stats, TimerManager* timers)
+{
+    unsigned int interval = g_sampleInterval->val();
+    if (interval == 0 || timers == NULL)
+        return NULL;
+    return new MemorySampler(gc_stats, timers, interval * 1000ull,
+                             std::max(g_historySize->val(), 1u));
+}
+
+MemorySampler::MemorySampler(GcStats* gc_stats, TimerManager* timers,
+                             unsigned long long interval, size_t capacity) :
+        gc_stats_(gc_stats),
+        guard_(GuardedTarget<MemorySampler>::Create(this)),
+        ring_(capacity),
+        next_(0),
+        size_(0)
+{
+    timer_ = timers->registerTimer(interval,
+            GuardedTarget<MemorySampler>::Bind(guard_, &MemorySampler::onTimer), true);
+}
+
+MemorySampler::~MemorySampler()
+{
+    // Waits out a sample in progress, GcStats goes away right after us.
+    guard_->detach();
+    timer_->cancel();
+}
+
+MemorySample MemorySampler::sample() const
+{
+    MemorySample sample;
+    sample.time = TimerManager::now();
+    sample.rss = MemoryInfo::residentSetSize();
+    sample.heap_used = gc_stats_->heapUsed();
+    sample.heap_total = gc_stats_->heapTotal();
+    sample.array_buffers = ArrayBufferAllocator::the_singleton.stats().live_bytes;
+    sample.scavenges = gc_stats_->count(GcStats::kScavenge);
+    sample.mark_compacts = gc_stats_->count(GcStats::kMarkCompact);
+    sample.gc_pause = gc_stats_->totalPause();
+    return sample;
+}
+
+void MemorySampler::onTimer()
+{
+    MemorySample s = sample();
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    ring_[next_] = s;
+    next_ = (next_ + 1) % ring_.size();
+    if (size_ < ring_.size())
+        ++size_;
+}
+
+std::vector<MemorySample> MemorySampler::history() const
+{
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    std::vector<MemorySample> result;
+    result.reserve(size_);
+    size_t first = (next_ + ring_.size() - size_) % ring_.size();
+    for (size_t i = 0; i < size_; ++i)
+        result.push_back(ring_[(first + i) % ring_.size()]);
+    return result;
+}
+
+/*****************************************************************************
+ * ExternalMemory
+ */
+ExternalMemory ExternalMemory::the_singleton;
+
+ExternalMemory::ExternalMemory() :
+        isolate_(NULL),
+        live_(0),
+        peak_(0),
+        pending_(0),
+        reported_(0),
+        interrupt_pending_(false)
+{
+}
+
+void ExternalMemory::attach(v8::Isolate* isolate)
+{
+    isolate_.store(isolate, std::memory_order_release);
+    // An interrupt requested from the previous isolate is ignored, see
+    // OnInterrupt(); don't let it block the next request.
+    interrupt_pending_.store(false, std::memory_order_release);
+}
+
+void ExternalMemory::add(int64_t bytes)
+{
+    if (bytes == 0)
+        return;
+    int64_t live = live_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    int64_t peak = peak_.load(std::memory_order_relaxed);
+    while (live > peak && !peak_.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+    int64_t pending = pending_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    if (pending < kFlushThreshold && pending > -kFlushThreshold)
+        return;
+    v8::Isolate* isolate = isolate_.load(std::memory_order_acquire);
+    if (isolate && !interrupt_pending_.exchange(true, std::memory_order_acq_rel))
+        isolate->RequestInterrupt(OnInterrupt, this);
+}
+
+void ExternalMemory::OnInterrupt(v8::Isolate* isolate, void* data)
+{
+    ExternalMemory* self = static_cast<ExternalMemory*>(data);
+    if (self->isolate_.load(std::memory_order_acquire) != isolate)
+        return;
+    self->interrupt_pending_.store(false, std::memory_order_release);
+    self->flush();
+}
+
+void ExternalMemory::flush()
+{
+    v8::Isolate* isolate = isolate_.load(std::memory_order_acquire);
+    if (isolate == NULL)
+        return;
+    int64_t delta = pending_.exchange(0, std::memory_order_relaxed);
+    if (delta == 0)
+        return;
+    reported_.fetch_add(delta, std::memory_order_relaxed);
+    isolate->AdjustAmountOfExternalAllocatedMemory(delta);
+}
+
+/*****************************************************************************
+ * MemoryInfo
+ */
+uint64_t MemoryInfo::residentSetSize()
+{
+#ifdef __linux__
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL) {
+        unsigned long size = 0, resident = 0;
+        int n = fscanf(statm, "%lu %lu", &size, &resident);
+        fclose(statm);
+        if (n == 2)
+            return static_cast<uint64_t>(resident) * sysconf(_SC_PAGESIZE);
+    }
+#endif
+    // Fall back to the peak, which is all getrusage() offers.
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+} } // namespace Mordor::Test
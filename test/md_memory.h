@@ -0,0 +1,348 @@
+#ifndef MD_MEMORY_H_
+#define MD_MEMORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "v8.h"
+#include "mordor/util.h"
+#include "mordor/timer.h"
+
+#include "md_guarded.h"
+#include "md_histogram.h"
+
+// Isolate::GetHeapSpaceStatistics() appeared in V8 4.3.
+#if defined(V8_MAJOR_VERSION) && \
+    (V8_MAJOR_VERSION > 4 || (V8_MAJOR_VERSION == 4 && V8_MINOR_VERSION >= 3))
+#define MD_V8_HAS_HEAP_SPACE_STATISTICS 1
+#endif
+
+#define MD_V8_HEAP_GUARD_SLOT               1
+#define MD_V8_GC_STATS_SLOT                 2
+
+namespace Mordor
+{
+namespace Test
+{
+
+/**
+ * Per-isolate GC telemetry fed by GC prologue/epilogue callbacks.
+ *
+ * Pause times are recorded in microseconds. The heap figures of the last
+ * epilogue are kept so threads that do not own the isolate can still read
+ * an up to date heap size.
+ */
+class GcStats : Mordor::noncopyable
+{
+public:
+    enum Kind {
+        kScavenge = 0,
+        kMarkCompact,
+        kKindCount
+    };
+
+    explicit GcStats(v8::Isolate* isolate);
+    ~GcStats();
+
+    static GcStats* Get(v8::Isolate* isolate);
+    static const char* kindName(Kind kind);
+
+    uint64_t count(Kind kind) const
+    {
+        return pauses_[kind].count();
+    }
+
+    const Histogram& pauses(Kind kind) const
+    {
+        return pauses_[kind];
+    }
+
+    // Total time spent in GC pauses, in microseconds.
+    uint64_t totalPause() const
+    {
+        return total_pause_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t heapUsed() const
+    {
+        return heap_used_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t heapTotal() const
+    {
+        return heap_total_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t heapLimit() const
+    {
+        return heap_limit_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static const int kSlot = MD_V8_GC_STATS_SLOT;
+
+    static void Prologue(v8::Isolate* isolate, v8::GCType type, v8::GCCallbackFlags flags);
+    static void Epilogue(v8::Isolate* isolate, v8::GCType type, v8::GCCallbackFlags flags);
+    static Kind kindOf(v8::GCType type);
+
+    v8::Isolate* const isolate_;
+    unsigned long long start_[kKindCount];
+    Histogram pauses_[kKindCount];
+    std::atomic<uint64_t> total_pause_;
+    std::atomic<uint64_t> heap_used_;
+    std::atomic<uint64_t> heap_total_;
+    std::atomic<uint64_t> heap_limit_;
+};
+
+/**
+ * HeapGuard
+ *
+ * Keeps one isolate from taking the whole process down when it approaches
+ * its heap limit. Only mark-compacts are looked at, a scavenge says little
+ * about the old generation. After one leaves the heap above
+ * --mdv8.heap.pressure percent of the limit:
+ *
+ *  - the isolate is under pressure and the pressure handler is told, so
+ *    the embedder can shed work (MD_Worker rejects bulk tasks). Pressure
+ *    ends once a mark-compact leaves the heap kHysteresis below the mark.
+ *  - the isolate is interrupted and asked for a LowMemoryNotification (a
+ *    full, compacting GC). While that does not bring the heap back under
+ *    the mark, further notifications back off from
+ *    --mdv8.heap.relieveinterval ms up to kMaxBackoff, so a legitimately
+ *    large live set does not turn into a GC storm.
+ *  - if the heap is still above --mdv8.heap.critical percent after the
+ *    notification, or any mark-compact leaves it there, the running
+ *    script is terminated; the runner calls recover() to turn that into an
+ *    error and carry on with the next script.
+ *
+ * ConfigureConstraints() sizes the heap from --mdv8.heap.* before the
+ * isolate is created.
+ */
+class HeapGuard : Mordor::noncopyable
+{
+public:
+    // Fraction of the heap limit below the pressure mark that ends pressure.
+    static const double kHysteresis;
+    // Longest pause between notifications while the heap stays high, in µs.
+    static const unsigned long long kMaxBackoff = 60000000;
+
+    typedef std::function<void (bool)> PressureHandler;
+
+    static void ConfigureConstraints(v8::ResourceConstraints* constraints);
+
+    explicit HeapGuard(v8::Isolate* isolate);
+    ~HeapGuard();
+
+    static HeapGuard* Get(v8::Isolate* isolate);
+
+    // Returns true if this guard terminated the script, after cancelling
+    // the termination and collecting what it left behind.
+    bool recover();
+    void throwOutOfMemory() const;
+
+    // Called with true when pressure starts and false when it ends, on the
+    // isolate thread. An empty handler removes it.
+    void setPressureHandler(const PressureHandler& handler);
+
+    bool underPressure() const
+    {
+        return under_pressure_.load(std::memory_order_relaxed);
+    }
+
+    // GCs that ended above the pressure threshold.
+    uint64_t pressureEvents() const
+    {
+        return pressure_events_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t lowMemoryNotifications() const
+    {
+        return notifications_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t terminations() const
+    {
+        return terminations_.load(std::memory_order_relaxed);
+    }
+
+    // Notifications skipped because of the backoff.
+    uint64_t throttled() const
+    {
+        return throttled_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static const int kSlot = MD_V8_HEAP_GUARD_SLOT;
+
+    static void Epilogue(v8::Isolate* isolate, v8::GCType type, v8::GCCallbackFlags flags);
+    void onMarkCompact();
+    void requestRelief();
+    void setPressure(bool pressure);
+    void relieve();
+    void terminate(double ratio);
+    double heapRatio() const;
+
+    v8::Isolate* const isolate_;
+    const double pressure_;
+    const double critical_;
+    const unsigned long long min_backoff_;
+    bool interrupt_pending_;
+    bool relieving_;
+    bool terminated_;
+    unsigned long long last_relief_;
+    unsigned long long backoff_;
+    PressureHandler pressure_handler_;
+    // What a requested interrupt points at; outlives the guard.
+    GuardedTarget<HeapGuard>::ptr interrupt_target_;
+    std::atomic<bool> under_pressure_;
+    std::atomic<uint64_t> throttled_;
+    std::atomic<uint64_t> pressure_events_;
+    std::atomic<uint64_t> notifications_;
+    std::atomic<uint64_t> terminations_;
+};
+
+struct MemorySample
+{
+    unsigned long long time;     // TimerManager::now()
+    uint64_t rss;
+    uint64_t heap_used;
+    uint64_t heap_total;
+    uint64_t array_buffers;
+    uint64_t scavenges;
+    uint64_t mark_compacts;
+    uint64_t gc_pause;
+};
+
+/**
+ * Periodically records a MemorySample into a fixed size ring buffer so GC
+ * and RSS can be correlated with latency after the fact. Sampling only
+ * reads counters and never takes the isolate lock.
+ *
+ * Enabled with --mdv8.memory.sampleinterval=<ms>, the number of retained
+ * samples is --mdv8.memory.historysize.
+ */
+class MemorySampler : Mordor::noncopyable
+{
+public:
+    // Returns NULL when sampling is disabled.
+    static MemorySampler* Create(GcStats* gc_stats, TimerManager* timers);
+
+    MemorySampler(GcStats* gc_stats, TimerManager* timers,
+                  unsigned long long interval, size_t capacity);
+    ~MemorySampler();
+
+    MemorySample sample() const;
+
+    // Samples in chronological order.
+    std::vector<MemorySample> history() const;
+
+private:
+    // Timer thread.
+    void onTimer();
+
+    GcStats* gc_stats_;
+    // What the timer points at; outlives the sampler.
+    GuardedTarget<MemorySampler>::ptr guard_;
+    Timer::ptr timer_;
+    mutable std::mutex lock_;
+    std::vector<MemorySample> ring_;
+    size_t next_;
+    size_t size_;
+};
+
+/**
+ * ExternalMemory
+ *
+ * Process wide account of native memory held on behalf of JS (file
+ * buffers, profiles waiting to be written, ...) so V8's GC heuristics see
+ * it. Any thread may add or release bytes; the change is collected in an
+ * atomic and reported with AdjustAmountOfExternalAllocatedMemory on the
+ * isolate thread, at script boundaries or, once it exceeds
+ * kFlushThreshold, through an interrupt.
+ *
+ * ArrayBuffer backing stores are not tracked here: V8 already adjusts its
+ * external memory for them when the buffer is created and collected.
+ */
+class ExternalMemory : Mordor::noncopyable
+{
+public:
+    static const int64_t kFlushThreshold = 1 << 20;
+    static ExternalMemory the_singleton;
+
+    // Holds |bytes| for the lifetime of the scope.
+    class Scope : Mordor::noncopyable
+    {
+    public:
+        explicit Scope(int64_t bytes) : bytes_(bytes)
+        {
+            the_singleton.add(bytes_);
+        }
+
+        ~Scope()
+        {
+            the_singleton.add(-bytes_);
+        }
+
+        void resize(int64_t bytes)
+        {
+            the_singleton.add(bytes - bytes_);
+            bytes_ = bytes;
+        }
+
+    private:
+        int64_t bytes_;
+    };
+
+    // The isolate to report to; NULL detaches.
+    void attach(v8::Isolate* isolate);
+
+    void add(int64_t bytes);
+
+    // Isolate thread: reports what changed since the last flush.
+    void flush();
+
+    int64_t live() const
+    {
+        return live_.load(std::memory_order_relaxed);
+    }
+
+    int64_t peak() const
+    {
+        return peak_.load(std::memory_order_relaxed);
+    }
+
+    // What V8 has been told so far.
+    int64_t reported() const
+    {
+        return reported_.load(std::memory_order_relaxed);
+    }
+
+private:
+    ExternalMemory();
+
+    static void OnInterrupt(v8::Isolate* isolate, void* data);
+
+    std::atomic<v8::Isolate*> isolate_;
+    std::atomic<int64_t> live_;
+    std::atomic<int64_t> peak_;
+    std::atomic<int64_t> pending_;
+    std::atomic<int64_t> reported_;
+    std::atomic<bool> interrupt_pending_;
+};
+
+class MemoryInfo
+{
+public:
+    // Resident set size of the process in bytes, 0 if unknown.
+    static uint64_t residentSetSize();
+};
+
+} } // namespace Mordor::Test
+
+#endif // MD_MEMORY_H_
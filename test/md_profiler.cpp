@@ -0,0 +1,402 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <functional>
+
+#include "mordor/config.h"
+#include "mordor/scheduler.h"
+#include "mordor/streams/file.h"
+
+#include "md_profiler.h"
+#include "md_json.h"
+#include "md_memory.h"
+#include "md_trace.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+static ConfigVar<std::string>::ptr g_profileDir =
+        Config::lookup("mdv8.profiler.dir", std::string("."),
+                "Directory for profiles written without an explicit path");
+static ConfigVar<int>::ptr g_cpuInterval =
+        Config::lookup("mdv8.profiler.interval", 1000,
+                "CPU profiler sampling interval in us");
+static ConfigVar<unsigned int>::ptr g_allocInterval =
+        Config::lookup("mdv8.profiler.allocinterval", 10u,
+                "Allocation sampler interval in ms");
+
+static const char kProfileTitle[] = "mdv8";
+
+/*****************************************************************************
+ * ProfileFile
+ */
+// Accounted in ExternalMemory from WriteAsync() until written.
+static void writeFile(const std::string& path, std::shared_ptr<std::string> data)
+{
+    MD_TRACE_SCOPE("profiler", "writeFile");
+    try {
+        FileStream stream(path, FileStream::WRITE, FileStream::OVERWRITE_OR_CREATE);
+        size_t offset = 0;
+        while (offset < data->size())
+            offset += stream.write(data->data() + offset, data->size() - offset);
+        stream.close();
+    } catch (...) {
+        fprintf(stderr, "failed to write %s\n", path.c_str());
+    }
+    ExternalMemory::the_singleton.add(-static_cast<int64_t>(data->size()));
+}
+
+void ProfileFile::WriteAsync(Scheduler* scheduler, const std::string& path,
+                             std::shared_ptr<std::string> data)
+{
+    ExternalMemory::the_singleton.add(data->size());
+    if (scheduler == NULL) {
+        writeFile(path, data);
+        return;
+    }
+    scheduler->schedule(std::bind(&writeFile, path, data));
+}
+
+std::string ProfileFile::DefaultBaseName(const char* prefix)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    char name[64];
+    snprintf(name, sizeof(name), "/%s.%d.%llu", prefix, static_cast<int>(getpid()),
+             static_cast<unsigned long long>(tv.tv_sec) * 1000 + tv.tv_usec / 1000);
+    return g_profileDir->val() + name;
+}
+
+/*****************************************************************************
+ * Serialization
+ */
+static void appendValue(std::string& out, v8::Handle<v8::String> value)
+{
+    v8::String::Utf8Value utf8(value);
+    if (*utf8)
+        AppendJsonString(out, *utf8, utf8.length());
+    else
+        out += "\"\"";
+}
+
+static void appendNode(std::string& out, const v8::CpuProfileNode* node)
+{
+    char numbers[192];
+    out += "{\"functionName\":";
+    appendValue(out, node->GetFunctionName());
+    out += ",\"url\":";
+    appendValue(out, node->GetScriptResourceName());
+    snprintf(numbers, sizeof(numbers),
+             ",\"scriptId\":\"%d\",\"lineNumber\":%d,\"columnNumber\":%d,"
+             "\"hitCount\":%u,\"callUID\":%u,\"id\":%u,\"deoptReason\":",
+             node->GetScriptId(), node->GetLineNumber(), node->GetColumnNumber(),
+             node->GetHitCount(), node->GetCallUid(), node->GetNodeId());
+    out += numbers;
+    const char* reason = node->GetBailoutReason();
+    AppendJsonString(out, reason, reason ? strlen(reason) : 0);
+    out += ",\"children\":[";
+    for (int i = 0; i < node->GetChildrenCount(); ++i) {
+        if (i)
+            out += ',';
+        appendNode(out, node->GetChild(i));
+    }
+    out += "]}";
+}
+
+// Old style (pre-CDP) .cpuprofile, times in seconds with µs timestamps.
+static void serializeCpuProfile(const v8::CpuProfile* profile, std::string& out)
+{
+    char numbers[64];
+    out += "{\"head\":";
+    appendNode(out, profile->GetTopDownRoot());
+    snprintf(numbers, sizeof(numbers), ",\"startTime\":%.6f,\"endTime\":%.6f",
+             profile->GetStartTime() / 1e6, profile->GetEndTime() / 1e6);
+    out += numbers;
+    out += ",\"samples\":[";
+    for (int i = 0; i < profile->GetSamplesCount(); ++i) {
+        snprintf(numbers, sizeof(numbers), i ? ",%u" : "%u", profile->GetSample(i)->GetNodeId());
+        out += numbers;
+    }
+    out += "],\"timestamps\":[";
+    for (int i = 0; i < profile->GetSamplesCount(); ++i) {
+        snprintf(numbers, sizeof(numbers), i ? ",%lld" : "%lld",
+                 static_cast<long long>(profile->GetSampleTimestamp(i)));
+        out += numbers;
+    }
+    out += "]}\n";
+}
+
+// One "frame;frame;frame hits" line per node with self samples.
+static void appendCollapsed(std::string& out, std::string& stack, const v8::CpuProfileNode* node)
+{
+    size_t mark = stack.size();
+    v8::String::Utf8Value name(node->GetFunctionName());
+    v8::String::Utf8Value url(node->GetScriptResourceName());
+    if (!stack.empty())
+        stack += ';';
+    stack += (*name && name.length()) ? *name : "(anonymous)";
+    if (*url && url.length()) {
+        char line[32];
+        snprintf(line, sizeof(line), ":%d", node->GetLineNumber());
+        stack += ' ';
+        stack += *url;
+        stack += line;
+    }
+    if (node->GetHitCount()) {
+        char hits[32];
+        snprintf(hits, sizeof(hits), " %u\n", node->GetHitCount());
+        out += stack;
+        out += hits;
+    }
+    for (int i = 0; i < node->GetChildrenCount(); ++i)
+        appendCollapsed(out, stack, node->GetChild(i));
+    stack.resize(mark);
+}
+
+static void serializeCollapsed(const v8::CpuProfile* profile, std::string& out)
+{
+    // The root itself never has hits, start with its children.
+    const v8::CpuProfileNode* root = profile->GetTopDownRoot();
+    std::string stack;
+    for (int i = 0; i < root->GetChildrenCount(); ++i)
+        appendCollapsed(out, stack, root->GetChild(i));
+}
+
+/*****************************************************************************
+ * CpuProfilerSession
+ */
+CpuProfilerSession::CpuProfilerSession(v8::Isolate* isolate, Scheduler* scheduler) :
+        isolate_(isolate),
+        scheduler_(scheduler),
+        interval_(g_cpuInterval->val()),
+        profiling_(false),
+        toggle_pending_(false),
+        guard_(GuardedTarget<CpuProfilerSession>::Create(this))
+{
+}
+
+CpuProfilerSession::~CpuProfilerSession()
+{
+    // An interrupt V8 has not delivered yet finds nobody to call.
+    guard_->detach();
+    if (!profiling_)
+        return;
+    v8::HandleScope handle_scope(isolate_);
+    v8::Local<v8::String> title = v8::String::NewFromUtf8(isolate_, kProfileTitle);
+    v8::CpuProfile* profile = isolate_->GetCpuProfiler()->StopProfiling(title);
+    if (profile)
+        profile->Delete();
+}
+
+void CpuProfilerSession::setSamplingInterval(int interval)
+{
+    if (interval > 0)
+        interval_ = interval;
+}
+
+bool CpuProfilerSession::start()
+{
+    if (profiling_)
+        return false;
+    v8::HandleScope handle_scope(isolate_);
+    v8::CpuProfiler* profiler = isolate_->GetCpuProfiler();
+    profiler->SetSamplingInterval(interval_);
+    profiler->StartProfiling(v8::String::NewFromUtf8(isolate_, kProfileTitle), true);
+    profiling_ = true;
+    return true;
+}
+
+bool CpuProfilerSession::stop(const std::string& base)
+{
+    if (!profiling_)
+        return false;
+    profiling_ = false;
+    MD_TRACE_SCOPE("profiler", "CpuProfilerSession::stop");
+    v8::HandleScope handle_scope(isolate_);
+    v8::CpuProfile* profile = isolate_->GetCpuProfiler()->StopProfiling(
+            v8::String::NewFromUtf8(isolate_, kProfileTitle));
+    if (profile == NULL)
+        return false;
+
+    std::shared_ptr<std::string> cpuprofile(new std::string());
+    std::shared_ptr<std::string> collapsed(new std::string());
+    serializeCpuProfile(profile, *cpuprofile);
+    serializeCollapsed(profile, *collapsed);
+    profile->Delete();
+
+    ProfileFile::WriteAsync(scheduler_, base + ".cpuprofile", cpuprofile);
+    ProfileFile::WriteAsync(scheduler_, base + ".folded", collapsed);
+    return true;
+}
+
+void CpuProfilerSession::toggle()
+{
+    if (profiling_) {
+        std::string base = ProfileFile::DefaultBaseName("CPU");
+        if (stop(base))
+            fprintf(stderr, "cpu profile written to %s.cpuprofile\n", base.c_str());
+    } else {
+        start();
+        fprintf(stderr, "cpu profiler started\n");
+    }
+}
+
+void CpuProfilerSession::requestToggle()
+{
+    toggle_pending_.store(true, std::memory_order_release);
+    GuardedTarget<CpuProfilerSession>::RequestInterrupt(guard_, isolate_,
+                                                        &CpuProfilerSession::checkPending);
+}
+
+void CpuProfilerSession::checkPending()
+{
+    if (toggle_pending_.exchange(false, std::memory_order_acq_rel))
+        toggle();
+}
+
+/*****************************************************************************
+ * AllocationSampler
+ */
+AllocationSampler* AllocationSampler::s_active = NULL;
+
+AllocationSampler::AllocationSampler(v8::Isolate* isolate, TimerManager* timers,
+                                     Scheduler* scheduler) :
+        isolate_(isolate),
+        timers_(timers),
+        scheduler_(scheduler),
+        sampling_(false),
+        last_used_(0),
+        hidden_by_gc_(0)
+{
+}
+
+AllocationSampler::~AllocationSampler()
+{
+    if (sampling_)
+        stop(std::string());
+}
+
+uint64_t AllocationSampler::heapUsed()
+{
+    v8::HeapStatistics heap_stats;
+    isolate_->GetHeapStatistics(&heap_stats);
+    return heap_stats.used_heap_size();
+}
+
+bool AllocationSampler::start(unsigned int interval)
+{
+    if (sampling_ || s_active != NULL || timers_ == NULL)
+        return false;
+    if (interval == 0)
+        interval = std::max(g_allocInterval->val(), 1u);
+    sites_.clear();
+    hidden_by_gc_ = 0;
+    last_used_ = heapUsed();
+    s_active = this;
+    isolate_->AddGCPrologueCallback(OnGcPrologue);
+    isolate_->AddGCEpilogueCallback(OnGcEpilogue);
+    guard_ = GuardedTarget<AllocationSampler>::Create(this);
+    timer_ = timers_->registerTimer(interval * 1000ull,
+            GuardedTarget<AllocationSampler>::Bind(guard_, &AllocationSampler::onTimer), true);
+    sampling_ = true;
+    return true;
+}
+
+bool AllocationSampler::stop(const std::string& path)
+{
+    if (!sampling_)
+        return false;
+    sampling_ = false;
+    // Waits out a tick in progress; later ticks and interrupts still
+    // pending find nobody.
+    guard_->detach();
+    guard_.reset();
+    timer_->cancel();
+    timer_.reset();
+    isolate_->RemoveGCPrologueCallback(OnGcPrologue);
+    isolate_->RemoveGCEpilogueCallback(OnGcEpilogue);
+    s_active = NULL;
+
+    if (!path.empty()) {
+        std::shared_ptr<std::string> collapsed(new std::string());
+        char weight[32];
+        for (std::map<std::string, Site>::const_iterator it = sites_.begin();
+             it != sites_.end(); ++it) {
+            snprintf(weight, sizeof(weight), " %llu\n",
+                     static_cast<unsigned long long>(it->second.bytes));
+            *collapsed += it->first;
+            *collapsed += weight;
+        }
+        ProfileFile::WriteAsync(scheduler_, path, collapsed);
+    }
+    sites_.clear();
+    return true;
+}
+
+// Timer thread: only asks the isolate thread to take the sample.
+void AllocationSampler::onTimer()
+{
+    GuardedTarget<AllocationSampler>::RequestInterrupt(guard_, isolate_, &AllocationSampler::sample);
+}
+
+void AllocationSampler::OnGcPrologue(v8::Isolate* isolate, v8::GCType type, v8::GCCallbackFlags flags)
+{
+    AllocationSampler* self = s_active;
+    if (self == NULL)
+        return;
+    uint64_t used = self->heapUsed();
+    if (used > self->last_used_)
+        self->hidden_by_gc_ += used - self->last_used_;
+}
+
+void AllocationSampler::OnGcEpilogue(v8::Isolate* isolate, v8::GCType type, v8::GCCallbackFlags flags)
+{
+    AllocationSampler* self = s_active;
+    if (self != NULL)
+        self->last_used_ = self->heapUsed();
+}
+
+void AllocationSampler::sample()
+{
+    uint64_t used = heapUsed();
+    uint64_t bytes = hidden_by_gc_ + (used > last_used_ ? used - last_used_ : 0);
+    last_used_ = used;
+    hidden_by_gc_ = 0;
+    if (bytes == 0)
+        return;
+
+    v8::HandleScope handle_scope(isolate_);
+    v8::Local<v8::StackTrace> trace = v8::StackTrace::CurrentStackTrace(isolate_, kMaxFrames,
+            static_cast<v8::StackTrace::StackTraceOptions>(v8::StackTrace::kFunctionName |
+                                                           v8::StackTrace::kScriptName |
+                                                           v8::StackTrace::kLineNumber));
+    // Outermost frame first, as flamegraph.pl expects.
+    std::string stack;
+    for (int i = trace->GetFrameCount() - 1; i >= 0; --i) {
+        v8::Local<v8::StackFrame> frame = trace->GetFrame(i);
+        v8::String::Utf8Value name(frame->GetFunctionName());
+        v8::String::Utf8Value script(frame->GetScriptName());
+        if (!stack.empty())
+            stack += ';';
+        stack += (*name && name.length()) ? *name : "(anonymous)";
+        if (*script && script.length()) {
+            char line[32];
+            snprintf(line, sizeof(line), ":%d", frame->GetLineNumber());
+            stack += ' ';
+            stack += *script;
+            stack += line;
+        }
+    }
+    if (stack.empty())
+        stack = "(native)";
+    Site& site = sites_[stack];
+    site.bytes += bytes;
+    ++site.samples;
+}
+
+} } // namespace Mordor::Test
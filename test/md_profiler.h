@@ -0,0 +1,145 @@
+#ifndef MD_PROFILER_H_
+#define MD_PROFILER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "v8.h"
+#include "v8-profiler.h"
+#include "mordor/util.h"
+#include "mordor/timer.h"
+
+#include "md_guarded.h"
+
+namespace Mordor
+{
+
+class Scheduler;
+
+namespace Test
+{
+
+class ProfileFile
+{
+public:
+    // Writes |data| to |path| on a fiber of |scheduler| so the isolate
+    // thread never blocks on disk. Failures are reported on stderr.
+    static void WriteAsync(Scheduler* scheduler, const std::string& path,
+                           std::shared_ptr<std::string> data);
+
+    // <mdv8.profiler.dir>/<prefix>.<pid>.<ms since epoch>
+    static std::string DefaultBaseName(const char* prefix);
+};
+
+/**
+ * CpuProfilerSession
+ *
+ * Drives V8's CpuProfiler for one isolate. start() and stop() have to run
+ * on the isolate thread; stop() serializes the profile both as a
+ * .cpuprofile (Chrome DevTools) and as collapsed stacks for flamegraph.pl,
+ * then hands the files to ProfileFile::WriteAsync().
+ *
+ * requestToggle() may be called from any thread (the SIGUSR2 handler): it
+ * interrupts running JS, and checkPending() picks it up between scripts.
+ * The interrupt goes through a GuardedTarget the destructor detaches.
+ */
+class CpuProfilerSession : Mordor::noncopyable
+{
+public:
+    CpuProfilerSession(v8::Isolate* isolate, Scheduler* scheduler);
+    ~CpuProfilerSession();
+
+    bool profiling() const
+    {
+        return profiling_;
+    }
+
+    // Sampling interval in microseconds, takes effect on the next start().
+    void setSamplingInterval(int interval);
+
+    bool start();
+    // Writes <base>.cpuprofile and <base>.folded, returns false if the
+    // profiler was not running.
+    bool stop(const std::string& base);
+
+    void requestToggle();
+    void checkPending();
+
+private:
+    void toggle();
+
+    v8::Isolate* const isolate_;
+    Scheduler* const scheduler_;
+    int interval_;
+    bool profiling_;
+    std::atomic<bool> toggle_pending_;
+    GuardedTarget<CpuProfilerSession>::ptr guard_;
+};
+
+/**
+ * AllocationSampler
+ *
+ * The bundled V8 has no sampling heap profiler, so allocation sites are
+ * approximated: every interval a timer interrupts the isolate, and the
+ * growth of the used heap since the previous sample is charged to the JS
+ * stack running at that moment. Growth that a GC hides between two samples
+ * is measured in the GC prologue and charged to the next sample. The
+ * result is a collapsed-stack file (frame;frame bytes) for flamegraph.pl.
+ *
+ * start() and stop() run on the isolate thread. Each run's timer and
+ * interrupts go through a GuardedTarget that stop() detaches, so a late
+ * tick or interrupt finds nothing to sample.
+ */
+class AllocationSampler : Mordor::noncopyable
+{
+public:
+    static const int kMaxFrames = 64;
+
+    AllocationSampler(v8::Isolate* isolate, TimerManager* timers, Scheduler* scheduler);
+    ~AllocationSampler();
+
+    bool sampling() const
+    {
+        return sampling_;
+    }
+
+    // |interval| in ms, 0 for --mdv8.profiler.allocinterval.
+    bool start(unsigned int interval);
+    // Writes the collapsed stacks to |path|, false if not sampling.
+    bool stop(const std::string& path);
+
+private:
+    struct Site
+    {
+        uint64_t bytes;
+        uint64_t samples;
+    };
+
+    static void OnGcPrologue(v8::Isolate* isolate, v8::GCType type, v8::GCCallbackFlags flags);
+    static void OnGcEpilogue(v8::Isolate* isolate, v8::GCType type, v8::GCCallbackFlags flags);
+    static AllocationSampler* s_active;
+
+    // Timer thread.
+    void onTimer();
+    // Isolate thread.
+    void sample();
+    uint64_t heapUsed();
+
+    v8::Isolate* const isolate_;
+    TimerManager* const timers_;
+    Scheduler* const scheduler_;
+    GuardedTarget<AllocationSampler>::ptr guard_;
+    Timer::ptr timer_;
+    bool sampling_;
+    uint64_t last_used_;
+    uint64_t hidden_by_gc_;
+    std::map<std::string, Site> sites_;
+};
+
+} } // namespace Mordor::Test
+
+#endif // MD_PROFILER_H_
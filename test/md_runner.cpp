@@ -1,7 +1,11 @@
 #include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <exception>
 #include <iostream>
 #include <functional>
 
@@ -11,6 +15,7 @@
 #include "mordor/thread.h"
 #include "mordor/fiber.h"
 #include "mordor/assert.h"
+#include "mordor/config.h"
 #include "mordor/coroutine.h"
 #include "mordor/streams/file.h"
 #include "mordor/streams/std.h"
@@ -18,12 +23,22 @@
 #include "v8.h"
 #include "v8/include/libplatform/libplatform.h"
 #include "md_v8_wrapper.h"
+#include "md_array_buffer_allocator.h"
+#include "md_budget.h"
+#include "md_counters.h"
+#include "md_guarded.h"
+#include "md_signal.h"
+#include "md_topology.h"
+#include "md_trace.h"
 
 #include "md_env.h"
 #include "md_env_inl.h"
 #include "md_v8_util_inl.h"
 
+#include "js_objects/bench.h"
 #include "js_objects/process.h"
+#include "js_objects/tracing.h"
+#include "js_objects/profiler.h"
 
 extern int g_argc;
 extern char** g_argv;
@@ -35,6 +50,14 @@ namespace Mordor
 namespace Test
 {
 
+static ConfigVar<std::string>::ptr g_traceFile =
+        Config::lookup("mdv8.trace.file", std::string(),
+                "Record a Chrome trace from startup and write it here on exit");
+
+static ConfigVar<bool>::ptr g_topologyReport =
+        Config::lookup("mdv8.iomanager.report", false,
+                "Print the CPU topology and thread placement at startup");
+
 LineEditor *LineEditor::current_ = NULL;
 
 LineEditor::LineEditor(Type type, const char* name) :
@@ -44,53 +67,6 @@ LineEditor::LineEditor(Type type, const char* name) :
         current_ = this;
 }
 
-/**
- * ArrayBufferAllocator
- */
-class ArrayBufferAllocator: public v8::ArrayBuffer::Allocator
-{
-public:
-    // Impose an upper limit to avoid out of memory errors that bring down
-    // the process.
-    static const size_t kMaxLength = 0x3fffffff;
-    static ArrayBufferAllocator the_singleton;
-    virtual ~ArrayBufferAllocator()
-    {
-    }
-    virtual void* Allocate(size_t length);
-    virtual void* AllocateUninitialized(size_t length);
-    virtual void Free(void* data, size_t length);
-private:
-    ArrayBufferAllocator()
-    {
-    }
-    ArrayBufferAllocator(const ArrayBufferAllocator&);
-    void operator=(const ArrayBufferAllocator&);
-};
-
-ArrayBufferAllocator ArrayBufferAllocator::the_singleton;
-
-void* ArrayBufferAllocator::Allocate(size_t length)
-{
-    if (length > kMaxLength)
-        return NULL;
-    char* data = new char[length];
-    memset(data, 0, length);
-    return data;
-}
-
-void* ArrayBufferAllocator::AllocateUninitialized(size_t length)
-{
-    if (length > kMaxLength)
-        return NULL;
-    return new char[length];
-}
-
-void ArrayBufferAllocator::Free(void* data, size_t length)
-{
-    delete[] static_cast<char*>(data);
-}
-
 static void readScript(Coroutine<const char*>& self)
 {
     LineEditor* console = LineEditor::Get();
@@ -104,6 +80,55 @@ static void readScript(Coroutine<const char*>& self)
     } while (true);
 }
 
+static void co_prompt(MD_Task<const char*(TASK)>& self, Coroutine<const char*>* coReadScript)
+{
+    self.setResult(coReadScript->call());
+}
+
+// A line being read for the runner, see waitForInput().
+struct PendingInput
+{
+    const char* script { NULL };
+    std::exception_ptr error;
+    std::atomic<bool> done { false };
+};
+
+static void readInput(Environment* env, Coroutine<const char*>* coReadScript, PendingInput* input)
+{
+    try {
+        TaskOptions options("prompt", kLaneInteractive);
+        options.waits_for_input = true;
+        env->worker()->doTask<const char*, TASK>(
+                std::bind(&co_prompt, std::placeholders::_1, coReadScript), input->script, options);
+    } catch (...) {
+        input->error = std::current_exception();
+    }
+    input->done.store(true, std::memory_order_release);
+    env->wake_idle();
+}
+
+// The prompt blocks a thread in readline, so it is read by a worker task
+// submitted from a fiber of its own, while the runner sleeps on the
+// isolate thread with the isolate lock and does the idle time work it is
+// woken for. The worker fiber is not pinned: when readline happens to
+// block the isolate thread, the idle work waits for the next line.
+static const char* waitForInput(Environment* env, Scheduler& sched, Coroutine<const char*>* coReadScript)
+{
+    PendingInput input;
+    sched.schedule(std::bind(&readInput, env, coReadScript, &input));
+    env->set_idle(true);
+    while (true) {
+        env->wait_idle();
+        if (input.done.load(std::memory_order_acquire))
+            break;
+        env->run_idle_work();
+    }
+    env->set_idle(false);
+    if (input.error)
+        std::rethrow_exception(input.error);
+    return input.script;
+}
+
 static void AppendExceptionLine(Environment* env, v8::Handle<v8::Value> er, v8::Handle<v8::Message> message)
 {
     if (message.IsEmpty())
@@ -265,7 +290,11 @@ static v8::Local<v8::Value> ExecuteString(Environment* env,
     // we will handle exceptions ourself.
     try_catch.SetVerbose(false);
 
-    v8::Local<v8::Script> script = v8::Script::Compile(source, filename);
+    v8::Local<v8::Script> script;
+    {
+        MD_TRACE_SCOPE("v8", "compile");
+        script = v8::Script::Compile(source, filename);
+    }
     if (script.IsEmpty()) {
         ReportException(env, try_catch);
         if(exitOnError)
@@ -273,7 +302,19 @@ static v8::Local<v8::Value> ExecuteString(Environment* env,
         return scope.Escape(v8::Undefined(isolate)->ToObject());
     }
 
-    v8::Local<v8::Value> result = script->Run();
+    v8::Local<v8::Value> result;
+    {
+        MD_TRACE_SCOPE("v8", "run");
+        ExecutionBudget budget(isolate, dynamic_cast<TimerManager*>(Scheduler::getThis()));
+        result = script->Run();
+        // A runaway script becomes an ordinary error and the shell goes on.
+        if (result.IsEmpty()) {
+            if (budget.recover())
+                budget.throwTimeout();
+            else if (env->heap_guard()->recover())
+                env->heap_guard()->throwOutOfMemory();
+        }
+    }
     if (result.IsEmpty()) {
         ReportException(env, try_catch);
         if(exitOnError)
@@ -287,6 +328,19 @@ static v8::Local<v8::Value> ExecuteString(Environment* env,
     return scope.Escape(result);
 }
 
+// Installs the JS objects into the entered context.
+static void SetupGlobals(Environment* env)
+{
+    ProcessObject po(env);
+    po.setup();
+    TracingObject tracing(env);
+    tracing.setup();
+    ProfilerObject profiler(env);
+    profiler.setup();
+    BenchObject bench(env);
+    bench.setup();
+}
+
 MD_Runner::MD_Runner(Scheduler& sched) :
         sched_(sched)
 {
@@ -311,7 +365,16 @@ void MD_Runner::run()
     v8::V8::SetFlagsFromString(MD_V8_OPTIONS, sizeof(MD_V8_OPTIONS) - 1);
     v8::V8::SetArrayBufferAllocator(&ArrayBufferAllocator::the_singleton);
 
-    v8::Isolate* isolate = v8::Isolate::New();
+    // The isolate's heap is mapped from this thread.
+    ThreadPlacement::the_singleton.localMemory();
+    if (g_topologyReport->val())
+        ThreadPlacement::the_singleton.report(std::cerr);
+
+    v8::Isolate::CreateParams create_params;
+    HeapGuard::ConfigureConstraints(&create_params.constraints);
+    v8::Isolate* isolate = v8::Isolate::New(create_params);
+    CounterTable::InstallFromConfig(isolate);
+    ExternalMemory::the_singleton.attach(isolate);
     {
         v8::Isolate::Scope isolate_scope(isolate);
         v8::Locker locker(isolate);
@@ -320,26 +383,63 @@ void MD_Runner::run()
         v8::Context::Scope context_scope(context);
         Environment* env = Environment::New(context, Scheduler::getThis());
 
-        ProcessObject po(env);
-        po.setup();
+        SetupGlobals(env);
+        // Requests run in pooled contexts bootstrapped the same way.
+        if (env->context_pool())
+            env->context_pool()->start(std::bind(&SetupGlobals, env));
+        if (!g_traceFile->val().empty())
+            Tracer::start();
+
+        // kill -USR1 dumps the task latency histograms.
+        SignalWatcher signal_watcher(dynamic_cast<IOManager&>(sched_));
+        signal_watcher.on(SIGUSR1, std::bind(&TaskStats::dump, &env->worker()->stats(), std::ref(std::cerr)));
+        // kill -USR2 starts the CPU profiler, the next one writes the profile.
+        signal_watcher.on(SIGUSR2, std::bind(&CpuProfilerSession::requestToggle, env->cpu_profiler()));
         {
             Coroutine<const char*> coReadScript(&readScript);
             const char* script;
             bool running = true;
+            // Lines typed at a terminal build on each other's globals, only
+            // piped in requests get a pooled context each.
+            ContextPool* request_pool = isatty(STDIN_FILENO) ? NULL : env->context_pool();
             do {
-                script = coReadScript.call();
+                script = waitForInput(env, sched_, &coReadScript);
                 if (coReadScript.state() == Fiber::State::TERM) {
                     break;
                 }
                 v8::HandleScope handle_scope(context->GetIsolate());
+                // A SIGUSR2 that arrived while waiting for input.
+                env->cpu_profiler()->checkPending();
                 v8::Local<v8::String> script_str = Utf8String(isolate, script);
-                ExecuteString(env, script_str, Utf8String(isolate, "md_shell"));
+                if (env->watchdog())
+                    env->watchdog()->scriptStarted();
+                {
+                    ContextPool::Lease lease(request_pool);
+                    v8::Context::Scope request_scope(lease.empty() ? context : lease.context());
+                    ExecuteString(env, script_str, Utf8String(isolate, "md_shell"));
+                }
+                if (env->watchdog())
+                    env->watchdog()->scriptFinished();
+                ExternalMemory::the_singleton.flush();
                 running = env->running();
             } while (running);
             std::cout << "bye." << std::endl;
         }
+        if (!g_traceFile->val().empty()) {
+            Tracer::stop();
+            try {
+                FileStream stream(g_traceFile->val(), FileStream::WRITE,
+                                  FileStream::OVERWRITE_OR_CREATE);
+                Tracer::write(stream);
+                stream.close();
+            } catch (...) {
+                fprintf(stderr, "failed to write trace to %s\n", g_traceFile->val().c_str());
+            }
+        }
         Environment::environment.reset();
     }
+    ExternalMemory::the_singleton.attach(NULL);
+    ReleasePendingInterrupts(isolate);
     isolate->Dispose();
 
     LineEditor* line_editor = LineEditor::Get();
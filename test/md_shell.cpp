@@ -48,6 +48,8 @@
 #include "libplatform/libplatform.h"
 
 #include "md_runner.h"
+#include "md_signal.h"
+#include "md_iomanager.h"
 
 #ifdef COMPRESS_STARTUP_DATA_BZ2
 #error Using compressed startup data is not supported for this sample
@@ -85,7 +87,10 @@ MORDOR_MAIN(int argc, char* argv[])
 
     int result = 0;
 
-    IOManager pool(4);
+    // Before the IOManager starts its threads, they inherit the mask.
+    Mordor::Test::SignalWatcher::blockSignals();
+
+    Mordor::Test::MD_IOManager pool(Mordor::Test::ThreadPlacement::configuredThreads());
 
     Mordor::Test::MD_Runner runner(pool);
 
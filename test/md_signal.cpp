@@ -0,0 +1,98 @@
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "mordor/version.h"
+#include "mordor/assert.h"
+#include "mordor/exception.h"
+#include "mordor/iomanager.h"
+
+#ifdef LINUX
+#include <sys/signalfd.h>
+#endif
+
+#include "md_signal.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+static sigset_t watchedSignals()
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    return mask;
+}
+
+void SignalWatcher::blockSignals()
+{
+#ifdef LINUX
+    sigset_t mask = watchedSignals();
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+#endif
+}
+
+SignalWatcher::SignalWatcher(IOManager& iom) :
+        iom_(iom), fd_(-1), stopping_(false)
+{
+#ifdef LINUX
+    sigset_t mask = watchedSignals();
+    fd_ = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd_ < 0)
+        MORDOR_THROW_EXCEPTION_FROM_LAST_ERROR_API("signalfd");
+    iom_.schedule(std::bind(&SignalWatcher::run, this));
+#endif
+}
+
+SignalWatcher::~SignalWatcher()
+{
+    if (fd_ < 0)
+        return;
+    stopping_ = true;
+    iom_.cancelEvent(fd_, IOManager::READ);
+    stopped_.wait();
+    close(fd_);
+}
+
+void SignalWatcher::on(int signo, const Handler& dg)
+{
+    MORDOR_ASSERT(signo == SIGUSR1 || signo == SIGUSR2);
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    handlers_[signo] = dg;
+}
+
+void SignalWatcher::dispatch(int signo)
+{
+    Handler dg;
+    {
+        std::lock_guard<std::mutex> scopeLock(lock_);
+        std::map<int, Handler>::iterator it = handlers_.find(signo);
+        if (it == handlers_.end())
+            return;
+        dg = it->second;
+    }
+    dg();
+}
+
+void SignalWatcher::run()
+{
+#ifdef LINUX
+    while (!stopping_) {
+        iom_.registerEvent(fd_, IOManager::READ);
+        // The destructor may have set stopping_ and cancelled before the
+        // event was registered; it would then wait for us forever.
+        if (stopping_)
+            iom_.cancelEvent(fd_, IOManager::READ);
+        Scheduler::yieldTo();
+        struct signalfd_siginfo info;
+        while (!stopping_ && read(fd_, &info, sizeof(info)) == sizeof(info))
+            dispatch(info.ssi_signo);
+    }
+#endif
+    stopped_.notify();
+}
+
+} } // namespace Mordor::Test
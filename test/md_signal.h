@@ -0,0 +1,55 @@
+#ifndef MD_SIGNAL_H_
+#define MD_SIGNAL_H_
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+
+#include "mordor/util.h"
+#include "mordor/fibersynchronization.h"
+
+namespace Mordor
+{
+
+class IOManager;
+
+namespace Test
+{
+
+/**
+ * Delivers SIGUSR1/SIGUSR2 to handlers running on a fiber of the
+ * IOManager instead of in signal context.
+ *
+ * Uses a signalfd on Linux; the signals have to be blocked in every thread
+ * for that, so blockSignals() must run before any thread is started.
+ * Elsewhere the handlers are simply never called.
+ */
+class SignalWatcher : Mordor::noncopyable
+{
+public:
+    typedef std::function<void ()> Handler;
+
+    static void blockSignals();
+
+    explicit SignalWatcher(IOManager& iom);
+    ~SignalWatcher();
+
+    // Replaces the handler of |signo|, which must be SIGUSR1 or SIGUSR2.
+    void on(int signo, const Handler& dg);
+
+private:
+    void run();
+    void dispatch(int signo);
+
+    IOManager& iom_;
+    int fd_;
+    std::atomic<bool> stopping_;
+    FiberSemaphore stopped_;
+    std::mutex lock_;
+    std::map<int, Handler> handlers_;
+};
+
+} } // namespace Mordor::Test
+
+#endif // MD_SIGNAL_H_
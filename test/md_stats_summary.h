@@ -0,0 +1,60 @@
+#ifndef MD_STATS_SUMMARY_H_
+#define MD_STATS_SUMMARY_H_
+
+#include <math.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace Mordor
+{
+namespace Test
+{
+
+// Summary of a series of timing samples, shared by bench() and md_bench so
+// their numbers mean the same thing.
+struct SampleSummary
+{
+    size_t count;
+    double mean;
+    double stddev;      // sample standard deviation, 0 for one sample
+    double min;
+    double max;
+    double p50;
+    double p90;
+    double p99;
+};
+
+// Nearest-rank percentile of |sorted|, which is not empty, |p| in 0..100.
+inline double Percentile(const std::vector<double>& sorted, double p)
+{
+    size_t rank = static_cast<size_t>(ceil(p / 100.0 * sorted.size()));
+    return sorted[std::min(rank ? rank - 1 : 0, sorted.size() - 1)];
+}
+
+// Sorts |samples|, which is not empty, and summarizes them.
+inline SampleSummary Summarize(std::vector<double>& samples)
+{
+    std::sort(samples.begin(), samples.end());
+    SampleSummary summary;
+    summary.count = samples.size();
+    double sum = 0;
+    for (size_t i = 0; i < samples.size(); ++i)
+        sum += samples[i];
+    summary.mean = sum / samples.size();
+    double variance = 0;
+    for (size_t i = 0; i < samples.size(); ++i)
+        variance += (samples[i] - summary.mean) * (samples[i] - summary.mean);
+    summary.stddev = samples.size() > 1 ? sqrt(variance / (samples.size() - 1)) : 0;
+    summary.min = samples.front();
+    summary.max = samples.back();
+    summary.p50 = Percentile(samples, 50);
+    summary.p90 = Percentile(samples, 90);
+    summary.p99 = Percentile(samples, 99);
+    return summary;
+}
+
+} } // namespace Mordor::Test
+
+#endif // MD_STATS_SUMMARY_H_
@@ -0,0 +1,110 @@
+#include "mordor/scheduler.h"
+
+#include "md_task.h"
+#include "md_task_stats.h"
+#include "md_trace.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+void WaitOnThread(Mordor::FiberSemaphore& event, bool pin)
+{
+    tid_t tid = gettid();
+    event.wait();
+    Scheduler* scheduler = Scheduler::getThis();
+    if (pin && scheduler && gettid() != tid)
+        scheduler->switchTo(tid);
+}
+
+const char* TaskLaneName(TaskLane lane)
+{
+    switch (lane) {
+    case kLaneInteractive:
+        return "interactive";
+    case kLaneNormal:
+        return "normal";
+    case kLaneBulk:
+        return "bulk";
+    default:
+        return "unknown";
+    }
+}
+
+namespace Internal {
+
+void TaskControl::fire(Reason reason)
+{
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    if (reason_ != kNone)
+        return;
+    reason_ = reason;
+    if (task_)
+        task_->setEvent();
+}
+
+TaskControl::Reason TaskControl::detach()
+{
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    task_ = NULL;
+    return reason_;
+}
+
+TaskControl::Reason TaskControl::reason() const
+{
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    return reason_;
+}
+
+} // namespace Internal
+
+void CancellationToken::cancel()
+{
+    std::shared_ptr<Internal::TaskControl> control;
+    {
+        std::lock_guard<std::mutex> scopeLock(lock_);
+        cancelled_ = true;
+        control = control_.lock();
+    }
+    if (control)
+        control->fire(Internal::TaskControl::kCancelled);
+}
+
+bool CancellationToken::cancelled() const
+{
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    return cancelled_;
+}
+
+bool CancellationToken::bind(const std::shared_ptr<Internal::TaskControl>& control)
+{
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    if (cancelled_)
+        return false;
+    control_ = control;
+    return true;
+}
+
+void Task::Call(TaskStats* stats)
+{
+    try {
+        MD_TRACE_SCOPE("task", name());
+        this->run();
+    } catch (MdTaskTimeoutException &) {
+        error_ = std::current_exception();
+    } catch (MdTaskCancelledException &) {
+        error_ = std::current_exception();
+    } catch (MdTaskQueueFullException &) {
+        error_ = std::current_exception();
+    } catch (MdTaskAbortedException &) {
+    }
+    completed_at_ = TimerManager::now();
+    // The waiter owns this task and may destroy it as soon as the event is
+    // set, so everything we want to know has to be recorded before.
+    if (stats)
+        stats->record(*this);
+    setEvent();
+}
+
+} }  // namespace Mordor::Test
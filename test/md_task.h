@@ -1,15 +1,21 @@
 #ifndef MORDOR_CO_TASK_H_
 #define MORDOR_CO_TASK_H_
 
+#include <exception>
+#include <memory>
+#include <mutex>
+
 #include "mordor/assert.h"
 #include "mordor/util.h"
 #include "mordor/coroutine.h"
 #include "mordor/semaphore.h"
 #include "mordor/fibersynchronization.h"
+#include "mordor/timer.h"
 
 #include "v8.h"
 #include "v8_persistent_wrapper.h"
 #include "md_v8_util_inl.h"
+#include "md_trace.h"
 
 namespace Mordor
 {
@@ -20,35 +26,252 @@ struct MdTaskAbortedException: virtual OperationAbortedException
 {
 };
 
+// Thrown by MD_TaskQueue::append() when the queue is full and
+// --mdv8.queue.overflow is "reject".
+struct MdTaskQueueFullException: virtual Exception
+{
+};
+
+// Thrown by MD_TaskQueue::append() for a bulk task while the isolate is
+// under heap pressure, see MD_Worker::setShedding().
+struct MdTaskShedException: virtual MdTaskQueueFullException
+{
+};
+
+// Thrown to the submitter of a task that was dropped before a worker
+// picked it up, see TaskOptions::deadline and CancellationToken. Unlike a
+// plain MdTaskAbortedException they are not swallowed by Task::Call(): a
+// nested submission failing inside a task body fails the outer one too.
+struct MdTaskTimeoutException: virtual MdTaskAbortedException
+{
+};
+
+struct MdTaskCancelledException: virtual MdTaskAbortedException
+{
+};
+
+class Task;
+class TaskStats;
+
+// Waits on |event|. With |pin| the fiber comes back to the thread it
+// waited on before returning, whichever thread woke it: V8 keeps the state
+// of the isolate lock holder per thread.
+void WaitOnThread(Mordor::FiberSemaphore& event, bool pin);
+
+namespace Internal {
+
+// Wakes the submitter of a task when its deadline passes or it is
+// cancelled. Shared with the deadline timer and the CancellationToken,
+// which may fire after the task is gone; detach() cuts the link.
+class TaskControl : Mordor::noncopyable
+{
+public:
+    enum Reason {
+        kNone = 0,
+        kExpired,
+        kCancelled
+    };
+
+    explicit TaskControl(Task* task) : task_(task) {}
+
+    // Records |reason| and wakes the submitter, only the first call counts.
+    void fire(Reason reason);
+
+    // Unlinks the task and returns why its submitter was woken, kNone if
+    // it was not.
+    Reason detach();
+
+    Reason reason() const;
+
+private:
+    mutable std::mutex lock_;
+    Task* task_;
+    Reason reason_ { kNone };
+};
+
+} // namespace Internal
+
+/**
+ * CancellationToken
+ *
+ * Lets whoever is responsible for a submission give up on it, for example
+ * when the request it serves went away. cancel() drops the task if no
+ * worker has picked it up yet and the submitter gets
+ * MdTaskCancelledException; a task that is already running is waited for.
+ * A token stays cancelled, later submissions with it fail at once.
+ */
+class CancellationToken : Mordor::noncopyable
+{
+public:
+    typedef std::shared_ptr<CancellationToken> ptr;
+
+    void cancel();
+    bool cancelled() const;
+
+    // Makes |control| the submission to cancel, false if already cancelled.
+    bool bind(const std::shared_ptr<Internal::TaskControl>& control);
+
+private:
+    mutable std::mutex lock_;
+    bool cancelled_ { false };
+    std::weak_ptr<Internal::TaskControl> control_;
+};
+
+// The queues of MD_TaskQueue, highest priority first.
+enum TaskLane {
+    kLaneInteractive = 0,   // short and user facing, e.g. print
+    kLaneNormal,
+    kLaneBulk,              // large I/O that can wait
+    kLaneCount
+};
+
+const char* TaskLaneName(TaskLane lane);
+
+// Per submission settings, see MD_Worker::doTask().
+struct TaskOptions
+{
+    explicit TaskOptions(const char* name = NULL, TaskLane lane = kLaneNormal) :
+            name(name), lane(lane) {}
+
+    TaskOptions& setTimeout(unsigned long long us)
+    {
+        deadline = TimerManager::now() + us;
+        return *this;
+    }
+
+    // Key for the latency statistics, a string literal.
+    const char* name;
+    TaskLane lane;
+    // TimerManager::now() after which the task is dropped unless a worker
+    // has picked it up, 0 for none.
+    unsigned long long deadline { 0 };
+    CancellationToken::ptr token;
+    // The task mostly waits for the user, e.g. the prompt; MD_Worker leaves
+    // it out of the pool's utilization.
+    bool waits_for_input { false };
+};
+
 class Task : Mordor::noncopyable
 {
 public:
     virtual ~Task(){}
 
-    void Call()
+    void Call(TaskStats* stats = NULL);
+
+    // Rethrows to the submitter what a nested submission in run() failed
+    // with, once the task completed.
+    void rethrowError()
     {
-        try {
-            this->run();
-        } catch (MdTaskAbortedException &) {
-        }
-        setEvent();
+        if (error_)
+            std::rethrow_exception(error_);
     }
 
+    void setOptions(const TaskOptions& options)
+    {
+        name_ = options.name;
+        lane_ = options.lane;
+        deadline_ = options.deadline;
+        waits_for_input_ = options.waits_for_input;
+    }
+
+    bool waitsForInput() const
+    {
+        return waits_for_input_;
+    }
+
+    // Whether the task takes the isolate lock, see MD_Worker's isolate
+    // affinity.
+    virtual bool needsIsolate() const
+    {
+        return false;
+    }
+
+    void setControl(const std::shared_ptr<Internal::TaskControl>& control)
+    {
+        control_ = control;
+    }
+
+    // Whether a worker should skip this task: it is past its deadline or
+    // its submitter was woken to give up on it.
+    bool abandoned(unsigned long long now) const
+    {
+        return (deadline_ != 0 && now >= deadline_) ||
+                (control_ && control_->reason() != Internal::TaskControl::kNone);
+    }
+
+    TaskLane lane() const
+    {
+        return lane_;
+    }
+
+    const char* name() const
+    {
+        return name_ ? name_ : "unnamed";
+    }
+
+    // Timestamps in TimerManager::now() microseconds, 0 until reached.
+    unsigned long long enqueuedAt() const { return enqueued_at_; }
+    unsigned long long dequeuedAt() const { return dequeued_at_; }
+    unsigned long long completedAt() const { return completed_at_; }
+
+    void markEnqueued()
+    {
+        enqueued_at_ = TimerManager::now();
+    }
+
+    void markDequeued()
+    {
+        dequeued_at_ = TimerManager::now();
+    }
+
+    // Returns once the task completed, or once after its TaskControl
+    // fired; the submitter then has to wait again if the task is running.
+    // A submitter holding the isolate lock, e.g. a TASK_V8 body printing,
+    // resumes on the thread it waited on.
     virtual void waitEvent()
     {
-        event_.wait();
+        v8::Isolate* isolate = v8::Isolate::GetCurrent();
+        wait(isolate != NULL && v8::Locker::IsLocked(isolate));
     }
 
 protected:
+    void wait(bool pin)
+    {
+        MD_TRACE_SCOPE("fiber", "Task::waitEvent");
+        WaitOnThread(event_, pin);
+    }
+
     virtual void run() = 0;
 
     void setEvent()
     {
-        event_.set();
+        event_.notify();
     }
 
 protected:
-    Mordor::FiberEvent event_ { false };
+    friend class Internal::TaskControl;
+    friend class MD_TaskQueue;
+
+    // Where the task is, guarded by the MD_TaskQueue lock.
+    enum QueueState {
+        kIdle = 0,
+        kQueued,
+        kRunning,
+        kWithdrawn      // dropped or taken back before it ran
+    };
+
+    // Counts completion and TaskControl wakeups, either may come first.
+    Mordor::FiberSemaphore event_ { 0 };
+    const char* name_ { NULL };
+    TaskLane lane_ { kLaneNormal };
+    QueueState queue_state_ { kIdle };
+    unsigned long long deadline_ { 0 };
+    bool waits_for_input_ { false };
+    std::shared_ptr<Internal::TaskControl> control_;
+    std::exception_ptr error_;
+    unsigned long long enqueued_at_ { 0 };
+    unsigned long long dequeued_at_ { 0 };
+    unsigned long long completed_at_ { 0 };
 };
 
 struct TASK;      // for normal task
@@ -72,7 +295,7 @@ public:
         return val_;
     }
 protected:
-    Result val_;
+    Result val_ {};
 };
 
 template<>
@@ -158,10 +381,16 @@ public:
         return isolate_;
     }
 
+    virtual bool needsIsolate() const override
+    {
+        return true;
+    }
+
+    // The lock is taken back on the thread that gave it up.
     virtual void waitEvent() override
     {
         v8::Unlocker unlocker(isolate_);
-        Task::waitEvent();
+        wait(true);
     }
 
 protected:
@@ -1,5 +1,11 @@
+#include <algorithm>
+#include <string>
+
 #include "mordor/assert.h"
+#include "mordor/config.h"
+#include "mordor/scheduler.h"
 #include "md_task_queue.h"
+#include "md_trace.h"
 
 namespace Mordor
 {
@@ -7,45 +13,269 @@ namespace Mordor
 namespace Test
 {
 
+static ConfigVar<int>::ptr g_ageLimit =
+        Config::lookup("mdv8.queue.agelimit", 50,
+                       "Milliseconds a queued task may wait before it may be served ahead of "
+                       "higher priority lanes, at most every few tasks");
+
+static ConfigVar<int>::ptr g_capacity =
+        Config::lookup("mdv8.queue.capacity", 0,
+                       "Maximum number of tasks queued for the worker fibers, 0 for unbounded");
+
+static ConfigVar<std::string>::ptr g_overflow =
+        Config::lookup("mdv8.queue.overflow", std::string("block"),
+                       "What submitting to a full worker queue does: block or reject");
+
+const int MD_TaskQueue::kLaneWeights[kLaneCount] = { 8, 4, 1 };
+
 MD_TaskQueue::MD_TaskQueue() :
-        lock_(), condition_(lock_), terminated_(false)
+        lock_(), condition_(lock_), not_full_(lock_), size_(0), high_water_(0),
+        blocked_(0), rejected_(0), shed_(0), expired_(0), cancelled_(0),
+        wait_total_(0), released_(0), since_promotion_(0),
+        capacity_(static_cast<size_t>(std::max(g_capacity->val(), 0))),
+        reject_(g_overflow->val() == "reject"),
+        age_limit_(static_cast<unsigned long long>(std::max(g_ageLimit->val(), 1)) * 1000),
+        terminated_(false),
+        shedding_(false)
 {
+    for (int i = 0; i < kLaneCount; ++i) {
+        credits_[i] = kLaneWeights[i];
+        dequeued_[i] = 0;
+        promoted_[i] = 0;
+    }
 }
 
 MD_TaskQueue::~MD_TaskQueue()
 {
     FiberMutex::ScopedLock lock(lock_);
     MORDOR_ASSERT(terminated_);
-    MORDOR_ASSERT(task_queue_.empty());
+    MORDOR_ASSERT(size_ == 0);
 }
 
-void MD_TaskQueue::append(Task* task)
+void MD_TaskQueue::append(Task* task, bool may_block)
 {
+    MD_TRACE_SCOPE("queue", "append");
+    bool queued = true;
     {
         FiberMutex::ScopedLock lock(lock_);
         MORDOR_ASSERT(!terminated_);
-        task_queue_.push(task);
+        if (task->lane() == kLaneBulk && shedding_.load(std::memory_order_relaxed)) {
+            ++shed_;
+            MORDOR_THROW_EXCEPTION(MdTaskShedException());
+        }
+        if (capacity_ > 0 && size_ >= capacity_ && reject_) {
+            ++rejected_;
+            MORDOR_THROW_EXCEPTION(MdTaskQueueFullException());
+        }
+        // A worker fiber waiting for space could be waiting for itself.
+        if (capacity_ > 0 && size_ >= capacity_ && may_block) {
+            ++blocked_;
+            queued = false;
+        } else {
+            push(task);
+        }
+    }
+    if (!queued) {
+        // The tasks ahead may need the isolate lock (load, read), don't sit
+        // on it while waiting for them.
+        v8::Isolate* isolate = v8::Isolate::GetCurrent();
+        if (isolate != NULL && v8::Locker::IsLocked(isolate)) {
+            v8::Unlocker unlocker(isolate);
+            waitForSpace(task);
+        } else {
+            waitForSpace(task);
+        }
     }
     condition_.signal();
 }
 
+void MD_TaskQueue::waitForSpace(Task* task)
+{
+    MD_TRACE_SCOPE("queue", "full");
+    tid_t tid = gettid();
+    bool terminated;
+    {
+        FiberMutex::ScopedLock lock(lock_);
+        while (!terminated_ && size_ >= capacity_)
+            not_full_.wait();
+        terminated = terminated_;
+        if (!terminated)
+            push(task);
+    }
+    // Back to the thread the isolate lock is taken back on.
+    Scheduler* scheduler = Scheduler::getThis();
+    if (scheduler && gettid() != tid)
+        scheduler->switchTo(tid);
+    if (terminated)
+        MORDOR_THROW_EXCEPTION(MdTaskAbortedException());
+}
+
+void MD_TaskQueue::push(Task* task)
+{
+    task->markEnqueued();
+    task->queue_state_ = Task::kQueued;
+    lanes_[task->lane()].push_back(task);
+    if (++size_ > high_water_)
+        high_water_ = size_;
+}
+
 Task* MD_TaskQueue::getNext()
 {
+    MD_TRACE_SCOPE("queue", "getNext");
     while (true) {
         FiberMutex::ScopedLock lock(lock_);
-        if (!task_queue_.empty()) {
-            Task* task = task_queue_.front();
-            task_queue_.pop();
+        if (released_ > 0) {
+            --released_;
+            return NULL;
+        }
+        while (size_ > 0) {
+            TaskLane lane = pickLane();
+            Task* task = lanes_[lane].front();
+            lanes_[lane].pop_front();
+            --size_;
+            if (capacity_ > 0)
+                not_full_.signal();
+            if (task->abandoned(TimerManager::now())) {
+                // Its submitter is woken by the deadline timer or the
+                // cancellation; without a timer the deadline fires here.
+                task->queue_state_ = Task::kWithdrawn;
+                countAbandoned(task);
+                if (task->control_)
+                    task->control_->fire(Internal::TaskControl::kExpired);
+                continue;
+            }
+            task->queue_state_ = Task::kRunning;
+            ++dequeued_[lane];
+            task->markDequeued();
+            wait_total_ += task->dequeuedAt() - task->enqueuedAt();
             return task;
         }
         if (terminated_) {
             condition_.signal();
             return NULL;
         }
+        MD_TRACE_INSTANT("queue", "idle");
         condition_.wait();
     }
 }
 
+TaskLane MD_TaskQueue::pickLane()
+{
+    // Starvation guard: the longest waiting head past the age limit, but
+    // only once per kPromotionInterval picks. Under overload every head is
+    // past the limit; serving them by age alone would make the queue one
+    // FIFO and put interactive tasks behind the whole bulk backlog.
+    if (since_promotion_ < kPromotionInterval)
+        ++since_promotion_;
+    if (since_promotion_ >= kPromotionInterval) {
+        unsigned long long now = TimerManager::now();
+        int oldest = -1;
+        for (int i = 0; i < kLaneCount; ++i) {
+            if (lanes_[i].empty())
+                continue;
+            unsigned long long enqueued = lanes_[i].front()->enqueuedAt();
+            if (now - enqueued >= age_limit_ &&
+                    (oldest < 0 || enqueued < lanes_[oldest].front()->enqueuedAt()))
+                oldest = i;
+        }
+        if (oldest >= 0) {
+            since_promotion_ = 0;
+            ++promoted_[oldest];
+            return static_cast<TaskLane>(oldest);
+        }
+    }
+
+    // Weighted round robin; a new cycle starts once every non-empty lane
+    // has used up its credits.
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int i = 0; i < kLaneCount; ++i) {
+            if (!lanes_[i].empty() && credits_[i] > 0) {
+                --credits_[i];
+                return static_cast<TaskLane>(i);
+            }
+        }
+        for (int i = 0; i < kLaneCount; ++i)
+            credits_[i] = kLaneWeights[i];
+    }
+    MORDOR_NOTREACHED();
+    return kLaneNormal;
+}
+
+void MD_TaskQueue::countAbandoned(Task* task)
+{
+    if (task->control_ && task->control_->reason() == Internal::TaskControl::kCancelled)
+        ++cancelled_;
+    else
+        ++expired_;
+}
+
+bool MD_TaskQueue::withdraw(Task* task)
+{
+    FiberMutex::ScopedLock lock(lock_);
+    if (task->queue_state_ == Task::kWithdrawn)
+        return true;
+    if (task->queue_state_ != Task::kQueued)
+        return false;
+    std::deque<Task*>& lane = lanes_[task->lane()];
+    std::deque<Task*>::iterator it = std::find(lane.begin(), lane.end(), task);
+    MORDOR_ASSERT(it != lane.end());
+    lane.erase(it);
+    --size_;
+    task->queue_state_ = Task::kWithdrawn;
+    countAbandoned(task);
+    if (capacity_ > 0)
+        not_full_.signal();
+    return true;
+}
+
+size_t MD_TaskQueue::size()
+{
+    FiberMutex::ScopedLock lock(lock_);
+    return size_;
+}
+
+MD_TaskQueue::LaneStats MD_TaskQueue::laneStats(TaskLane lane)
+{
+    FiberMutex::ScopedLock lock(lock_);
+    LaneStats stats;
+    stats.depth = lanes_[lane].size();
+    stats.dequeued = dequeued_[lane];
+    stats.promoted = promoted_[lane];
+    return stats;
+}
+
+MD_TaskQueue::Stats MD_TaskQueue::stats()
+{
+    FiberMutex::ScopedLock lock(lock_);
+    Stats stats;
+    stats.capacity = capacity_;
+    stats.high_water = high_water_;
+    stats.blocked = blocked_;
+    stats.rejected = rejected_;
+    stats.shed = shed_;
+    stats.expired = expired_;
+    stats.cancelled = cancelled_;
+    stats.dequeued = 0;
+    for (int i = 0; i < kLaneCount; ++i)
+        stats.dequeued += dequeued_[i];
+    stats.wait_total = wait_total_;
+    return stats;
+}
+
+void MD_TaskQueue::setShedding(bool shedding)
+{
+    shedding_.store(shedding, std::memory_order_relaxed);
+}
+
+void MD_TaskQueue::release()
+{
+    {
+        FiberMutex::ScopedLock lock(lock_);
+        ++released_;
+    }
+    condition_.signal();
+}
+
 void MD_TaskQueue::terminate()
 {
     {
@@ -54,6 +284,7 @@ void MD_TaskQueue::terminate()
         terminated_ = true;
     }
     condition_.broadcast();
+    not_full_.broadcast();
 }
 
 } }  // namespace Mordor::Test
@@ -5,7 +5,10 @@
 #ifndef V8_LIBPLATFORM_TASK_QUEUE_H_
 #define V8_LIBPLATFORM_TASK_QUEUE_H_
 
-#include <queue>
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
 
 #include "mordor/fibersynchronization.h"
 #include "md_task.h"
@@ -14,26 +17,117 @@ namespace Mordor {
 
 namespace Test {
 
+// One queue per TaskLane. getNext() serves the lanes weighted round robin
+// (kLaneWeights tasks per cycle each), so bulk work cannot delay
+// interactive tasks by more than a few tasks, yet still makes progress. A
+// task that waited longer than --mdv8.queue.agelimit ms may be served
+// ahead of its lane, but only one in kPromotionInterval picks goes to such
+// a task, so aged work gets a bounded share instead of turning the queue
+// into a FIFO under overload.
+//
+// With --mdv8.queue.capacity set the queue is bounded: append() parks the
+// submitting fiber until a task is taken, or throws
+// MdTaskQueueFullException when --mdv8.queue.overflow is "reject". A
+// submitter holding the isolate lock gives it up while parked. Appends
+// that must not block, those from worker fibers, go past the capacity
+// instead: the fiber that would free the space may be the one waiting.
+//
+// While shedding, append() turns bulk tasks away with MdTaskShedException
+// whatever the capacity; the other lanes are still served.
+//
+// Tasks past their deadline or cancelled are dropped by getNext() instead
+// of being handed to a worker, see Task::abandoned().
 class MD_TaskQueue : Mordor::noncopyable{
  public:
+  struct LaneStats {
+    size_t depth;         // waiting now
+    uint64_t dequeued;
+    uint64_t promoted;    // dequeued early because of their age
+  };
+
+  struct Stats {
+    size_t capacity;      // 0 if unbounded
+    size_t high_water;    // most tasks ever queued at once
+    uint64_t blocked;     // appends that had to wait for space
+    uint64_t rejected;
+    uint64_t shed;        // bulk tasks turned away while shedding
+    uint64_t expired;     // dropped or withdrawn because of their deadline
+    uint64_t cancelled;
+    uint64_t dequeued;
+    uint64_t wait_total;  // microseconds the dequeued tasks spent queued
+  };
+
   MD_TaskQueue();
   ~MD_TaskQueue();
 
   // Appends a task to the queue. The queue takes ownership of |task|.
-  void append(Task* task);
+  // Blocks, unless |may_block| is false, or throws
+  // MdTaskQueueFullException while the queue is full, throws
+  // MdTaskAbortedException if it is terminated meanwhile.
+  void append(Task* task, bool may_block = true);
 
   // Returns the next task to process. Blocks if no task is available. Returns
-  // NULL if the queue is terminated.
+  // NULL if the queue is terminated or the caller was released.
   Task* getNext();
 
+  // Makes one getNext() return NULL without terminating the queue, so a
+  // worker fiber can retire.
+  void release();
+
+  // Takes back |task| unless a worker picked it up already. Returns true if
+  // it will not run.
+  bool withdraw(Task* task);
+
+  // Starts or stops turning bulk tasks away. Safe from any thread, it does
+  // not take |lock_|.
+  void setShedding(bool shedding);
+
+  bool shedding() const { return shedding_.load(std::memory_order_relaxed); }
+
   // Terminate the queue.
   void terminate();
 
+  // Number of tasks waiting to be picked up.
+  size_t size();
+
+  LaneStats laneStats(TaskLane lane);
+  Stats stats();
+
  private:
+  static const int kLaneWeights[kLaneCount];
+  static const int kPromotionInterval = 8;
+
+  // Called with |lock_| held and at least one task queued.
+  TaskLane pickLane();
+  // Called with |lock_| held for a task that will not run.
+  void countAbandoned(Task* task);
+  // Called with |lock_| held.
+  void push(Task* task);
+  // Parks until there is space for |task| and queues it, without |lock_|.
+  void waitForSpace(Task* task);
+
   FiberMutex lock_;
   FiberCondition condition_;
-  std::queue<Task*> task_queue_;
+  FiberCondition not_full_;
+  std::deque<Task*> lanes_[kLaneCount];
+  int credits_[kLaneCount];
+  uint64_t dequeued_[kLaneCount];
+  uint64_t promoted_[kLaneCount];
+  size_t size_;
+  size_t high_water_;
+  uint64_t blocked_;
+  uint64_t rejected_;
+  uint64_t shed_;
+  uint64_t expired_;
+  uint64_t cancelled_;
+  uint64_t wait_total_;
+  int released_;
+  int since_promotion_;     // picks since the last promotion, capped
+  const size_t capacity_;
+  const bool reject_;
+  const unsigned long long age_limit_;
   bool terminated_;
+  std::atomic<bool> shedding_;
 
 };
 
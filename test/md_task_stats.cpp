@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "md_task.h"
+#include "md_task_stats.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+TaskStats::TaskStats()
+{
+    for (size_t i = 0; i < kCacheSize; ++i)
+        cache_[i].store(NULL, std::memory_order_relaxed);
+}
+
+TaskLatency* TaskStats::lookup(const char* name)
+{
+    size_t slot = (reinterpret_cast<uintptr_t>(name) >> 3) & (kCacheSize - 1);
+    const LatencyMap::value_type* node = cache_[slot].load(std::memory_order_acquire);
+    if (node != NULL && strcmp(node->first.c_str(), name) == 0)
+        return node->second.get();
+
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    LatencyMap::iterator it = latencies_.find(name);
+    if (it == latencies_.end())
+        it = latencies_.insert(LatencyMap::value_type(name, std::unique_ptr<TaskLatency>(new TaskLatency()))).first;
+    cache_[slot].store(&*it, std::memory_order_release);
+    return it->second.get();
+}
+
+void TaskStats::record(const Task& task)
+{
+    if (task.enqueuedAt() == 0 || task.dequeuedAt() == 0)
+        return;
+    TaskLatency* latency = lookup(task.name());
+    latency->wait.record(task.dequeuedAt() - task.enqueuedAt());
+    latency->run.record(task.completedAt() - task.dequeuedAt());
+    latency->total.record(task.completedAt() - task.enqueuedAt());
+}
+
+void TaskStats::reset()
+{
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    for (LatencyMap::iterator it = latencies_.begin(); it != latencies_.end(); ++it) {
+        it->second->wait.reset();
+        it->second->run.reset();
+        it->second->total.reset();
+    }
+}
+
+static void dumpHistogram(std::ostream& os, const char* label, const Histogram& histogram)
+{
+    char line[160];
+    snprintf(line, sizeof(line), "  %-6s p50=%llu p90=%llu p99=%llu max=%llu mean=%.1f\n",
+             label,
+             static_cast<unsigned long long>(histogram.percentile(50)),
+             static_cast<unsigned long long>(histogram.percentile(90)),
+             static_cast<unsigned long long>(histogram.percentile(99)),
+             static_cast<unsigned long long>(histogram.max()),
+             histogram.mean());
+    os << line;
+}
+
+void TaskStats::dump(std::ostream& os) const
+{
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    os << "task latency (us)\n";
+    for (LatencyMap::const_iterator it = latencies_.begin(); it != latencies_.end(); ++it) {
+        const TaskLatency& latency = *it->second;
+        os << it->first << ": count=" << latency.total.count() << "\n";
+        dumpHistogram(os, "wait", latency.wait);
+        dumpHistogram(os, "run", latency.run);
+        dumpHistogram(os, "total", latency.total);
+    }
+    os.flush();
+}
+
+} }  // namespace Mordor::Test
@@ -0,0 +1,75 @@
+#ifndef MD_TASK_STATS_H_
+#define MD_TASK_STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+#include "mordor/util.h"
+
+#include "md_histogram.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+class Task;
+
+// Latencies of one kind of task, in microseconds.
+struct TaskLatency
+{
+    Histogram wait;     // enqueue -> dequeue
+    Histogram run;      // dequeue -> completion
+    Histogram total;    // enqueue -> completion
+};
+
+/**
+ * Per task name latency histograms of an MD_Worker.
+ *
+ * Task names are nearly always string literals, so the histograms are
+ * found through a small lock-free cache keyed by the name's address and
+ * checked against the name itself. Only a miss takes the lock. The
+ * samples themselves are lock-free.
+ */
+class TaskStats : Mordor::noncopyable
+{
+public:
+    typedef std::map<std::string, std::unique_ptr<TaskLatency> > LatencyMap;
+
+    TaskStats();
+
+    void record(const Task& task);
+
+    // Calls |dg(name, latency)| for every task name seen so far.
+    template <typename Callback>
+    void forEach(Callback dg) const
+    {
+        std::lock_guard<std::mutex> scopeLock(lock_);
+        for (LatencyMap::const_iterator it = latencies_.begin(); it != latencies_.end(); ++it)
+            dg(it->first, *it->second);
+    }
+
+    void dump(std::ostream& os) const;
+    void reset();
+
+private:
+    static const size_t kCacheSize = 64;
+
+    TaskLatency* lookup(const char* name);
+
+    mutable std::mutex lock_;
+    LatencyMap latencies_;
+    // Map nodes are never erased, so cached pointers stay valid.
+    std::atomic<const LatencyMap::value_type*> cache_[kCacheSize];
+};
+
+} } // namespace Mordor::Test
+
+#endif // MD_TASK_STATS_H_
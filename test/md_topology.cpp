@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "mordor/config.h"
+#include "mordor/scheduler.h"
+#include "mordor/version.h"
+
+#ifdef LINUX
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#include "md_topology.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+static ConfigVar<int>::ptr g_threads =
+        Config::lookup("mdv8.iomanager.threads", 4, "Threads of the shell's IOManager");
+
+static ConfigVar<std::string>::ptr g_affinity =
+        Config::lookup("mdv8.iomanager.affinity", std::string("none"),
+                       "Pinning of the IOManager threads: none, compact or spread");
+
+static ConfigVar<int>::ptr g_numaNode =
+        Config::lookup("mdv8.iomanager.numanode", -1,
+                       "NUMA node compact placement starts on, -1 for the largest");
+
+static ConfigVar<bool>::ptr g_localMemory =
+        Config::lookup("mdv8.numa.localmemory", true,
+                       "Prefer memory of the isolate thread's NUMA node when threads are pinned, "
+                       "turns on mdv8.worker.isolateaffinity");
+
+// From <numaif.h>, which needs libnuma's headers.
+static const int kMpolPreferred = 1;
+
+ThreadPlacement ThreadPlacement::the_singleton;
+
+const char* PlacementPolicyName(ThreadPlacement::Policy policy)
+{
+    switch (policy) {
+    case ThreadPlacement::kCompact:
+        return "compact";
+    case ThreadPlacement::kSpread:
+        return "spread";
+    default:
+        return "none";
+    }
+}
+
+// Parses a kernel cpulist such as "0-3,8-11".
+static std::vector<int> ParseCpuList(const std::string& list)
+{
+    std::vector<int> cpus;
+    const char* p = list.c_str();
+    while (*p) {
+        char* end;
+        long first = strtol(p, &end, 10);
+        if (end == p)
+            break;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(static_cast<int>(cpu));
+        if (*p == ',')
+            ++p;
+        else
+            break;
+    }
+    return cpus;
+}
+
+static std::string ReadLine(const std::string& path)
+{
+    std::ifstream file(path.c_str());
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+CpuTopology CpuTopology::Detect()
+{
+    CpuTopology topology;
+#ifdef LINUX
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool have_mask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    DIR* dir = opendir("/sys/devices/system/node");
+    if (dir != NULL) {
+        while (struct dirent* entry = readdir(dir)) {
+            if (strncmp(entry->d_name, "node", 4) != 0 || entry->d_name[4] < '0' || entry->d_name[4] > '9')
+                continue;
+            NumaNode node;
+            node.id = atoi(entry->d_name + 4);
+            node.cpus = ParseCpuList(ReadLine(std::string("/sys/devices/system/node/") +
+                                              entry->d_name + "/cpulist"));
+            topology.nodes_.push_back(node);
+        }
+        closedir(dir);
+    }
+    if (topology.nodes_.empty()) {
+        NumaNode node;
+        node.id = 0;
+        node.cpus = ParseCpuList(ReadLine("/sys/devices/system/cpu/online"));
+        topology.nodes_.push_back(node);
+    }
+    for (size_t i = 0; i < topology.nodes_.size(); ++i) {
+        std::vector<int>& cpus = topology.nodes_[i].cpus;
+        if (have_mask) {
+            cpus.erase(std::remove_if(cpus.begin(), cpus.end(),
+                    [&](int cpu) { return cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed); }),
+                    cpus.end());
+        }
+    }
+    topology.nodes_.erase(std::remove_if(topology.nodes_.begin(), topology.nodes_.end(),
+            [](const NumaNode& node) { return node.cpus.empty(); }),
+            topology.nodes_.end());
+    std::sort(topology.nodes_.begin(), topology.nodes_.end(),
+              [](const NumaNode& a, const NumaNode& b) { return a.id < b.id; });
+#endif
+    return topology;
+}
+
+size_t CpuTopology::cpuCount() const
+{
+    size_t count = 0;
+    for (size_t i = 0; i < nodes_.size(); ++i)
+        count += nodes_[i].cpus.size();
+    return count;
+}
+
+int CpuTopology::nodeOf(int cpu) const
+{
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+        if (std::find(nodes_[i].cpus.begin(), nodes_[i].cpus.end(), cpu) != nodes_[i].cpus.end())
+            return nodes_[i].id;
+    }
+    return -1;
+}
+
+ThreadPlacement::ThreadPlacement() :
+        policy_(kNone),
+        next_(0),
+        memory_node_(-1)
+{
+}
+
+size_t ThreadPlacement::configuredThreads()
+{
+    return static_cast<size_t>(std::max(g_threads->val(), 1));
+}
+
+void ThreadPlacement::plan(size_t threads)
+{
+    const std::string& affinity = g_affinity->val();
+    policy_ = affinity == "compact" ? kCompact : affinity == "spread" ? kSpread : kNone;
+    topology_ = CpuTopology::Detect();
+    plan_.clear();
+    next_ = 0;
+    const std::vector<NumaNode>& nodes = topology_.nodes();
+    if (policy_ == kNone || nodes.empty())
+        return;
+
+    if (policy_ == kCompact) {
+        // The chosen node first, then the others in order.
+        size_t first = 0;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (g_numaNode->val() >= 0 ? nodes[i].id == g_numaNode->val() :
+                    nodes[i].cpus.size() > nodes[first].cpus.size())
+                first = i;
+        }
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            const NumaNode& node = nodes[(first + i) % nodes.size()];
+            plan_.insert(plan_.end(), node.cpus.begin(), node.cpus.end());
+        }
+    } else {
+        for (size_t index = 0; plan_.size() < topology_.cpuCount(); ++index) {
+            for (size_t i = 0; i < nodes.size(); ++i) {
+                if (index < nodes[i].cpus.size())
+                    plan_.push_back(nodes[i].cpus[index]);
+            }
+        }
+    }
+    // More threads than CPUs share them in the same order.
+    while (plan_.size() > threads)
+        plan_.pop_back();
+    for (size_t i = plan_.size(), n = plan_.size(); i < threads && n > 0; ++i)
+        plan_.push_back(plan_[i % n]);
+}
+
+void ThreadPlacement::placeThisThread()
+{
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    Assignment assignment;
+    assignment.tid = gettid();
+    assignment.cpu = -1;
+    assignment.node = -1;
+    if (next_ < plan_.size()) {
+        int cpu = plan_[next_++];
+#ifdef LINUX
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) == 0) {
+            assignment.cpu = cpu;
+            assignment.node = topology_.nodeOf(cpu);
+        }
+#endif
+    }
+    assignments_.push_back(assignment);
+}
+
+void ThreadPlacement::placeScheduler(Scheduler* sched, size_t threads, bool use_caller)
+{
+    {
+        std::lock_guard<std::mutex> scopeLock(lock_);
+        // Reads the policy and detects the topology, which report() and
+        // localMemory() need whatever the policy.
+        plan(threads);
+        assignments_.clear();
+        // Nothing to pin, don't hold up every thread for it.
+        if (policy_ == kNone)
+            return;
+    }
+
+    // One blocking task per spawned thread: none of them can take a second
+    // one before all have arrived, so each lands on a different thread.
+    struct Barrier
+    {
+        std::mutex lock;
+        std::condition_variable cond;
+        size_t arrived;
+    };
+    size_t spawned = use_caller ? threads - 1 : threads;
+    std::shared_ptr<Barrier> barrier(new Barrier());
+    barrier->arrived = 0;
+    for (size_t i = 0; i < spawned; ++i) {
+        sched->schedule([this, barrier, spawned]() {
+            placeThisThread();
+            std::unique_lock<std::mutex> lock(barrier->lock);
+            if (++barrier->arrived == spawned)
+                barrier->cond.notify_all();
+            else
+                barrier->cond.wait(lock, [&]() { return barrier->arrived == spawned; });
+        });
+    }
+    if (use_caller)
+        placeThisThread();
+    std::unique_lock<std::mutex> lock(barrier->lock);
+    barrier->cond.wait(lock, [&]() { return barrier->arrived == spawned; });
+}
+
+int ThreadPlacement::localMemory()
+{
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    if (policy_ == kNone || !g_localMemory->val())
+        return -1;
+#ifdef LINUX
+    int node = topology_.nodeOf(sched_getcpu());
+    if (node < 0 || node >= static_cast<int>(sizeof(unsigned long) * 8))
+        return -1;
+    unsigned long mask = 1ul << node;
+    if (syscall(__NR_set_mempolicy, kMpolPreferred, &mask, sizeof(mask) * 8) != 0)
+        return -1;
+    memory_node_ = node;
+    return node;
+#else
+    return -1;
+#endif
+}
+
+std::vector<ThreadPlacement::Assignment> ThreadPlacement::assignments() const
+{
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    return assignments_;
+}
+
+int ThreadPlacement::memoryNode() const
+{
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    return memory_node_;
+}
+
+void ThreadPlacement::report(std::ostream& os) const
+{
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    const std::vector<NumaNode>& nodes = topology_.nodes();
+    os << "topology: " << nodes.size() << " node(s), " << topology_.cpuCount() << " cpu(s)";
+    os << ", affinity " << PlacementPolicyName(policy_) << std::endl;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        os << "  node " << nodes[i].id << ": cpus";
+        for (size_t j = 0; j < nodes[i].cpus.size(); ++j)
+            os << (j ? "," : " ") << nodes[i].cpus[j];
+        os << std::endl;
+    }
+    for (size_t i = 0; i < assignments_.size(); ++i) {
+        os << "  thread " << assignments_[i].tid << ": ";
+        if (assignments_[i].cpu < 0)
+            os << "unpinned";
+        else
+            os << "cpu " << assignments_[i].cpu << " (node " << assignments_[i].node << ")";
+        os << std::endl;
+    }
+    if (memory_node_ >= 0)
+        os << "  isolate memory: node " << memory_node_ << std::endl;
+}
+
+} } // namespace Mordor::Test
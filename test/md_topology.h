@@ -0,0 +1,128 @@
+#ifndef MD_TOPOLOGY_H_
+#define MD_TOPOLOGY_H_
+
+#include <stddef.h>
+
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#include "mordor/thread.h"
+#include "mordor/util.h"
+
+namespace Mordor
+{
+
+class Scheduler;
+
+namespace Test
+{
+
+struct NumaNode
+{
+    int id;
+    std::vector<int> cpus;      // only those this process may run on
+};
+
+/**
+ * CPUs and NUMA nodes from /sys/devices/system, restricted to the
+ * process's affinity mask. Without NUMA information all CPUs form node 0.
+ */
+class CpuTopology
+{
+public:
+    static CpuTopology Detect();
+
+    const std::vector<NumaNode>& nodes() const
+    {
+        return nodes_;
+    }
+
+    size_t cpuCount() const;
+    // -1 if |cpu| is unknown.
+    int nodeOf(int cpu) const;
+
+private:
+    std::vector<NumaNode> nodes_;
+};
+
+/**
+ * ThreadPlacement
+ *
+ * Pins the IOManager threads to CPUs according to --mdv8.iomanager.affinity:
+ * "compact" fills the CPUs of one node first (--mdv8.iomanager.numanode,
+ * by default the node with the most CPUs), keeping the isolate, its worker
+ * fibers and their memory on one socket; "spread" deals the threads out
+ * over the nodes round robin; "none" leaves placement to the kernel.
+ *
+ * Once pinned, localMemory() asks the kernel to prefer the calling
+ * thread's node for its allocations. The policy only covers pages that
+ * thread faults in, so it also turns on isolate affinity (see
+ * MD_Worker::isolateAffinityConfigured()): then every TASK_V8, and with
+ * it every first touch of the heap, runs on the thread the isolate was
+ * created on.
+ */
+class ThreadPlacement : Mordor::noncopyable
+{
+public:
+    enum Policy {
+        kNone = 0,
+        kCompact,
+        kSpread
+    };
+
+    struct Assignment
+    {
+        tid_t tid;
+        int cpu;        // -1 if not pinned
+        int node;
+    };
+
+    static ThreadPlacement the_singleton;
+
+    // --mdv8.iomanager.threads
+    static size_t configuredThreads();
+
+    // Pins every thread of |sched|, which was just created with |threads|
+    // threads, before it runs anything else.
+    void placeScheduler(Scheduler* sched, size_t threads, bool use_caller);
+
+    // Prefers memory of the calling thread's node. Returns the node, or -1
+    // if threads are not pinned or the kernel refused.
+    int localMemory();
+
+    Policy policy() const
+    {
+        return policy_;
+    }
+
+    const CpuTopology& topology() const
+    {
+        return topology_;
+    }
+
+    std::vector<Assignment> assignments() const;
+    int memoryNode() const;
+
+    void report(std::ostream& os) const;
+
+private:
+    ThreadPlacement();
+
+    void plan(size_t threads);
+    void placeThisThread();
+
+    mutable std::mutex lock_;
+    Policy policy_;
+    CpuTopology topology_;
+    std::vector<int> plan_;
+    size_t next_;
+    std::vector<Assignment> assignments_;
+    int memory_node_;
+};
+
+const char* PlacementPolicyName(ThreadPlacement::Policy policy);
+
+} } // namespace Mordor::Test
+
+#endif // MD_TOPOLOGY_H_
@@ -0,0 +1,429 @@
+#ifndef MD_V8_ARGS_H_
+#define MD_V8_ARGS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "v8.h"
+#include "mordor/util.h"
+
+#include "md_env.h"
+#include "md_env_inl.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+// Read-only view over a string argument, UTF-8 encoded. Valid for the
+// duration of the native call only.
+struct StringRef
+{
+    const char* data;
+    size_t length;
+
+    std::string str() const
+    {
+        return std::string(data, length);
+    }
+};
+
+// Mutable view over the bytes of a typed array argument.
+struct ByteSpan
+{
+    uint8_t* data;
+    size_t length;
+};
+
+// The remaining arguments of a variadic binding such as print(), each
+// converted with ToString() and encoded as UTF-8. Only valid as the last
+// parameter, it may be empty.
+struct RestStrings
+{
+    std::vector<std::string> values;
+};
+
+namespace Internal
+{
+
+// What a holder is built from. Converts to the argument for the holders
+// that take a single value.
+struct ArgInput
+{
+    ArgInput(const v8::FunctionCallbackInfo<v8::Value>& args, int index) :
+            args(args), index(index)
+    {
+    }
+
+    operator v8::Local<v8::Value>() const
+    {
+        return args[index];
+    }
+
+    const v8::FunctionCallbackInfo<v8::Value>& args;
+    const int index;
+};
+
+template<typename T> class ArgHolder;
+
+template<>
+class ArgHolder<int32_t> : Mordor::noncopyable
+{
+public:
+    explicit ArgHolder(v8::Local<v8::Value> value) :
+            ok_(value->IsInt32()), value_(ok_ ? value->Int32Value() : 0)
+    {
+    }
+    static const char* expected() { return "an int32"; }
+    bool ok() const { return ok_; }
+    int32_t get() const { return value_; }
+private:
+    bool ok_;
+    int32_t value_;
+};
+
+template<>
+class ArgHolder<uint32_t> : Mordor::noncopyable
+{
+public:
+    explicit ArgHolder(v8::Local<v8::Value> value) :
+            ok_(value->IsUint32()), value_(ok_ ? value->Uint32Value() : 0)
+    {
+    }
+    static const char* expected() { return "a uint32"; }
+    bool ok() const { return ok_; }
+    uint32_t get() const { return value_; }
+private:
+    bool ok_;
+    uint32_t value_;
+};
+
+template<>
+class ArgHolder<double> : Mordor::noncopyable
+{
+public:
+    explicit ArgHolder(v8::Local<v8::Value> value) :
+            ok_(value->IsNumber()), value_(ok_ ? value->NumberValue() : 0)
+    {
+    }
+    static const char* expected() { return "a number"; }
+    bool ok() const { return ok_; }
+    double get() const { return value_; }
+private:
+    bool ok_;
+    double value_;
+};
+
+template<>
+class ArgHolder<bool> : Mordor::noncopyable
+{
+public:
+    explicit ArgHolder(v8::Local<v8::Value> value) :
+            ok_(value->IsBoolean()), value_(ok_ && value->BooleanValue())
+    {
+    }
+    static const char* expected() { return "a boolean"; }
+    bool ok() const { return ok_; }
+    bool get() const { return value_; }
+private:
+    bool ok_;
+    bool value_;
+};
+
+// Strings are encoded as UTF-8, like Utf8Value, but into an inline buffer
+// so the short names and paths bindings usually take need no heap
+// allocation.
+template<>
+class ArgHolder<StringRef> : Mordor::noncopyable
+{
+public:
+    static const int kInlineSize = 256;
+
+    explicit ArgHolder(v8::Local<v8::Value> value) :
+            ok_(false)
+    {
+        ref_.data = NULL;
+        ref_.length = 0;
+        if (!value->IsString())
+            return;
+        v8::Local<v8::String> str = value.As<v8::String>();
+        int length = str->Utf8Length();
+        char* buffer = inline_;
+        if (length >= kInlineSize) {
+            heap_.reset(new char[length + 1]);
+            buffer = heap_.get();
+        }
+        length = str->WriteUtf8(buffer, length + 1);
+        // The count includes the terminating NUL.
+        ref_.data = buffer;
+        ref_.length = length > 0 ? length - 1 : 0;
+        ok_ = true;
+    }
+    static const char* expected() { return "a string"; }
+    bool ok() const { return ok_; }
+    StringRef get() const { return ref_; }
+private:
+    bool ok_;
+    StringRef ref_;
+    char inline_[kInlineSize];
+    std::unique_ptr<char[]> heap_;
+};
+
+// Typed arrays keep their elements in an external array, so the span
+// points straight into the ArrayBuffer backing store.
+template<>
+class ArgHolder<ByteSpan> : Mordor::noncopyable
+{
+public:
+    explicit ArgHolder(v8::Local<v8::Value> value) :
+            ok_(false)
+    {
+        span_.data = NULL;
+        span_.length = 0;
+        if (!value->IsTypedArray())
+            return;
+        v8::Local<v8::TypedArray> array = value.As<v8::TypedArray>();
+        if (!array->HasIndexedPropertiesInExternalArrayData())
+            return;
+        span_.data = static_cast<uint8_t*>(array->GetIndexedPropertiesExternalArrayData());
+        span_.length = array->ByteLength();
+        ok_ = true;
+    }
+    static const char* expected() { return "a typed array"; }
+    bool ok() const { return ok_; }
+    ByteSpan get() const { return span_; }
+private:
+    bool ok_;
+    ByteSpan span_;
+};
+
+template<>
+class ArgHolder<v8::Local<v8::Value> > : Mordor::noncopyable
+{
+public:
+    explicit ArgHolder(v8::Local<v8::Value> value) : value_(value) {}
+    static const char* expected() { return "a value"; }
+    bool ok() const { return true; }
+    v8::Local<v8::Value> get() const { return value_; }
+private:
+    v8::Local<v8::Value> value_;
+};
+
+template<>
+class ArgHolder<RestStrings> : Mordor::noncopyable
+{
+public:
+    explicit ArgHolder(const ArgInput& input)
+    {
+        v8::Isolate* isolate = input.args.GetIsolate();
+        for (int i = input.index; i < input.args.Length(); ++i) {
+            v8::HandleScope handle_scope(isolate);
+            v8::String::Utf8Value str(input.args[i]);
+            rest_.values.push_back(*str ? std::string(*str, str.length())
+                                        : std::string("<string conversion failed>"));
+        }
+    }
+    static const char* expected() { return "strings"; }
+    bool ok() const { return true; }
+    const RestStrings& get() const { return rest_; }
+private:
+    RestStrings rest_;
+};
+
+// Arguments a call must at least pass: all but a trailing RestStrings.
+template<typename... A>
+struct RequiredArgs
+{
+    static const int value = sizeof...(A);
+};
+
+template<typename A, typename... B>
+struct RequiredArgs<A, B...>
+{
+    static const int value = std::is_same<typename std::decay<A>::type, RestStrings>::value
+            ? 0 : 1 + RequiredArgs<B...>::value;
+};
+
+template<typename T>
+struct ReturnConverter;
+
+template<>
+struct ReturnConverter<bool>
+{
+    static void set(v8::ReturnValue<v8::Value> rv, Environment*, bool value) { rv.Set(value); }
+};
+
+template<>
+struct ReturnConverter<int32_t>
+{
+    static void set(v8::ReturnValue<v8::Value> rv, Environment*, int32_t value) { rv.Set(value); }
+};
+
+template<>
+struct ReturnConverter<uint32_t>
+{
+    static void set(v8::ReturnValue<v8::Value> rv, Environment*, uint32_t value) { rv.Set(value); }
+};
+
+template<>
+struct ReturnConverter<double>
+{
+    static void set(v8::ReturnValue<v8::Value> rv, Environment*, double value) { rv.Set(value); }
+};
+
+template<>
+struct ReturnConverter<const char*>
+{
+    static void set(v8::ReturnValue<v8::Value> rv, Environment* env, const char* value)
+    {
+        rv.Set(Utf8String(env->isolate(), value));
+    }
+};
+
+template<>
+struct ReturnConverter<std::string>
+{
+    static void set(v8::ReturnValue<v8::Value> rv, Environment* env, const std::string& value)
+    {
+        rv.Set(Utf8String(env->isolate(), value.data(), value.size()));
+    }
+};
+
+template<typename T>
+struct ReturnConverter<v8::Local<T> >
+{
+    static void set(v8::ReturnValue<v8::Value> rv, Environment*, v8::Local<T> value) { rv.Set(value); }
+};
+
+template<size_t... I> struct Indices {};
+
+template<size_t N, size_t... I>
+struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+
+template<size_t... I>
+struct MakeIndices<0, I...>
+{
+    typedef Indices<I...> type;
+};
+
+template<typename R>
+struct Invoker
+{
+    template<typename F, typename... A>
+    static void call(const v8::FunctionCallbackInfo<v8::Value>& args, Environment* env, F f, A... a)
+    {
+        ReturnConverter<R>::set(args.GetReturnValue(), env, f(env, a...));
+    }
+};
+
+template<>
+struct Invoker<void>
+{
+    template<typename F, typename... A>
+    static void call(const v8::FunctionCallbackInfo<v8::Value>& args, Environment* env, F f, A... a)
+    {
+        f(env, a...);
+    }
+};
+
+// Functions bound before their Environment exists (global templates) have
+// no callback data and fall back to the context lookup.
+inline Environment* CallbackEnvironment(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    if (args.Data()->IsExternal())
+        return Environment::GetCurrent(args);
+    return Environment::GetCurrent(args.GetIsolate());
+}
+
+} // namespace Internal
+
+/**
+ * Runs |fn|, which submits worker tasks, and turns the ways a submission
+ * fails into a JS Error; C++ exceptions must not unwind through V8 frames.
+ * Returns false if it threw one.
+ */
+template<typename Fn>
+inline bool CatchTaskErrors(v8::Isolate* isolate, const Fn& fn)
+{
+    try {
+        fn();
+        return true;
+    } catch (MdTaskShedException&) {
+        Environment::ThrowError(isolate, "Bulk work shed under heap pressure");
+    } catch (MdTaskQueueFullException&) {
+        // --mdv8.queue.overflow=reject
+        Environment::ThrowError(isolate, "Worker queue is full");
+    } catch (MdTaskTimeoutException&) {
+        Environment::ThrowError(isolate, "Worker task timed out");
+    } catch (MdTaskCancelledException&) {
+        Environment::ThrowError(isolate, "Worker task cancelled");
+    }
+    return false;
+}
+
+/**
+ * Adapts a function with a plain C++ signature to a v8::FunctionCallback.
+ *
+ *   static int32_t Add(Environment* env, int32_t a, int32_t b);
+ *   setMethod(object, env, "add", MD_NATIVE_FUNCTION(Add));
+ *
+ * Arguments are type-checked in order and a TypeError naming the first bad
+ * argument is thrown before the function runs. A trailing RestStrings
+ * parameter takes whatever arguments are left. The return value is
+ * converted with Internal::ReturnConverter.
+ */
+template<typename Signature, Signature F> struct NativeFunction;
+
+template<typename R, typename... A, R (*F)(Environment*, A...)>
+struct NativeFunction<R (*)(Environment*, A...), F>
+{
+    static void Callback(const v8::FunctionCallbackInfo<v8::Value>& args)
+    {
+        Environment* env = Internal::CallbackEnvironment(args);
+        if (args.Length() < Internal::RequiredArgs<A...>::value) {
+            char msg[64];
+            snprintf(msg, sizeof(msg), "expected %d argument(s), got %d",
+                     Internal::RequiredArgs<A...>::value, args.Length());
+            env->ThrowTypeError(msg);
+            return;
+        }
+        Unpack(args, env, typename Internal::MakeIndices<sizeof...(A)>::type());
+    }
+
+private:
+    template<size_t... I>
+    static void Unpack(const v8::FunctionCallbackInfo<v8::Value>& args, Environment* env, Internal::Indices<I...>)
+    {
+        std::tuple<Internal::ArgHolder<typename std::decay<A>::type>...> holders(
+                Internal::ArgInput(args, I)...);
+
+        // The leading true keeps the arrays non-empty for nullary functions.
+        const bool ok[] = { true, std::get<I>(holders).ok()... };
+        const char* expected[] = { NULL, Internal::ArgHolder<typename std::decay<A>::type>::expected()... };
+        for (size_t i = 1; i < sizeof(ok) / sizeof(ok[0]); ++i) {
+            if (!ok[i]) {
+                char msg[96];
+                snprintf(msg, sizeof(msg), "argument %d must be %s", static_cast<int>(i), expected[i]);
+                env->ThrowTypeError(msg);
+                return;
+            }
+        }
+        CatchTaskErrors(env->isolate(), [&]() {
+            Internal::Invoker<R>::call(args, env, F, std::get<I>(holders).get()...);
+        });
+    }
+};
+
+#define MD_NATIVE_FUNCTION(fn)                                                \
+  (&Mordor::Test::NativeFunction<decltype(&fn), &fn>::Callback)
+
+} } // namespace Mordor::Test
+
+#endif // MD_V8_ARGS_H_
@@ -107,7 +107,10 @@ inline v8::Local<v8::String> OneByteString(v8::Isolate* isolate,
                                            const unsigned char* data,
                                            int length = -1);
 
-inline void Wrap(v8::Local<v8::Object> object, void* pointer);
+// Stores |pointer| in internal field 0 of |object|, the template must have
+// reserved at least one internal field.
+template <typename TypeName>
+inline void Wrap(v8::Local<v8::Object> object, TypeName* pointer);
 
 inline void ClearWrap(v8::Local<v8::Object> object);
 
@@ -106,20 +106,20 @@ inline v8::Local<v8::String> OneByteString(v8::Isolate* isolate, const unsigned
 }
 
 template<typename TypeName>
-void Wrap(v8::Local<v8::Object> object, TypeName* pointer)
+inline void Wrap(v8::Local<v8::Object> object, TypeName* pointer)
 {
     MORDOR_ASSERT(!object.IsEmpty());
     MORDOR_ASSERT(object->InternalFieldCount() > 0);
     object->SetAlignedPointerInInternalField(0, pointer);
 }
 
-void ClearWrap(v8::Local<v8::Object> object)
+inline void ClearWrap(v8::Local<v8::Object> object)
 {
     Wrap<void>(object, NULL);
 }
 
 template<typename TypeName>
-TypeName* Unwrap(v8::Local<v8::Object> object)
+inline TypeName* Unwrap(v8::Local<v8::Object> object)
 {
     MORDOR_ASSERT(!object.IsEmpty());
     MORDOR_ASSERT(object->InternalFieldCount() > 0);
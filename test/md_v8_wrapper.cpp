@@ -17,6 +17,7 @@
 #include "md_worker.h"
 #include "md_task.h"
 #include "md_env.h"
+#include "md_budget.h"
 
 // Extracts a C string from a V8 Utf8Value.
 static const char* ToCString(const v8::String::Utf8Value& value)
@@ -72,6 +73,7 @@ v8::Local<v8::String> ReadFile(v8::Isolate* isolate, const char* name)
     try {
         Stream::ptr inStream(new FileStream(name, FileStream::READ));
         size_t size = inStream->size();
+        ExternalMemory::Scope buffer_memory(size);
 
         Buffer buf;
         size_t readed = 0;
@@ -96,15 +98,15 @@ v8::Handle<v8::Context> MD_V8Wrapper::createContext(v8::Isolate* isolate)
     // Create a template for the global object.
     v8::Handle<v8::ObjectTemplate> global = v8::ObjectTemplate::New(isolate);
     // Bind the global 'print' function to the C++ Print callback.
-    global->Set(toV8String(isolate, "p"), v8::FunctionTemplate::New(isolate, MD_V8Wrapper::Print));
+    global->Set(toV8String(isolate, "p"), v8::FunctionTemplate::New(isolate, MD_NATIVE_FUNCTION(MD_V8Wrapper::Print)));
     // Bind the global 'read' function to the C++ Read callback.
-    global->Set(toV8String(isolate, "read"), v8::FunctionTemplate::New(isolate, MD_V8Wrapper::Read));
+    global->Set(toV8String(isolate, "read"), v8::FunctionTemplate::New(isolate, MD_NATIVE_FUNCTION(MD_V8Wrapper::Read)));
     // Bind the global 'load' function to the C++ Load callback.
     global->Set(toV8String(isolate, "load"), v8::FunctionTemplate::New(isolate, MD_V8Wrapper::Load));
     // Bind the 'version' function
-    global->Set(toV8String(isolate, "v"), v8::FunctionTemplate::New(isolate, MD_V8Wrapper::Version));
+    global->Set(toV8String(isolate, "v"), v8::FunctionTemplate::New(isolate, MD_NATIVE_FUNCTION(MD_V8Wrapper::Version)));
 
-    global->Set(toV8String(isolate, "e"), v8::FunctionTemplate::New(isolate, MD_V8Wrapper::Exception));
+    global->Set(toV8String(isolate, "e"), v8::FunctionTemplate::New(isolate, MD_NATIVE_FUNCTION(MD_V8Wrapper::Exception)));
 
     context = v8::Context::New(isolate, NULL, global);
 
@@ -115,18 +117,34 @@ v8::Handle<v8::Context> MD_V8Wrapper::createContext(v8::Isolate* isolate)
     return context;
 }
 
-void co_execString(MD_Task<bool(TASK_V8)> &self, v8::Handle<v8::String> source)
+void co_execString(MD_Task<bool(TASK_V8)> &self, v8::Handle<v8::String> source, bool* timed_out)
 {
     v8::Isolate* isolate = self.isolate();
     v8::TryCatch try_catch;
     v8::ScriptOrigin origin(MD_V8Wrapper::toV8String(isolate, "md_shell"));
-    v8::Handle<v8::Script> script = v8::Script::Compile(source, &origin);
+    v8::Handle<v8::Script> script;
+    {
+        MD_TRACE_SCOPE("v8", "compile");
+        script = v8::Script::Compile(source, &origin);
+    }
     if (script.IsEmpty()) {
         ::ReportException(isolate, &try_catch);
         self.setResult(false);
         return;
     } else {
-        v8::Handle<v8::Value> result = script->Run();
+        v8::Handle<v8::Value> result;
+        {
+            MD_TRACE_SCOPE("v8", "run");
+            ExecutionBudget budget(isolate, dynamic_cast<TimerManager*>(Scheduler::getThis()));
+            result = script->Run();
+            if (result.IsEmpty() && budget.recover()) {
+                if (timed_out)
+                    *timed_out = true;
+                budget.throwTimeout();
+            } else if (result.IsEmpty() && HeapGuard::Get(isolate)->recover()) {
+                HeapGuard::Get(isolate)->throwOutOfMemory();
+            }
+        }
         if (result.IsEmpty()) {
             assert(try_catch.HasCaught());
             // Print errors that happened during executio
@@ -161,10 +179,12 @@ bool MD_V8Wrapper::execString(
         Environment* env,
         v8::Handle<v8::String> source,
         bool print_result,
-        bool report_exceptions)
+        bool report_exceptions,
+        bool* timed_out)
 {
     bool result;
-    env->worker()->doTask<bool,TASK_V8>(env->context(), std::bind(&co_execString, std::placeholders::_1, source), result);
+    env->worker()->doTask<bool,TASK_V8>(env->isolate()->GetCurrentContext(), std::bind(&co_execString, std::placeholders::_1, source, timed_out), result,
+            TaskOptions("execString"));
     return result;
 }
 
@@ -198,51 +218,25 @@ static void co_print(MD_Task<void(TASK)> &self, const std::vector<std::string>&
 // The callback that is invoked by v8 whenever the JavaScript 'print'
 // function is called.  Prints its arguments on stdout separated by
 // spaces and ending with a newline.
-void MD_V8Wrapper::Print(const v8::FunctionCallbackInfo<v8::Value>& args)
+void MD_V8Wrapper::Print(Environment* env, const RestStrings& args)
 {
-    v8::Isolate* isolate = args.GetIsolate();
-    std::vector<std::string> strs;
-    for (int i = 0; i < args.Length(); i++) {
-           v8::HandleScope handle_scope(isolate);
-           v8::String::Utf8Value str(args[i]);
-           const char* cstr = ::ToCString(str);
-           strs.push_back(std::string(cstr));
-       }
-    Environment::GetCurrentWorker(isolate)->doTask<void, TASK>(std::bind(&co_print, std::placeholders::_1, std::cref(strs)));
+    env->worker()->doTask<void, TASK>(std::bind(&co_print, std::placeholders::_1, std::cref(args.values)),
+            TaskOptions("print", kLaneInteractive));
 }
 
-static void co_read(MD_Task<v8::Local<v8::String>(TASK_V8)> &self, const v8::FunctionCallbackInfo<v8::Value>& args)
+static void co_read(MD_Task<v8::Local<v8::String>(TASK_V8)> &self, const std::string& file)
 {
-    v8::Isolate* isolate = self.isolate();
-    Environment* env = Environment::GetCurrent(isolate);
-    if (args.Length() != 1) {
-        env->ThrowError("Bad parameters");
-        self.setResult(v8::String::Empty(isolate));
-        return;
-    }
-    v8::String::Utf8Value file(args[0]);
-    if (*file == NULL) {
-        env->ThrowError("Error loading file");
-        self.setResult(v8::String::Empty(isolate));
-        return;
-    }
-    v8::Local<v8::String> source = ReadFile(isolate, *file);
-    if (source.IsEmpty()) {
-        env->ThrowError("Error loading file");
-        self.setResult(v8::String::Empty(isolate));
-        return;
-    }
-
-    self.setResult(source);
+    self.setResult(ReadFile(self.isolate(), file.c_str()));
 }
 
-void MD_V8Wrapper::Read(const v8::FunctionCallbackInfo<v8::Value>& args)
+v8::Local<v8::String> MD_V8Wrapper::Read(Environment* env, StringRef file)
 {
-    v8::Isolate* isolate = args.GetIsolate();
     v8::Local<v8::String> source;
-    Environment* env = Environment::GetCurrent(isolate);
-    env->worker()->doTask<v8::Local<v8::String>, TASK_V8>(env->context(), std::bind(&co_read, std::placeholders::_1, args), source);
-    args.GetReturnValue().Set(source);
+    env->worker()->doTask<v8::Local<v8::String>, TASK_V8>(env->isolate()->GetCurrentContext(), std::bind(&co_read, std::placeholders::_1, file.str()), source,
+            TaskOptions("read", kLaneBulk));
+    if (source.IsEmpty())
+        env->ThrowError("Error loading file");
+    return source;
 }
 
 void MD_V8Wrapper::Load(const v8::FunctionCallbackInfo<v8::Value>& args)
@@ -257,14 +251,27 @@ void MD_V8Wrapper::Load(const v8::FunctionCallbackInfo<v8::Value>& args)
             return;
         }
         v8::Local<v8::String> source;
-        env->worker()->doTask<v8::Local<v8::String>, TASK_V8>(env->context(), std::bind(&co_read, std::placeholders::_1, args), source);
+        bool submitted = CatchTaskErrors(isolate, [&]() {
+            env->worker()->doTask<v8::Local<v8::String>, TASK_V8>(env->isolate()->GetCurrentContext(), std::bind(&co_read, std::placeholders::_1, std::string(*file)), source,
+                    TaskOptions("read", kLaneBulk));
+        });
+        if (!submitted)
+            return;
 
         if (source.IsEmpty()) {
             env->ThrowError("Error loading file");
             return;
         }
-        if (!MD_V8Wrapper::execString(Environment::GetCurrent(isolate), source, false, false)) {
-            env->ThrowError("Error executing file");
+        bool timed_out = false;
+        bool ok = false;
+        submitted = CatchTaskErrors(isolate, [&]() {
+            ok = MD_V8Wrapper::execString(Environment::GetCurrent(isolate), source, false, false, &timed_out);
+        });
+        if (!submitted)
+            return;
+        if (!ok) {
+            // Scripts that ran out of budget get an error they can catch.
+            env->ThrowError(timed_out ? "Script execution timed out" : "Error executing file");
             return;
         }
     }
@@ -276,13 +283,11 @@ static void co_version(MD_Task<const char*(TASK)> &self)
     self.setResult(ret);
 }
 
-void MD_V8Wrapper::Version(const v8::FunctionCallbackInfo<v8::Value>& args)
+const char* MD_V8Wrapper::Version(Environment* env)
 {
-    v8::Isolate* isolate = args.GetIsolate();
     const char* result;
-    Environment::GetCurrentWorker(isolate)->doTask<const char*,TASK>(&co_version, result);
-    v8::Handle<v8::Value> ret = MD_V8Wrapper::toV8String(isolate, result);
-    args.GetReturnValue().Set(ret);
+    env->worker()->doTask<const char*,TASK>(&co_version, result, TaskOptions("version", kLaneInteractive));
+    return result;
 }
 
 static void co_exception(MD_Task<void(TASK_V8)> &self, int err)
@@ -294,19 +299,10 @@ static void co_exception(MD_Task<void(TASK_V8)> &self, int err)
     ::ReportException(isolate, &try_catch);
 }
 
-void MD_V8Wrapper::Exception(const v8::FunctionCallbackInfo<v8::Value>& args)
+void MD_V8Wrapper::Exception(Environment* env, int32_t err)
 {
-    v8::Isolate* isolate = args.GetIsolate();
-    Environment* env = Environment::GetCurrent(isolate);
-    if(args.Length() != 1){
-        env->ThrowRangeError("arguments length must be 1.");
-        args.GetReturnValue().Set(v8::Undefined(isolate));
-    }
-
-    v8::Integer* arg = v8::Integer::Cast(*args[0]);
-    int err = arg->Int32Value();
-    env->worker()->doTask<void,TASK_V8>(env->context(), std::bind(&co_exception, std::placeholders::_1, err));
-    args.GetReturnValue().Set(v8::Undefined(isolate));
+    env->worker()->doTask<void,TASK_V8>(env->isolate()->GetCurrentContext(), std::bind(&co_exception, std::placeholders::_1, err),
+            TaskOptions("exception", kLaneInteractive));
 }
 
 } } // namespace Mordor::Test
@@ -6,6 +6,7 @@
 
 #include "md_env.h"
 #include "md_env_inl.h"
+#include "md_v8_args.h"
 
 namespace Mordor
 {
@@ -20,7 +21,9 @@ public:
     // Creates a new execution environment containing the built-in
     // functions.
     static v8::Handle<v8::Context> createContext(v8::Isolate* isolate);
-    static bool execString(Environment* env, v8::Handle<v8::String> source, bool print_result, bool report_exceptions);
+    // |timed_out| is set when the script was stopped by its ExecutionBudget.
+    static bool execString(Environment* env, v8::Handle<v8::String> source, bool print_result, bool report_exceptions,
+                           bool* timed_out = NULL);
     static bool execString(Environment* env, const char* str, bool print_result, bool report_exceptions);
     static bool execString(Environment* env, const std::string& str, bool print_result, bool report_exceptions);
 
@@ -46,11 +49,11 @@ protected:
     // The callback that is invoked by v8 whenever the JavaScript 'print'
     // function is called.  Prints its arguments on stdout separated by
     // spaces and ending with a newline.
-    static void Print(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void Print(Environment* env, const RestStrings& args);
     // The callback that is invoked by v8 whenever the JavaScript 'read'
     // function is called.  This function loads the content of the file named in
     // the argument into a JavaScript string.
-    static void Read(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static v8::Local<v8::String> Read(Environment* env, StringRef file);
     // The callback that is invoked by v8 whenever the JavaScript 'load'
     // function is called.  Loads, compiles and executes its argument
     // JavaScript file.
@@ -59,9 +62,9 @@ protected:
     // function is called.  Quits.
     static void Quit(const v8::FunctionCallbackInfo<v8::Value>& args);
 
-    static void Version(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static const char* Version(Environment* env);
 
-    static void Exception(const v8::FunctionCallbackInfo<v8::Value>& args);
+    static void Exception(Environment* env, int32_t err);
 };
 
 } } // namespace Mordor::Test
@@ -0,0 +1,169 @@
+#include <stdio.h>
+
+#include <algorithm>
+#include <functional>
+
+#include "mordor/config.h"
+#include "mordor/scheduler.h"
+
+#include "md_watchdog.h"
+#include "md_trace.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+static ConfigVar<unsigned int>::ptr g_watchdogInterval =
+        Config::lookup("mdv8.watchdog.interval", 0u,
+                "Interval in ms between isolate lag probes, 0 disables the watchdog");
+static ConfigVar<unsigned int>::ptr g_watchdogThreshold =
+        Config::lookup("mdv8.watchdog.threshold", 200u,
+                "Isolate lag in ms above which the JS stack is captured");
+
+static const int kMaxStallFrames = 32;
+
+IsolateWatchdog* IsolateWatchdog::Create(v8::Isolate* isolate, Scheduler* scheduler)
+{
+    unsigned int interval = g_watchdogInterval->val();
+    TimerManager* timers = dynamic_cast<TimerManager*>(scheduler);
+    if (interval == 0 || timers == NULL)
+        return NULL;
+    return new IsolateWatchdog(isolate, scheduler, timers, interval * 1000ull,
+                               std::max(g_watchdogThreshold->val(), 1u) * 1000ull);
+}
+
+IsolateWatchdog::IsolateWatchdog(v8::Isolate* isolate, Scheduler* scheduler, TimerManager* timers,
+                                 unsigned long long interval, unsigned long long threshold) :
+        isolate_(isolate),
+        scheduler_(scheduler),
+        tid_(gettid()),
+        threshold_(threshold),
+        idle_(false),
+        idle_ended_(0),
+        probe_pending_(false),
+        probe_posted_(0),
+        script_started_(0),
+        stall_reported_(false),
+        stall_lag_(0),
+        stall_count_(0),
+        interrupt_pending_(false),
+        guard_(GuardedTarget<IsolateWatchdog>::Create(this))
+{
+    timer_ = timers->registerTimer(interval,
+            GuardedTarget<IsolateWatchdog>::Bind(guard_, &IsolateWatchdog::onTimer), true);
+}
+
+IsolateWatchdog::~IsolateWatchdog()
+{
+    // Waits out a check in progress. A probe still queued on this thread or
+    // an interrupt V8 has not delivered yet finds nobody to call.
+    guard_->detach();
+    timer_->cancel();
+}
+
+void IsolateWatchdog::setIdle(bool idle)
+{
+    if (!idle)
+        idle_ended_.store(TimerManager::now(), std::memory_order_relaxed);
+    idle_.store(idle, std::memory_order_relaxed);
+}
+
+unsigned long long IsolateWatchdog::waited(unsigned long long posted, unsigned long long now) const
+{
+    unsigned long long since = std::max(posted, idle_ended_.load(std::memory_order_relaxed));
+    return now > since ? now - since : 0;
+}
+
+void IsolateWatchdog::scriptStarted()
+{
+    script_started_.store(TimerManager::now(), std::memory_order_relaxed);
+}
+
+void IsolateWatchdog::scriptFinished()
+{
+    script_started_.store(0, std::memory_order_relaxed);
+    stall_reported_.store(false, std::memory_order_relaxed);
+    // The stack of whatever runs next is not this stall's.
+    interrupt_pending_.store(false, std::memory_order_relaxed);
+}
+
+// Timer thread.
+void IsolateWatchdog::onTimer()
+{
+    if (idle_.load(std::memory_order_relaxed))
+        return;
+    unsigned long long now = TimerManager::now();
+    if (!probe_pending_.exchange(true, std::memory_order_acq_rel)) {
+        probe_posted_.store(now, std::memory_order_relaxed);
+        scheduler_->schedule(
+                GuardedTarget<IsolateWatchdog>::Bind(guard_, &IsolateWatchdog::probe, now), tid_);
+        return;
+    }
+
+    // The previous probe has not run yet, or a single script is hogging
+    // the isolate while its thread stays responsive (e.g. blocked in a
+    // synchronous doTask).
+    unsigned long long lag = waited(probe_posted_.load(std::memory_order_relaxed), now);
+    unsigned long long started = script_started_.load(std::memory_order_relaxed);
+    if (started && now - started > lag)
+        lag = now - started;
+    if (lag < threshold_ || stall_reported_.exchange(true, std::memory_order_relaxed))
+        return;
+    stall_lag_.store(lag, std::memory_order_relaxed);
+    stall_count_.fetch_add(1, std::memory_order_relaxed);
+    interrupt_pending_.store(true, std::memory_order_relaxed);
+    GuardedTarget<IsolateWatchdog>::RequestInterrupt(guard_, isolate_, &IsolateWatchdog::onInterrupt);
+}
+
+// Isolate thread.
+void IsolateWatchdog::probe(unsigned long long posted)
+{
+    lag_.record(waited(posted, TimerManager::now()));
+    if (script_started_.load(std::memory_order_relaxed) == 0)
+        stall_reported_.store(false, std::memory_order_relaxed);
+    probe_pending_.store(false, std::memory_order_release);
+}
+
+void IsolateWatchdog::onInterrupt()
+{
+    if (interrupt_pending_.exchange(false, std::memory_order_relaxed))
+        captureStall();
+}
+
+void IsolateWatchdog::captureStall()
+{
+    MD_TRACE_INSTANT("watchdog", "stall");
+    Stall stall;
+    stall.time = TimerManager::now();
+    stall.lag = stall_lag_.load(std::memory_order_relaxed);
+
+    v8::HandleScope handle_scope(isolate_);
+    v8::Local<v8::StackTrace> trace = v8::StackTrace::CurrentStackTrace(isolate_, kMaxStallFrames,
+            v8::StackTrace::kOverview);
+    for (int i = 0; i < trace->GetFrameCount(); ++i) {
+        v8::Local<v8::StackFrame> frame = trace->GetFrame(i);
+        v8::String::Utf8Value name(frame->GetFunctionName());
+        v8::String::Utf8Value script(frame->GetScriptName());
+        char line[512];
+        snprintf(line, sizeof(line), "    at %s (%s:%d:%d)\n",
+                 (*name && name.length()) ? *name : "<anonymous>",
+                 *script ? *script : "<unknown>",
+                 frame->GetLineNumber(), frame->GetColumn());
+        stall.stack += line;
+    }
+    fprintf(stderr, "isolate stalled for %llu ms\n%s", stall.lag / 1000, stall.stack.c_str());
+
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    stalls_.push_back(stall);
+    if (stalls_.size() > kMaxStalls)
+        stalls_.pop_front();
+}
+
+std::deque<IsolateWatchdog::Stall> IsolateWatchdog::stalls() const
+{
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    return stalls_;
+}
+
+} } // namespace Mordor::Test
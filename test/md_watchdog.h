@@ -0,0 +1,126 @@
+#ifndef MD_WATCHDOG_H_
+#define MD_WATCHDOG_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "v8.h"
+#include "mordor/util.h"
+#include "mordor/thread.h"
+#include "mordor/timer.h"
+
+#include "md_guarded.h"
+#include "md_histogram.h"
+
+namespace Mordor
+{
+
+class Scheduler;
+
+namespace Test
+{
+
+/**
+ * IsolateWatchdog
+ *
+ * Every interval a timer posts a probe to the isolate thread; how late the
+ * probe runs is the lag of that thread, recorded in µs. When a probe is
+ * still pending after the threshold, or one script has been running that
+ * long, the isolate is interrupted once to record the JS stack of the
+ * stall.
+ *
+ * The runner marks itself idle while it waits for input, since the prompt
+ * blocks the thread without anything being late.
+ *
+ * V8 delivers the interrupt only when JS runs next, which may be after the
+ * stalled script finished or the watchdog is gone. The timer, the probes
+ * and the interrupt all go through a GuardedTarget the destructor
+ * detaches, and a stack is only captured while the script that stalled is
+ * still running.
+ *
+ * Enabled with --mdv8.watchdog.interval=<ms>, stall threshold is
+ * --mdv8.watchdog.threshold.
+ */
+class IsolateWatchdog : Mordor::noncopyable
+{
+public:
+    static const size_t kMaxStalls = 16;
+
+    struct Stall
+    {
+        unsigned long long time;    // TimerManager::now()
+        unsigned long long lag;     // µs
+        std::string stack;
+    };
+
+    // Must be called on the isolate thread. Returns NULL when disabled.
+    static IsolateWatchdog* Create(v8::Isolate* isolate, Scheduler* scheduler);
+
+    IsolateWatchdog(v8::Isolate* isolate, Scheduler* scheduler, TimerManager* timers,
+                    unsigned long long interval, unsigned long long threshold);
+    ~IsolateWatchdog();
+
+    void setIdle(bool idle);
+
+    // Called around script execution on the isolate thread.
+    void scriptStarted();
+    void scriptFinished();
+
+    const Histogram& lag() const
+    {
+        return lag_;
+    }
+
+    uint64_t stallCount() const
+    {
+        return stall_count_.load(std::memory_order_relaxed);
+    }
+
+    // Most recent stalls, oldest first.
+    std::deque<Stall> stalls() const;
+
+private:
+    // Timer thread.
+    void onTimer();
+    // Isolate thread.
+    void probe(unsigned long long posted);
+    void onInterrupt();
+    // Time a probe posted at |posted| has been waiting at |now|, not
+    // counting time spent idle at the prompt.
+    unsigned long long waited(unsigned long long posted, unsigned long long now) const;
+    void captureStall();
+
+    v8::Isolate* const isolate_;
+    Scheduler* const scheduler_;
+    const tid_t tid_;
+    const unsigned long long threshold_;
+    Timer::ptr timer_;
+
+    Histogram lag_;
+    std::atomic<bool> idle_;
+    std::atomic<unsigned long long> idle_ended_;
+    std::atomic<bool> probe_pending_;
+    std::atomic<unsigned long long> probe_posted_;
+    std::atomic<unsigned long long> script_started_;
+    // Set when a stall was reported, cleared when the thread catches up.
+    std::atomic<bool> stall_reported_;
+    std::atomic<unsigned long long> stall_lag_;
+    std::atomic<uint64_t> stall_count_;
+    // An interrupt was requested for the running script.
+    std::atomic<bool> interrupt_pending_;
+    // What the timer, probes and interrupts point at; outlives the
+    // watchdog.
+    GuardedTarget<IsolateWatchdog>::ptr guard_;
+
+    mutable std::mutex lock_;
+    std::deque<Stall> stalls_;
+};
+
+} } // namespace Mordor::Test
+
+#endif // MD_WATCHDOG_H_
@@ -5,36 +5,71 @@
 #include "md_worker.h"
 
 #include <algorithm>
-#include <iostream>
 
 #include "v8/src/base/sys-info.h"
 #include "mordor/assert.h"
+#include "mordor/config.h"
 #include "mordor/iomanager.h"
 #include "mordor/fibersynchronization.h"
 #include "mordor/sleep.h"
 
+#include "md_fiber_pool.h"
+#include "md_topology.h"
+#include "md_trace.h"
+
 namespace Mordor
 {
 namespace Test
 {
 
-MD_Worker* MD_Worker::New(Scheduler* sched, int worker_pool_size)
+static ConfigVar<int>::ptr g_adaptInterval =
+        Config::lookup("mdv8.worker.adaptinterval", 0,
+                       "Milliseconds between worker fiber count adjustments, 0 keeps the count fixed");
+
+static ConfigVar<int>::ptr g_minWorkers =
+        Config::lookup("mdv8.worker.min", 1, "Fewest worker fibers the adaptive controller keeps");
+
+static ConfigVar<int>::ptr g_maxWorkers =
+        Config::lookup("mdv8.worker.max", 16, "Most worker fibers the adaptive controller starts");
+
+static ConfigVar<int>::ptr g_targetWait =
+        Config::lookup("mdv8.worker.targetwait", 2,
+                       "Milliseconds of queue wait above which the adaptive controller adds worker fibers");
+
+static ConfigVar<bool>::ptr g_isolateAffinity =
+        Config::lookup("mdv8.worker.isolateaffinity", false,
+                       "Run tasks that enter V8 on the isolate's thread only");
+
+MD_Worker* MD_Worker::New(Scheduler* sched, int worker_pool_size, tid_t isolate_thread)
 {
-    MD_Worker* mdWorker = new MD_Worker(sched);
+    MD_Worker* mdWorker = new MD_Worker(sched, isolate_thread);
     mdWorker->setWorkerPoolSize(worker_pool_size);
     mdWorker->ensureInitialized();
     return mdWorker;
 }
 
+bool MD_Worker::isolateAffinityConfigured()
+{
+    // Node local memory only holds if V8 touches the heap from one thread.
+    return g_isolateAffinity->val() || ThreadPlacement::the_singleton.memoryNode() >= 0;
+}
+
 const int MD_Worker::kMaxWorkerFiberSize = 4;
+const double MD_Worker::kGrowUtilization = 0.75;
+const double MD_Worker::kShrinkUtilization = 0.25;
 
-MD_Worker::MD_Worker(Scheduler* sched) : sched_(sched)
+MD_Worker::MD_Worker(Scheduler* sched, tid_t isolate_thread) :
+        sched_(sched), isolate_thread_(isolate_thread),
+        adapt_guard_(GuardedTarget<MD_Worker>::Create(this))
 {
 }
 
 MD_Worker::~MD_Worker()
 {
-    std::lock_guard<std::mutex> scopeLock(lock_);
+    // Waits out an adapt() in progress; later ones find nobody.
+    adapt_guard_->detach();
+    if (adapt_timer_)
+        adapt_timer_->cancel();
     stop();
 }
 
@@ -46,6 +81,14 @@ void MD_Worker::setWorkerPoolSize(int worker_pool_size)
         worker_pool_size = v8::base::SysInfo::NumberOfProcessors();
     }
     worker_pool_size_ = std::max(std::min(worker_pool_size, kMaxWorkerFiberSize), 1);
+    if (g_adaptInterval->val() > 0) {
+        min_workers_ = std::max(g_minWorkers->val(), 1);
+        max_workers_ = std::max(g_maxWorkers->val(), min_workers_);
+        worker_pool_size_ = std::max(std::min(worker_pool_size_, max_workers_), min_workers_);
+        target_wait_ = static_cast<unsigned long long>(std::max(g_targetWait->val(), 0)) * 1000;
+    } else {
+        min_workers_ = max_workers_ = worker_pool_size_;
+    }
 }
 
 void MD_Worker::ensureInitialized()
@@ -55,35 +98,225 @@ void MD_Worker::ensureInitialized()
         return;
     initialized_ = true;
 
-    workers_.resize(worker_pool_size_);
+    for (int i = 0; i < worker_pool_size_; ++i)
+        spawn(&task_queue_);
+    // As many as the shared pool, tasks may nest (load() inside load()).
+    if (isolate_thread_ != emptytid()) {
+        for (int i = 0; i < worker_pool_size_; ++i) {
+            spawn(&isolate_queue_);
+            ++isolate_workers_;
+        }
+    }
 
-    for (int i = 0; i < worker_pool_size_; ++i) {
-        workers_[i] = Fiber::ptr(new Fiber(std::bind(&MD_Worker::run, this)));
+    TimerManager* timers = dynamic_cast<TimerManager*>(sched_);
+    if (min_workers_ < max_workers_ && timers) {
+        last_adapt_ = TimerManager::now();
+        busy_since_ = last_adapt_;
+        adapt_timer_ = timers->registerTimer(
+                static_cast<unsigned long long>(g_adaptInterval->val()) * 1000,
+                GuardedTarget<MD_Worker>::Bind(adapt_guard_, &MD_Worker::adapt), true);
     }
+}
 
-    sched_->schedule(workers_.begin(), workers_.end());
+void MD_Worker::spawn(MD_TaskQueue* queue)
+{
+    // Tasks may enter V8 unless those go to the isolate queue.
+    FiberPool* pool = queue == &task_queue_ && isolate_thread_ != emptytid() ?
+            &FiberPool::small() : &FiberPool::large();
+    Fiber::ptr fiber = pool->acquire(std::bind(&MD_Worker::run, this, queue, pool));
+    workers_.push_back(fiber);
+    ++live_workers_;
+    if (queue == &isolate_queue_)
+        sched_->schedule(fiber, isolate_thread_);
+    else
+        sched_->schedule(fiber);
+}
+
+void MD_Worker::addBusy(int delta)
+{
+    std::lock_guard<std::mutex> scopeLock(busy_lock_);
+    unsigned long long now = TimerManager::now();
+    busy_time_ += static_cast<uint64_t>(busy_) * (now - busy_since_);
+    busy_since_ = now;
+    busy_ += delta;
+}
+
+int MD_Worker::busy(uint64_t* busy_time)
+{
+    std::lock_guard<std::mutex> scopeLock(busy_lock_);
+    if (busy_time)
+        *busy_time = busy_time_ + static_cast<uint64_t>(busy_) * (TimerManager::now() - busy_since_);
+    return busy_;
+}
+
+// Timer thread.
+void MD_Worker::adapt()
+{
+    unsigned long long now = TimerManager::now();
+    MD_TaskQueue::Stats queue = task_queue_.stats();
+    size_t queued = task_queue_.size();
+    uint64_t busy_time;
+    int busy = this->busy(&busy_time);
+    bool shrink = false;
+    {
+        std::lock_guard<std::mutex> scopeLock(lock_);
+        if (stopping_)
+            return;
+        int size = live_workers_ - isolate_workers_ - retiring_;
+        // Fibers held by the prompt serve nothing else.
+        int available = std::max(size - input_waiters_.load(std::memory_order_relaxed), 0);
+        double window = static_cast<double>(std::max(now - last_adapt_, 1ull)) * std::max(available, 1);
+        uint64_t dequeued = queue.dequeued - last_dequeued_;
+        mean_wait_ = dequeued > 0 ?
+                static_cast<double>(queue.wait_total - last_wait_total_) / dequeued : 0;
+        // Running tasks are credited up to now, so fibers blocked in long
+        // I/O still read as busy and a long task finishing does not pile
+        // its whole runtime onto one window.
+        utilization_ = std::min((busy_time - last_busy_time_) / window, 1.0);
+        last_adapt_ = now;
+        last_busy_time_ = busy_time;
+        last_dequeued_ = queue.dequeued;
+        last_wait_total_ = queue.wait_total;
+
+        bool waiting = mean_wait_ > target_wait_ || (queued > 0 && busy >= available);
+        if (waiting && (utilization_ >= kGrowUtilization || available == 0) &&
+                size < max_workers_) {
+            MD_TRACE_INSTANT("worker", "grow");
+            spawn(&task_queue_);
+            ++grows_;
+        } else if (!waiting && queued == 0 && utilization_ < kShrinkUtilization &&
+                   size > min_workers_) {
+            MD_TRACE_INSTANT("worker", "shrink");
+            ++retiring_;
+            ++shrinks_;
+            shrink = true;
+        }
+    }
+    if (shrink)
+        task_queue_.release();
+}
+
+void MD_Worker::submitControlled(Task& task, const TaskOptions& options)
+{
+    typedef Internal::TaskControl TaskControl;
+    std::shared_ptr<TaskControl> control(new TaskControl(&task));
+    task.setControl(control);
+    if (options.token && !options.token->bind(control))
+        MORDOR_THROW_EXCEPTION(MdTaskCancelledException());
+
+    Timer::ptr timer;
+    if (options.deadline != 0) {
+        unsigned long long now = TimerManager::now();
+        if (now >= options.deadline)
+            MORDOR_THROW_EXCEPTION(MdTaskTimeoutException());
+        // Without a TimerManager the deadline is only checked at dequeue.
+        TimerManager* timers = dynamic_cast<TimerManager*>(sched_);
+        if (timers) {
+            timer = timers->registerTimer(options.deadline - now,
+                    std::bind(&TaskControl::fire, control, TaskControl::kExpired));
+        }
+    }
+
+    try {
+        queueFor(task).append(&task, !onWorkerFiber());
+    } catch (...) {
+        control->detach();
+        if (timer)
+            timer->cancel();
+        throw;
+    }
+    task.waitEvent();
+    TaskControl::Reason reason = control->detach();
+    if (timer)
+        timer->cancel();
+    if (reason == TaskControl::kNone) {
+        task.rethrowError();
+        return;
+    }
+    if (queueFor(task).withdraw(&task)) {
+        if (reason == TaskControl::kCancelled)
+            MORDOR_THROW_EXCEPTION(MdTaskCancelledException());
+        MORDOR_THROW_EXCEPTION(MdTaskTimeoutException());
+    }
+    // A worker got to it first. Whether the first wakeup was the control or
+    // the completion, exactly one more is due.
+    task.waitEvent();
+    task.rethrowError();
+}
+
+bool MD_Worker::onWorkerFiber()
+{
+    Fiber::ptr self = Fiber::getThis();
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    return std::find(workers_.begin(), workers_.end(), self) != workers_.end();
+}
+
+MD_Worker::PoolStats MD_Worker::poolStats()
+{
+    std::lock_guard<std::mutex> scopeLock(lock_);
+    PoolStats stats;
+    stats.size = live_workers_ - isolate_workers_ - retiring_;
+    stats.min = min_workers_;
+    stats.max = max_workers_;
+    stats.busy = busy(NULL);
+    stats.grows = grows_;
+    stats.shrinks = shrinks_;
+    stats.utilization = utilization_;
+    stats.mean_wait = mean_wait_;
+    stats.isolate_affinity = isolate_thread_ != emptytid();
+    return stats;
 }
 
 void MD_Worker::stop()
 {
+    bool wait;
+    {
+        std::lock_guard<std::mutex> scopeLock(lock_);
+        stopping_ = true;
+        wait = live_workers_ > 0;
+    }
     task_queue_.terminate();
-    stop_lock_.wait();
+    isolate_queue_.terminate();
+    if (wait)
+        stop_lock_.wait();
 }
 
-void MD_Worker::run()
+void MD_Worker::run(MD_TaskQueue* queue, FiberPool* pool)
 {
-    Task* task = NULL;
     while (true) {
-        task = task_queue_.getNext();
-        if (!task){
-            if(++termed_workers_ >= worker_pool_size_){
-                stop_lock_.notify();
-            }
-            return;
-        }
-        std::cout << "*** run on fiber:" << Fiber::getThis() << ", tid:" << Mordor::gettid() << std::endl << std::flush;
-        task->Call();
+        Task* task = queue->getNext();
+        if (!task)
+            break;
+        // A wakeup may have resumed us on another thread.
+        if (queue == &isolate_queue_)
+            sched_->switchTo(isolate_thread_);
+        // The pool is sized by the shared queue's load; a prompt waiting
+        // for the user is not load.
+        bool shared = queue == &task_queue_;
+        bool input = task->waitsForInput();
+        if (shared && input)
+            input_waiters_.fetch_add(1, std::memory_order_relaxed);
+        else if (shared)
+            addBusy(1);
+        task->Call(&stats_);
+        // |task| may be gone already.
+        if (shared && input)
+            input_waiters_.fetch_sub(1, std::memory_order_relaxed);
+        else if (shared)
+            addBusy(-1);
+    }
+    pool->recycleSelf();
+    bool last;
+    {
+        std::lock_guard<std::mutex> scopeLock(lock_);
+        workers_.erase(std::remove(workers_.begin(), workers_.end(), Fiber::getThis()), workers_.end());
+        if (retiring_ > 0)
+            --retiring_;
+        last = --live_workers_ == 0 && stopping_;
     }
+    // ~MD_Worker may free us as soon as this returns.
+    if (last)
+        stop_lock_.notify();
 }
 
 } }  // namespace Mordor::Test
@@ -5,14 +5,21 @@
 #ifndef MORDOR_LIBPLATFORM_PLATFORM_H_
 #define MORDOR_LIBPLATFORM_PLATFORM_H_
 
+#include <stdint.h>
+
+#include <atomic>
 #include <mutex>
 #include <memory>
 
 #include "v8.h"
 #include "mordor/fiber.h"
 #include "mordor/fibersynchronization.h"
+#include "mordor/thread.h"
+#include "mordor/timer.h"
 
+#include "md_guarded.h"
 #include "md_task_queue.h"
+#include "md_task_stats.h"
 
 namespace Mordor
 {
@@ -22,85 +29,232 @@ class IOManager;
 namespace Test
 {
 
+class FiberPool;
+
+/**
+ * MD_Worker
+ *
+ * A pool of fibers running the tasks of one MD_TaskQueue. With
+ * --mdv8.worker.adaptinterval set, adapt() resizes the pool between
+ * --mdv8.worker.min and --mdv8.worker.max: it adds a fiber when tasks wait
+ * longer than --mdv8.worker.targetwait ms while the fibers are busy, e.g.
+ * blocked in I/O, and retires one when they are mostly idle.
+ *
+ * Given an isolate thread (--mdv8.worker.isolateaffinity), TASK_V8 tasks
+ * go to a second queue whose fibers only run on that thread, so the
+ * isolate and its caches stay on one core instead of following whichever
+ * IOManager thread picked the task up. The shared pool then only runs
+ * tasks that never enter V8 and uses small stacks.
+ */
 class MD_Worker: Mordor::noncopyable
 {
 public:
+    struct PoolStats
+    {
+        int size;
+        int min;
+        int max;
+        int busy;               // fibers running a task now
+        uint64_t grows;
+        uint64_t shrinks;
+        // Of the last adapt() window.
+        double utilization;     // 0..1
+        double mean_wait;       // microseconds
+        bool isolate_affinity;
+    };
+
     virtual ~MD_Worker();
 
-    static MD_Worker* New(Scheduler* sched, int worker_pool_size = 0);
+    // Tasks needing the isolate run on |isolate_thread| unless it is
+    // emptytid().
+    static MD_Worker* New(Scheduler* sched, int worker_pool_size = 0,
+                          tid_t isolate_thread = emptytid());
+
+    // --mdv8.worker.isolateaffinity, or node local memory being in effect,
+    // see ThreadPlacement::localMemory().
+    static bool isolateAffinityConfigured();
 
+    // Runs |func| on a worker fiber and waits for it. |options| names the
+    // task for the latency statistics and picks its TaskLane. With a
+    // deadline or CancellationToken in |options| this throws
+    // MdTaskTimeoutException or MdTaskCancelledException if the task was
+    // dropped before it ran. Those, and MdTaskQueueFullException, are also
+    // rethrown here when a submission made by |func| failed with them.
     template<typename Result, typename ... ARGS>
-    void doTask(const typename MD_Task<Result(ARGS...)>::CallbackType& func, Result& ret)
+    void doTask(const typename MD_Task<Result(ARGS...)>::CallbackType& func, Result& ret,
+            const TaskOptions& options = TaskOptions())
     {
         MD_Task<Result(ARGS...)> task(func);
-        task_queue_.append(&task);
-        task.waitEvent();
+        submit(task, options);
         ret = task.getResult();
     }
 
     template<typename Result, typename ... ARGS>
-    void doTask(const typename MD_Task<void(ARGS...)>::CallbackType& func)
+    void doTask(const typename MD_Task<void(ARGS...)>::CallbackType& func,
+            const TaskOptions& options = TaskOptions())
     {
         MD_Task<void(ARGS...)> task(func);
-        task_queue_.append(&task);
-        task.waitEvent();
+        submit(task, options);
     }
 
     template<typename Result>
-    void doTask(const typename MD_Task<Result()>::CallbackType& func, Result& ret)
+    void doTask(const typename MD_Task<Result()>::CallbackType& func, Result& ret,
+            const TaskOptions& options = TaskOptions())
     {
         MD_Task<Result()> task(func);
-        task_queue_.append(&task);
-        task.waitEvent();
+        submit(task, options);
         ret = task.getResult();
     }
 
     template<typename Result, typename ... ARGS>
     void doTask(v8::Local<v8::Context> context, const typename MD_Task<Result(ARGS...)>::CallbackType& func,
-            Result& ret)
+            Result& ret, const TaskOptions& options = TaskOptions())
     {
         MD_Task<Result(ARGS...)> task(context, func);
-        task_queue_.append(&task);
-        task.waitEvent();
+        submit(task, options);
         ret = task.getResult();
     }
 
     template<typename Result, typename ... ARGS>
-    void doTask(v8::Local<v8::Context> context, const typename MD_Task<void(ARGS...)>::CallbackType& func)
+    void doTask(v8::Local<v8::Context> context, const typename MD_Task<void(ARGS...)>::CallbackType& func,
+            const TaskOptions& options = TaskOptions())
     {
         MD_Task<void(ARGS...)> task(context, func);
-        task_queue_.append(&task);
-        task.waitEvent();
+        submit(task, options);
     }
 
     template<typename Result>
-    void doTask(v8::Local<v8::Context> context, const typename MD_Task<Result()>::CallbackType& func, Result& ret)
+    void doTask(v8::Local<v8::Context> context, const typename MD_Task<Result()>::CallbackType& func, Result& ret,
+            const TaskOptions& options = TaskOptions())
     {
         MD_Task<Result()> task(context, func);
-        task_queue_.append(&task);
-        task.waitEvent();
+        submit(task, options);
         ret = task.getResult();
     }
 
+    // Tasks submitted but not picked up by a worker fiber yet.
+    size_t queued()
+    {
+        return task_queue_.size() + isolate_queue_.size();
+    }
+
+    MD_TaskQueue::LaneStats laneStats(TaskLane lane)
+    {
+        return task_queue_.laneStats(lane);
+    }
+
+    MD_TaskQueue::Stats queueStats()
+    {
+        return task_queue_.stats();
+    }
+
+    PoolStats poolStats();
+
+    // Turns bulk tasks away from both queues, see HeapGuard.
+    void setShedding(bool shedding)
+    {
+        task_queue_.setShedding(shedding);
+        isolate_queue_.setShedding(shedding);
+    }
+
+    bool shedding() const
+    {
+        return task_queue_.shedding();
+    }
+
+    const TaskStats& stats() const
+    {
+        return stats_;
+    }
+
+    TaskStats& stats()
+    {
+        return stats_;
+    }
+
 private:
-    MD_Worker(Scheduler* sched);
+    MD_Worker(Scheduler* sched, tid_t isolate_thread);
     void setWorkerPoolSize(int worker_pool_size);
     void ensureInitialized();
 
+    void submit(Task& task, const TaskOptions& options)
+    {
+        task.setOptions(options);
+        if (options.deadline != 0 || options.token) {
+            submitControlled(task, options);
+            return;
+        }
+        queueFor(task).append(&task, !onWorkerFiber());
+        task.waitEvent();
+        task.rethrowError();
+    }
+
+    MD_TaskQueue& queueFor(const Task& task)
+    {
+        return task.needsIsolate() && isolate_thread_ != emptytid() ?
+                isolate_queue_ : task_queue_;
+    }
+
+    void submitControlled(Task& task, const TaskOptions& options);
+
+    // Whether the calling fiber is one of the pool's. Those never wait for
+    // queue space, see MD_TaskQueue::append().
+    bool onWorkerFiber();
+
     void stop();
-    void run();
+    void run(MD_TaskQueue* queue, FiberPool* pool);
+
+    // Starts one more worker fiber for |queue|, called with |lock_| held.
+    void spawn(MD_TaskQueue* queue);
+    // Timer thread.
+    void adapt();
+    // Counts a shared queue fiber starting (+1) or finishing (-1) a task.
+    void addBusy(int delta);
+    // Busy fibers now, and busy fiber-µs up to now.
+    int busy(uint64_t* busy_time);
 
 private:
     static const int kMaxWorkerFiberSize;
+    static const double kGrowUtilization;
+    static const double kShrinkUtilization;
 
     std::mutex lock_;
     bool initialized_ { false };
+    bool stopping_ { false };
     int worker_pool_size_ { 0 };
-    int termed_workers_ { 0 };
+    int live_workers_ { 0 };
+    int isolate_workers_ { 0 };
+    int retiring_ { 0 };
+    int min_workers_ { 1 };
+    int max_workers_ { 1 };
     FiberSemaphore stop_lock_ { 0 };
     std::vector<Fiber::ptr> workers_;
     Scheduler* sched_;
+    const tid_t isolate_thread_;
     MD_TaskQueue task_queue_;
+    MD_TaskQueue isolate_queue_;
+    TaskStats stats_;
+
+    // Shared queue fibers running a task, and that count integrated over
+    // time so running tasks are credited to every window they span.
+    std::mutex busy_lock_;
+    int busy_ { 0 };
+    uint64_t busy_time_ { 0 };
+    unsigned long long busy_since_ { 0 };
+    // Shared queue fibers held by a task waiting for input.
+    std::atomic<int> input_waiters_ { 0 };
+    // What the adapt timer points at; outlives the worker.
+    GuardedTarget<MD_Worker>::ptr adapt_guard_;
+    Timer::ptr adapt_timer_;
+    unsigned long long target_wait_ { 0 };
+    unsigned long long last_adapt_ { 0 };
+    uint64_t last_busy_time_ { 0 };
+    uint64_t last_dequeued_ { 0 };
+    uint64_t last_wait_total_ { 0 };
+    uint64_t grows_ { 0 };
+    uint64_t shrinks_ { 0 };
+    double utilization_ { 0 };
+    double mean_wait_ { 0 };
 };
 
 }
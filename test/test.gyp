@@ -1,64 +1,120 @@
 {
+  'variables': {
+    'md_core_sources': [
+      './md_array_buffer_allocator.cpp',
+      './md_budget.cpp',
+      './md_context_pool.cpp',
+      './md_counters.cpp',
+      './md_env.cpp',
+      './md_fiber_pool.cpp',
+      './md_guarded.cpp',
+      './md_heap_snapshot.cpp',
+      './md_idle_gc.cpp',
+      './md_memory.cpp',
+      './md_profiler.cpp',
+      './md_task.cpp',
+      './md_task_queue.cpp',
+      './md_task_stats.cpp',
+      './md_topology.cpp',
+      './md_watchdog.cpp',
+      './md_worker.cpp',
+    ],
+  },
+  'target_defaults': {
+    'dependencies': [
+      '../third_party/openssl/openssl.gyp:openssl',
+      '../third_party/openssl/openssl.gyp:openssl-cli',
+      '../third_party/mordor-base/gyp/mordor.gyp:mordor_base',
+      '../third_party/v8/mordor_v8_patch/gen/v8.gyp:v8',
+      '../third_party/v8/mordor_v8_patch/gen/v8.gyp:v8_libplatform',
+      '../trace/trace.gyp:mordor_trace',
+    ],
+    'include_dirs': [
+      '.',
+      '..',
+      '../third_party',
+      '../third_party/mordor-base',
+      '../third_party/v8/mordor_v8_patch',
+      '../third_party/v8',
+      '../third_party/v8/include',
+    ],
+    'cflags': [ '-std=c++11' ],
+    'cflags_cc!': [ '-fno-rtti', '-fno-exceptions'],
+    'link_settings': {
+      'libraries': [
+        '-L<(PRODUCT_DIR)',
+        '-ldl',
+        ],
+      },
+    'xcode_settings': {
+      'GCC_VERSION': 'com.apple.compilers.llvm.clang.1_0',
+      'GCC_ENABLE_CPP_EXCEPTIONS': 'YES',        # -fno-exceptions
+      'GCC_ENABLE_CPP_RTTI': 'YES',              # -fno-rtti
+      'MACOSX_DEPLOYMENT_TARGET': '10.8',        # OS X Deployment Target: 10.8
+      'CLANG_CXX_LANGUAGE_STANDARD': 'c++11',
+      'CLANG_CXX_LIBRARY': 'libc++', # libc++ requires OS X 10.7 or later
+      'OTHER_LDFLAGS': [
+        '-Wl,-force_load,<(PRODUCT_DIR)/libopenssl.a',
+       ],
+    },
+    'conditions': [
+      ['OS in "linux freebsd"', {
+        'ldflags': [
+          '-Wl,--whole-archive <(PRODUCT_DIR)/libopenssl.a -Wl,--no-whole-archive',
+         ],
+      }],
+     ],
+  },
   'targets': [
     {
       'target_name': 'shell',
       'product_name': 'mordor_shell',
       'type': 'executable',
-      'dependencies': [
-        '../third_party/openssl/openssl.gyp:openssl',
-        '../third_party/openssl/openssl.gyp:openssl-cli',
-        '../third_party/mordor-base/gyp/mordor.gyp:mordor_base',
-        '../third_party/v8/mordor_v8_patch/gen/v8.gyp:v8',
-        '../third_party/v8/mordor_v8_patch/gen/v8.gyp:v8_libplatform',
-      ],
-      'include_dirs': [
-        '.',
-        '..',
-        '../third_party',
-        '../third_party/mordor-base',
-        '../third_party/v8/mordor_v8_patch',
-        '../third_party/v8',
-        '../third_party/v8/include',
-      ],
       'sources': [
+        '<@(md_core_sources)',
+        './js_objects/bench.cpp',
         './js_objects/process.cpp',
+        './js_objects/profiler.cpp',
+        './js_objects/tracing.cpp',
         './md_runner.cpp',
         './md_readline.cpp',
         './md_shell.cpp',
-        './md_env.cpp',
+        './md_signal.cpp',
         './md_v8_wrapper.cpp',
-        './md_task_queue.cpp',
-        './md_worker.cpp',
       ],
-      'cflags': [ '-std=c++11' ],
-      'cflags_cc!': [ '-fno-rtti', '-fno-exceptions'],
       'link_settings': {
         'libraries': [
-          '-L<(PRODUCT_DIR)',
           '-lreadline',
           '-lhistory',
-          '-ldl',
           ],
         },
-      'xcode_settings': {
-        'GCC_VERSION': 'com.apple.compilers.llvm.clang.1_0',
-        'GCC_ENABLE_CPP_EXCEPTIONS': 'YES',        # -fno-exceptions
-        'GCC_ENABLE_CPP_RTTI': 'YES',              # -fno-rtti
-        'MACOSX_DEPLOYMENT_TARGET': '10.8',        # OS X Deployment Target: 10.8
-        'CLANG_CXX_LANGUAGE_STANDARD': 'c++11',
-        'CLANG_CXX_LIBRARY': 'libc++', # libc++ requires OS X 10.7 or later
-        'OTHER_LDFLAGS': [
-          '-Wl,-force_load,<(PRODUCT_DIR)/libopenssl.a',
-         ],
-      },
-      'conditions': [
-        ['OS in "linux freebsd"', {
-          'ldflags': [
-            '-Wl,--whole-archive <(PRODUCT_DIR)/libopenssl.a -Wl,--no-whole-archive',
-           ],
-        }],
-       ],
+    },
+    {
+      'target_name': 'binding_bench',
+      'product_name': 'md_binding_bench',
+      'type': 'executable',
+      'sources': [
+        '<@(md_core_sources)',
+        './bench/md_bench_binding.cpp',
+      ],
+    },
+    {
+      'target_name': 'bench',
+      'product_name': 'md_bench',
+      'type': 'executable',
+      'sources': [
+        '<@(md_core_sources)',
+        './bench/md_bench.cpp',
+        './bench/md_bench_main.cpp',
+      ],
+    },
+    {
+      'target_name': 'counters_tool',
+      'product_name': 'md_counters',
+      'type': 'executable',
+      'sources': [
+        './tools/md_counters_main.cpp',
+      ],
     },
   ],
 }
-
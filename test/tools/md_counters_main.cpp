@@ -0,0 +1,87 @@
+// Prints the V8 counters a shell exports with --mdv8.counters.file.
+//
+//   md_counters <file> [interval-ms [filter]]
+//
+// With an interval the table is printed again every interval, showing the
+// change since the previous print next to each value.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <vector>
+
+#include "md_counters.h"
+
+using namespace Mordor::Test;
+
+static void print(const CounterCollection* collection, const char* filter,
+                  std::vector<int32_t>& previous)
+{
+    uint32_t in_use = __atomic_load_n(&collection->counters_in_use, __ATOMIC_ACQUIRE);
+    if (in_use > CounterCollection::kMaxCounters)
+        in_use = CounterCollection::kMaxCounters;
+    previous.resize(CounterCollection::kMaxCounters, 0);
+    for (uint32_t i = 0; i < in_use; ++i) {
+        const CounterSlot& slot = collection->counters[i];
+        const char* name = reinterpret_cast<const char*>(slot.name);
+        if (filter && strstr(name, filter) == NULL)
+            continue;
+        int32_t count = __atomic_load_n(&slot.count, __ATOMIC_RELAXED);
+        if (slot.is_histogram) {
+            int32_t total = __atomic_load_n(&slot.sample_total, __ATOMIC_RELAXED);
+            printf("%-60s %12d %+10d  avg %.1f\n", name, count, count - previous[i],
+                   count ? static_cast<double>(total) / count : 0.0);
+        } else {
+            printf("%-60s %12d %+10d\n", name, count, count - previous[i]);
+        }
+        previous[i] = count;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <file> [interval-ms [filter]]\n", argv[0]);
+        return 1;
+    }
+    int interval = argc > 2 ? atoi(argv[2]) : 0;
+    const char* filter = argc > 3 ? argv[3] : NULL;
+
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(CounterCollection))) {
+        fprintf(stderr, "%s: not a counters file\n", argv[1]);
+        return 1;
+    }
+    void* memory = mmap(NULL, sizeof(CounterCollection), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    const CounterCollection* collection = static_cast<const CounterCollection*>(memory);
+    if (__atomic_load_n(&collection->magic_number, __ATOMIC_ACQUIRE) != CounterCollection::kMagicNumber) {
+        fprintf(stderr, "%s: bad magic number\n", argv[1]);
+        return 1;
+    }
+
+    std::vector<int32_t> previous;
+    do {
+        print(collection, filter, previous);
+        if (interval > 0) {
+            printf("\n");
+            fflush(stdout);
+            usleep(interval * 1000);
+        }
+    } while (interval > 0);
+    return 0;
+}
@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "mordor/fiber.h"
+#include "mordor/thread.h"
+#include "mordor/timer.h"
+
+#include "md_trace.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+namespace
+{
+
+struct TraceEvent
+{
+    const char* category;
+    const char* name;
+    char phase;         // 'X' complete, 'i' instant, 'a' migrated
+    unsigned long long ts;
+    unsigned long long dur;
+    uintptr_t fiber;
+    unsigned long tid;
+};
+
+// One ring buffer entry. |seq| is 2 * index + 1 while the owner writes the
+// event with that index and 2 * index + 2 once it is complete; the fields
+// are relaxed atomics so a concurrent reader is not a data race.
+struct TraceSlot
+{
+    std::atomic<uint64_t> seq;
+    std::atomic<const char*> category;
+    std::atomic<const char*> name;
+    std::atomic<char> phase;
+    std::atomic<unsigned long long> ts;
+    std::atomic<unsigned long long> dur;
+    std::atomic<uintptr_t> fiber;
+    std::atomic<unsigned long> tid;
+};
+
+// Written by its own thread only, read by Tracer::write().
+struct TraceBuffer
+{
+    TraceBuffer() :
+            head(0), events(new TraceSlot[Tracer::kBufferEvents])
+    {
+        for (size_t i = 0; i < Tracer::kBufferEvents; ++i)
+            events[i].seq.store(0, std::memory_order_relaxed);
+    }
+
+    void add(const TraceEvent& event)
+    {
+        uint64_t index = head.load(std::memory_order_relaxed);
+        TraceSlot& slot = events[index % Tracer::kBufferEvents];
+        slot.seq.store(2 * index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.category.store(event.category, std::memory_order_relaxed);
+        slot.name.store(event.name, std::memory_order_relaxed);
+        slot.phase.store(event.phase, std::memory_order_relaxed);
+        slot.ts.store(event.ts, std::memory_order_relaxed);
+        slot.dur.store(event.dur, std::memory_order_relaxed);
+        slot.fiber.store(event.fiber, std::memory_order_relaxed);
+        slot.tid.store(event.tid, std::memory_order_relaxed);
+        slot.seq.store(2 * index + 2, std::memory_order_release);
+        head.store(index + 1, std::memory_order_release);
+    }
+
+    // Copies the event with |index|, false if it was overwritten or is
+    // being written.
+    bool read(uint64_t index, TraceEvent* event) const
+    {
+        const TraceSlot& slot = events[index % Tracer::kBufferEvents];
+        if (slot.seq.load(std::memory_order_acquire) != 2 * index + 2)
+            return false;
+        event->category = slot.category.load(std::memory_order_relaxed);
+        event->name = slot.name.load(std::memory_order_relaxed);
+        event->phase = slot.phase.load(std::memory_order_relaxed);
+        event->ts = slot.ts.load(std::memory_order_relaxed);
+        event->dur = slot.dur.load(std::memory_order_relaxed);
+        event->fiber = slot.fiber.load(std::memory_order_relaxed);
+        event->tid = slot.tid.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot.seq.load(std::memory_order_relaxed) == 2 * index + 2;
+    }
+
+    std::atomic<uint64_t> head;
+    std::unique_ptr<TraceSlot[]> events;
+};
+
+std::mutex g_registryLock;
+std::vector<std::unique_ptr<TraceBuffer> > g_buffers;
+thread_local TraceBuffer* t_buffer = NULL;
+
+TraceBuffer* threadBuffer()
+{
+    if (t_buffer == NULL) {
+        std::unique_ptr<TraceBuffer> buffer(new TraceBuffer());
+        std::lock_guard<std::mutex> scopeLock(g_registryLock);
+        t_buffer = buffer.get();
+        g_buffers.push_back(std::move(buffer));
+    }
+    return t_buffer;
+}
+
+// Events before the last start() are left in the buffers and skipped by
+// write(); only the owning thread ever touches a buffer's head.
+std::atomic<unsigned long long> g_since(0);
+
+unsigned long currentThread()
+{
+    return static_cast<unsigned long>(gettid());
+}
+
+uintptr_t currentFiber()
+{
+    return reinterpret_cast<uintptr_t>(Fiber::getThis().get());
+}
+
+void writeAll(Stream& stream, const std::string& data)
+{
+    size_t offset = 0;
+    while (offset < data.size())
+        offset += stream.write(data.data() + offset, data.size() - offset);
+}
+
+} // namespace
+
+std::atomic<bool> Tracer::enabled_(false);
+
+void Tracer::start()
+{
+    g_since.store(TimerManager::now(), std::memory_order_relaxed);
+    enabled_.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::stop()
+{
+    enabled_.store(false, std::memory_order_relaxed);
+}
+
+void Tracer::addComplete(const char* category, const char* name,
+                         unsigned long long start, unsigned long long duration)
+{
+    TraceEvent event = { category, name, 'X', start, duration, currentFiber(), currentThread() };
+    threadBuffer()->add(event);
+}
+
+void Tracer::addMigrated(const char* category, const char* name,
+                         unsigned long long start, unsigned long long duration,
+                         unsigned long tid)
+{
+    TraceEvent event = { category, name, 'a', start, duration, currentFiber(), tid };
+    threadBuffer()->add(event);
+}
+
+void Tracer::addInstant(const char* category, const char* name)
+{
+    TraceEvent event = { category, name, 'i', TimerManager::now(), 0, currentFiber(), currentThread() };
+    threadBuffer()->add(event);
+}
+
+size_t Tracer::write(Stream& stream)
+{
+    std::lock_guard<std::mutex> scopeLock(g_registryLock);
+    pid_t pid = getpid();
+    size_t count = 0;
+    std::string chunk("{\"traceEvents\":[");
+    char line[512];
+    unsigned long long since = g_since.load(std::memory_order_relaxed);
+    for (size_t b = 0; b < g_buffers.size(); ++b) {
+        const TraceBuffer& buffer = *g_buffers[b];
+        uint64_t head = buffer.head.load(std::memory_order_acquire);
+        uint64_t size = Tracer::kBufferEvents;
+        uint64_t first = head > size ? head - size : 0;
+        for (uint64_t i = first; i < head; ++i) {
+            TraceEvent event;
+            if (!buffer.read(i, &event) || event.ts < since)
+                continue;
+            int n;
+            if (event.phase == 'X') {
+                n = snprintf(line, sizeof(line),
+                        "%s{\"cat\":\"%s\",\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,"
+                        "\"pid\":%d,\"tid\":%lu,\"args\":{\"fiber\":\"%#lx\"}}",
+                        count ? "," : "", event.category, event.name, event.ts, event.dur,
+                        static_cast<int>(pid), event.tid,
+                        static_cast<unsigned long>(event.fiber));
+            } else if (event.phase == 'a') {
+                n = snprintf(line, sizeof(line),
+                        "%s{\"cat\":\"%s\",\"name\":\"%s\",\"ph\":\"b\",\"id\":\"%#lx\",\"ts\":%llu,"
+                        "\"pid\":%d,\"tid\":%lu},"
+                        "{\"cat\":\"%s\",\"name\":\"%s\",\"ph\":\"e\",\"id\":\"%#lx\",\"ts\":%llu,"
+                        "\"pid\":%d,\"tid\":%lu}",
+                        count ? "," : "", event.category, event.name,
+                        static_cast<unsigned long>(event.fiber), event.ts,
+                        static_cast<int>(pid), event.tid,
+                        event.category, event.name,
+                        static_cast<unsigned long>(event.fiber), event.ts + event.dur,
+                        static_cast<int>(pid), event.tid);
+            } else {
+                n = snprintf(line, sizeof(line),
+                        "%s{\"cat\":\"%s\",\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%llu,"
+                        "\"pid\":%d,\"tid\":%lu,\"args\":{\"fiber\":\"%#lx\"}}",
+                        count ? "," : "", event.category, event.name, event.ts,
+                        static_cast<int>(pid), event.tid,
+                        static_cast<unsigned long>(event.fiber));
+            }
+            if (n <= 0)
+                continue;
+            chunk.append(line, std::min<size_t>(n, sizeof(line) - 1));
+            ++count;
+            if (chunk.size() >= 64 * 1024) {
+                writeAll(stream, chunk);
+                chunk.clear();
+            }
+        }
+    }
+    chunk.append("]}\n");
+    writeAll(stream, chunk);
+    stream.flush();
+    return count;
+}
+
+void TraceScope::begin(const char* category, const char* name)
+{
+    category_ = category;
+    name_ = name;
+    tid_ = currentThread();
+    start_ = TimerManager::now();
+}
+
+void TraceScope::end()
+{
+    unsigned long long duration = TimerManager::now() - start_;
+    if (currentThread() == tid_)
+        Tracer::addComplete(category_, name_, start_, duration);
+    else
+        Tracer::addMigrated(category_, name_, start_, duration, tid_);
+}
+
+} } // namespace Mordor::Test
@@ -0,0 +1,107 @@
+#ifndef MD_TRACE_H_
+#define MD_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "mordor/streams/stream.h"
+
+namespace Mordor
+{
+namespace Test
+{
+
+/**
+ * Event tracer writing Chrome trace_event JSON (chrome://tracing).
+ *
+ * Every thread appends to its own fixed size ring buffer, so recording
+ * takes no lock; the oldest events are overwritten when a buffer is full.
+ * Each slot carries a sequence number, so write() can copy while threads
+ * keep recording and skips slots that are overwritten under it.
+ * While tracing is off the MD_TRACE_* macros cost one relaxed load and a
+ * branch. Category and name must be string literals (or otherwise outlive
+ * the trace).
+ *
+ * A scope whose fiber moved to another thread in between (a task waiting
+ * on an event, say) cannot nest on either thread's track; it is written as
+ * an async begin/end pair keyed by the fiber instead.
+ */
+class Tracer
+{
+public:
+    static const size_t kBufferEvents = 1 << 16;
+
+    static bool enabled()
+    {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    // Discards previously recorded events and starts recording.
+    static void start();
+    static void stop();
+
+    // |start| and |duration| in TimerManager::now() microseconds.
+    static void addComplete(const char* category, const char* name,
+                            unsigned long long start, unsigned long long duration);
+    // Like addComplete() for a fiber that started on thread |tid| and
+    // finishes on another one.
+    static void addMigrated(const char* category, const char* name,
+                            unsigned long long start, unsigned long long duration,
+                            unsigned long tid);
+    static void addInstant(const char* category, const char* name);
+
+    // Writes everything recorded since start() as a JSON trace, returns the
+    // number of events written. May run while threads keep recording.
+    static size_t write(Stream& stream);
+
+private:
+    static std::atomic<bool> enabled_;
+};
+
+class TraceScope
+{
+public:
+    TraceScope(const char* category, const char* name) :
+            start_(0)
+    {
+        if (Tracer::enabled())
+            begin(category, name);
+    }
+
+    ~TraceScope()
+    {
+        if (start_)
+            end();
+    }
+
+private:
+    TraceScope(const TraceScope&);
+    void operator=(const TraceScope&);
+
+    void begin(const char* category, const char* name);
+    void end();
+
+    const char* category_;
+    const char* name_;
+    unsigned long long start_;
+    unsigned long tid_;
+};
+
+#define MD_TRACE_CONCAT_(a, b) a ## b
+#define MD_TRACE_CONCAT(a, b) MD_TRACE_CONCAT_(a, b)
+
+// Records a complete event covering the rest of the enclosing block.
+#define MD_TRACE_SCOPE(category, name)                                        \
+  Mordor::Test::TraceScope MD_TRACE_CONCAT(md_trace_scope_, __LINE__)(category, name)
+
+#define MD_TRACE_INSTANT(category, name)                                      \
+  do {                                                                        \
+    if (Mordor::Test::Tracer::enabled())                                      \
+      Mordor::Test::Tracer::addInstant(category, name);                       \
+  } while (0)
+
+} } // namespace Mordor::Test
+
+#endif // MD_TRACE_H_
@@ -0,0 +1,35 @@
+{
+  'targets': [
+    {
+      'target_name': 'mordor_trace',
+      'product_name': 'mordor_trace',
+      'type': 'static_library',
+      'dependencies': [
+        '../third_party/mordor-base/gyp/mordor.gyp:mordor_base',
+      ],
+      'include_dirs': [
+        '.',
+        '../third_party',
+        '../third_party/mordor-base',
+      ],
+      'direct_dependent_settings': {
+        'include_dirs': [
+          '.',
+        ],
+      },
+      'sources': [
+        'md_trace.cpp',
+      ],
+      'cflags': [ '-std=c++11' ],
+      'cflags_cc!': [ '-fno-rtti', '-fno-exceptions'],
+      'xcode_settings': {
+        'GCC_VERSION': 'com.apple.compilers.llvm.clang.1_0',
+        'GCC_ENABLE_CPP_EXCEPTIONS': 'YES',        # -fno-exceptions
+        'GCC_ENABLE_CPP_RTTI': 'YES',              # -fno-rtti
+        'MACOSX_DEPLOYMENT_TARGET': '10.8',        # OS X Deployment Target: 10.8
+        'CLANG_CXX_LANGUAGE_STANDARD': 'c++11',
+        'CLANG_CXX_LIBRARY': 'libc++',             # libc++ requires OS X 10.7 or later
+      },
+    },
+  ],
+}